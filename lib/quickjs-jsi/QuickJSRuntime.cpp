@@ -1,8 +1,15 @@
 #include <string>
 #include <unordered_set>
 
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include <jsi/instrumentation.h>
+
 #include "quickjs/quickjs.h"
 #include "QuickJSRuntime.h"
+#include "QuickJSSlabAllocator.h"
 
 namespace quickjs {
     using namespace facebook;
@@ -25,22 +32,30 @@ namespace quickjs {
     class QuickJSRuntime : public jsi::Runtime {
     private:
         bool jsRuntimeProvided;
+        std::unique_ptr<QuickJSSlabAllocator> slabAllocator; // must outlive jsRuntime
         JSRuntime *jsRuntime;
         JSContext *jsContext;
+        int evalFlags{JS_EVAL_TYPE_GLOBAL};
+        int64_t lastTrimGCCount{-1};
+        std::unique_ptr<jsi::Instrumentation> jsInstrumentation;
 
         JSAtom atomToString{}, atomLength{}, atomName{};
 
+        // The pointer values are allocated with the runtime allocator, so they are accounted by the GC
+        // and served from the slabs when the slab allocator is used.
+        static void *allocPointerValue(JSContext *ctx, size_t size) {
+            void *ptr = js_malloc(ctx, size);
+            if (!ptr) throw jsi::JSINativeException("Out of memory");
+            return ptr;
+        }
+
         class QuickJSPointerValue final : public jsi::Runtime::PointerValue {
         public:
             void invalidate() override {
-                if (!jsContext) return;
-                JS_FreeValue(jsContext, jsValue);
-                jsValue = JS_UNDEFINED;
-                jsContext = nullptr;
-            }
-
-            ~QuickJSPointerValue() override {
-                invalidate();
+                JSContext *ctx = jsContext;
+                JS_FreeValue(ctx, jsValue);
+                this->~QuickJSPointerValue();
+                js_free(ctx, this);
             }
 
             static PointerValue *clonePointerValue(const PointerValue *pv) {
@@ -49,7 +64,14 @@ namespace quickjs {
             }
 
             static PointerValue *takeJSValue(JSContext *ctx, JSValue val) {
-                return new QuickJSPointerValue(ctx, val);
+                void *ptr;
+                try {
+                    ptr = allocPointerValue(ctx, sizeof(QuickJSPointerValue));
+                } catch (...) {
+                    JS_FreeValue(ctx, val);
+                    throw;
+                }
+                return new (ptr) QuickJSPointerValue(ctx, val);
             }
 
         protected:
@@ -64,14 +86,10 @@ namespace quickjs {
         struct QuickJSAtomPointerValue final : public jsi::Runtime::PointerValue {
         public:
             void invalidate() override {
-                if (!jsContext) return;
-                JS_FreeAtom(jsContext, jsAtom);
-                jsAtom = 0;
-                jsContext = nullptr;
-            }
-
-            ~QuickJSAtomPointerValue() override {
-                invalidate();
+                JSContext *ctx = jsContext;
+                JS_FreeAtom(ctx, jsAtom);
+                this->~QuickJSAtomPointerValue();
+                js_free(ctx, this);
             }
 
             static PointerValue *clonePointerValue(const PointerValue *pv) {
@@ -80,7 +98,14 @@ namespace quickjs {
             }
 
             static PointerValue *takeJSAtom(JSContext *ctx, JSAtom atom) {
-                return new QuickJSAtomPointerValue(ctx, atom);
+                void *ptr;
+                try {
+                    ptr = allocPointerValue(ctx, sizeof(QuickJSAtomPointerValue));
+                } catch (...) {
+                    JS_FreeAtom(ctx, atom);
+                    throw;
+                }
+                return new (ptr) QuickJSAtomPointerValue(ctx, atom);
             }
         protected:
             JSAtom jsAtom;
@@ -147,6 +172,7 @@ namespace quickjs {
                 case JS_TAG_NULL:
                     return {nullptr};
                 case JS_TAG_STRING:
+                case JS_TAG_STRING_ROPE:
                     return {*runtime, make<jsi::String>(QuickJSPointerValue::takeJSValue(runtime->jsContext, jsValue))};
                 case JS_TAG_OBJECT:
                     return {*runtime, make<jsi::Object>(QuickJSPointerValue::takeJSValue(runtime->jsContext, jsValue))};
@@ -260,11 +286,56 @@ namespace quickjs {
             atomLength = JS_NewAtom(jsContext, "length");
             atomName = JS_NewAtom(jsContext, "name");
         }
+        static JSContext *newContext(JSRuntime *rt, uint32_t intrinsics) {
+            JSContext *ctx = JS_NewContextRaw(rt);
+            if (!ctx) return nullptr;
+
+            JS_AddIntrinsicBaseObjects(ctx);
+            JS_AddIntrinsicEval(ctx);
+            if (intrinsics & QuickJSIntrinsicDate) JS_AddIntrinsicDate(ctx);
+            if (intrinsics & QuickJSIntrinsicStringNormalize) JS_AddIntrinsicStringNormalize(ctx);
+            if (intrinsics & (QuickJSIntrinsicRegExpCompiler | QuickJSIntrinsicRegExp)) JS_AddIntrinsicRegExpCompiler(ctx);
+            if (intrinsics & QuickJSIntrinsicRegExp) JS_AddIntrinsicRegExp(ctx);
+            if (intrinsics & QuickJSIntrinsicJSON) JS_AddIntrinsicJSON(ctx);
+            if (intrinsics & QuickJSIntrinsicProxy) JS_AddIntrinsicProxy(ctx);
+            if (intrinsics & QuickJSIntrinsicMapSet) JS_AddIntrinsicMapSet(ctx);
+            if (intrinsics & QuickJSIntrinsicTypedArrays) JS_AddIntrinsicTypedArrays(ctx);
+            if (intrinsics & QuickJSIntrinsicPromise) JS_AddIntrinsicPromise(ctx);
+            if (intrinsics & QuickJSIntrinsicBigInt) JS_AddIntrinsicBigInt(ctx);
+#ifdef CONFIG_BIGNUM
+            if (intrinsics & QuickJSIntrinsicBigFloat) JS_AddIntrinsicBigFloat(ctx);
+            if (intrinsics & QuickJSIntrinsicBigDecimal) JS_AddIntrinsicBigDecimal(ctx);
+            if (intrinsics & QuickJSIntrinsicOperators) JS_AddIntrinsicOperators(ctx);
+#endif
+            return ctx;
+        }
     public:
-        explicit QuickJSRuntime() {
+        explicit QuickJSRuntime(const QuickJSRuntimeConfig &config = {}) {
             jsRuntimeProvided = false;
-            jsRuntime = JS_NewRuntime();
-            jsContext = JS_NewContext(jsRuntime);
+            if (config.mallocFunctions) {
+                jsRuntime = JS_NewRuntime2(config.mallocFunctions, config.mallocOpaque);
+            } else if (config.useSlabAllocator) {
+                slabAllocator = std::make_unique<QuickJSSlabAllocator>();
+                jsRuntime = JS_NewRuntime2(&QuickJSSlabAllocator::mallocFunctions, slabAllocator.get());
+            } else {
+                jsRuntime = JS_NewRuntime();
+            }
+            if (!jsRuntime) throw jsi::JSINativeException("Failed to create QuickJS runtime");
+            if (config.memoryLimit) JS_SetMemoryLimit(jsRuntime, config.memoryLimit);
+            JS_SetGCThreshold(jsRuntime, config.gcThreshold);
+            JS_SetGCSliceBudget(jsRuntime, config.gcSliceBudgetUs);
+            if (config.gcPolicy) {
+                JS_SetGCPolicy(jsRuntime, config.gcPolicy, config.gcPolicyOpaque);
+            } else if (config.gcPolicyOpaque) {
+                JS_SetGCPolicy(jsRuntime, JS_GCAdaptivePolicy, config.gcPolicyOpaque);
+            }
+            JS_SetMaxStackSize(jsRuntime, config.maxStackSize);
+            jsContext = newContext(jsRuntime, config.intrinsics);
+            if (!jsContext) {
+                JS_FreeRuntime(jsRuntime);
+                throw jsi::JSINativeException("Failed to create QuickJS context");
+            }
+            if (config.stripDebugInfo) evalFlags |= JS_EVAL_FLAG_STRIP;
             initCommon();
         }
 
@@ -287,7 +358,7 @@ namespace quickjs {
             JSValue result;
             {
                 PendingExecutionScope scope(*this);
-                result = JS_Eval(jsContext, (const char *) buffer->data(), buffer->size(), sourceURL.c_str(),JS_EVAL_TYPE_GLOBAL);
+                result = JS_Eval(jsContext, (const char *) buffer->data(), buffer->size(), sourceURL.c_str(), evalFlags);
             }
             return takeToJsiValue(this, result);
         }
@@ -316,6 +387,125 @@ namespace quickjs {
             return false;
         }
 
+        class QuickJSInstrumentation final : public jsi::Instrumentation {
+        public:
+            explicit QuickJSInstrumentation(JSRuntime *rt) : jsRuntime(rt) {}
+
+            std::string getRecordedGCStats() override {
+                JSGCStats s;
+                JS_GetGCStats(jsRuntime, &s);
+                std::string json = R"({"type":"quickjs","version":1)";
+                auto add = [&json](const char *name, int64_t value) {
+                    json += ",\"";
+                    json += name;
+                    json += "\":";
+                    json += std::to_string(value);
+                };
+                add("numCollections", s.gc_count);
+                add("numSlices", s.slice_count);
+                add("totalTimeUs", s.total_time_us);
+                add("maxPauseUs", s.max_pause_us);
+                add("lastTimeUs", s.last_time_us);
+                add("lastIntervalUs", s.last_interval_us);
+                add("lastAllocatedBytes", (int64_t)s.last_allocated_size);
+                add("lastSizeBefore", (int64_t)s.last_size_before);
+                add("lastSizeAfter", (int64_t)s.last_size_after);
+                add("nextThreshold", (int64_t)s.threshold);
+                json += "}";
+                return json;
+            }
+
+            std::unordered_map<std::string, int64_t> getHeapInfo(bool includeExpensive) override {
+                JSGCStats s;
+                JS_GetGCStats(jsRuntime, &s);
+                std::unordered_map<std::string, int64_t> info{
+                    {"quickjs_numCollections", s.gc_count},
+                    {"quickjs_gcTotalTimeUs", s.total_time_us},
+                    {"quickjs_gcMaxPauseUs", s.max_pause_us},
+                    {"quickjs_gcThreshold", (int64_t)s.threshold},
+                };
+                if (includeExpensive) {
+                    // computing the usage walks the heap and cancels an incremental collection in progress
+                    JSMemoryUsage usage;
+                    JS_ComputeMemoryUsage(jsRuntime, &usage);
+                    info["quickjs_mallocSize"] = usage.malloc_size;
+                    info["quickjs_mallocCount"] = usage.malloc_count;
+                    info["quickjs_memoryUsedSize"] = usage.memory_used_size;
+                    info["quickjs_objectCount"] = usage.obj_count;
+                    info["quickjs_stringCount"] = usage.str_count;
+                }
+                return info;
+            }
+
+            void collectGarbage() override {
+                JS_RunGC(jsRuntime);
+            }
+
+            void createSnapshotToFile(const std::string &) override {
+                throw jsi::JSINativeException("QuickJS cannot create a heap snapshot");
+            }
+
+            void createSnapshotToStream(std::ostream &) override {
+                throw jsi::JSINativeException("QuickJS cannot create a heap snapshot");
+            }
+
+            std::string flushAndDisableBridgeTrafficTrace() override {
+                return "";
+            }
+
+            void writeBasicBlockProfileTraceToFile(const std::string &) const override {}
+
+            void dumpProfilerSymbolsToFile(const std::string &) const override {}
+
+        private:
+            JSRuntime *jsRuntime;
+        };
+
+        bool notifyIdle(std::chrono::steady_clock::time_point deadline) {
+            auto remainingUs = [deadline]() {
+                return std::chrono::duration_cast<std::chrono::microseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            };
+            if (!JS_RunIdleGC(jsRuntime, remainingUs())) return false;
+
+            // trim once after each collection, the parked runtimes are not walked again
+            JSGCStats stats;
+            JS_GetGCStats(jsRuntime, &stats);
+            if (stats.gc_count == lastTrimGCCount || remainingUs() <= 0) return true;
+            lastTrimGCCount = stats.gc_count;
+            JS_TrimMemory(jsRuntime);
+            if (slabAllocator) slabAllocator->trim();
+#if defined(__GLIBC__)
+            malloc_trim(0);
+#endif
+            return true;
+        }
+
+        bool serializeToJsonUtf8(const jsi::Value &value, std::string &json) {
+            JSValue result;
+            {
+                // toJSON methods and getters may run
+                PendingExecutionScope scope(*this);
+                result = JS_JSONStringify(jsContext, pickJSValueFromJSI(jsContext, value), JS_UNDEFINED, JS_UNDEFINED);
+            }
+            if (JS_IsException(result)) ThrowJSError();
+            json.clear();
+            if (JS_IsUndefined(result)) return false;
+            // an ASCII result is not copied by JS_ToCStringLen
+            size_t len;
+            auto str = JS_ToCStringLen(jsContext, &len, result);
+            JS_FreeValue(jsContext, result);
+            if (!str) ThrowJSError();
+            json.assign(str, len);
+            JS_FreeCString(jsContext, str);
+            return true;
+        }
+
+        jsi::Instrumentation &instrumentation() override {
+            if (!jsInstrumentation) jsInstrumentation = std::make_unique<QuickJSInstrumentation>(jsRuntime);
+            return *jsInstrumentation;
+        }
+
         PointerValue *cloneSymbol(const Runtime::PointerValue *pv) override {
             return QuickJSPointerValue::clonePointerValue(pv);
         }
@@ -398,12 +588,20 @@ namespace quickjs {
 
         std::string utf8(const jsi::String &str) override {
             auto pv = pointerValue(str);
-            auto strResult = JS_ToCString(pv->jsContext, pv->jsValue);
-            auto string = std::string(strResult);
+            // flattens a rope once, the result is kept by the rope
+            size_t len;
+            auto strResult = JS_ToCStringLen(pv->jsContext, &len, pv->jsValue);
+            auto string = std::string(strResult, len);
             JS_FreeCString(pv->jsContext, strResult);
             return string;
         }
 
+        jsi::Value createValueFromJsonUtf8(const uint8_t *json, size_t length) override {
+            // JS_ParseJSON reads the terminating null character of the buffer
+            std::string buffer((const char *)json, length);
+            return takeToJsiValue(this, JS_ParseJSON(jsContext, buffer.c_str(), length, "<json>"));
+        }
+
         jsi::Object createObject() override {
             return make<jsi::Object>(QuickJSPointerValue::takeJSValue(jsContext, JS_NewObject(jsContext)));
         }
@@ -826,4 +1024,20 @@ namespace quickjs {
         if (ctx) return std::make_unique<QuickJSRuntime>(ctx);
         return std::make_unique<QuickJSRuntime>();
     }
+
+    std::unique_ptr<jsi::Runtime> __cdecl makeQuickJSRuntime(const QuickJSRuntimeConfig &config) {
+        return std::make_unique<QuickJSRuntime>(config);
+    }
+
+    bool __cdecl notifyIdle(jsi::Runtime &runtime, std::chrono::steady_clock::time_point deadline) {
+        auto quickJSRuntime = dynamic_cast<QuickJSRuntime *>(&runtime);
+        if (!quickJSRuntime) throw jsi::JSINativeException("notifyIdle: not a QuickJS runtime");
+        return quickJSRuntime->notifyIdle(deadline);
+    }
+
+    bool __cdecl serializeToJsonUtf8(jsi::Runtime &runtime, const jsi::Value &value, std::string &json) {
+        auto quickJSRuntime = dynamic_cast<QuickJSRuntime *>(&runtime);
+        if (!quickJSRuntime) throw jsi::JSINativeException("serializeToJsonUtf8: not a QuickJS runtime");
+        return quickJSRuntime->serializeToJsonUtf8(value, json);
+    }
 }
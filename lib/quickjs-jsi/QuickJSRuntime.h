@@ -1,9 +1,75 @@
 #pragma once
 
+#include <chrono>
+#include <string>
+
 #include <jsi/jsi.h>
 
 struct JSContext;
+struct JSRuntime;
+struct JSMallocFunctions;
+struct JSGCStats;
 
 namespace quickjs {
+    // Intrinsic objects added to the context of a new runtime, see JS_AddIntrinsic* in quickjs.h
+    enum QuickJSIntrinsic : uint32_t {
+        QuickJSIntrinsicBaseObjects = 1u << 0, // always added, the other intrinsics depend on it
+        QuickJSIntrinsicDate = 1u << 1,
+        QuickJSIntrinsicEval = 1u << 2, // always added, it installs the compiler used by evaluateJavaScript
+        QuickJSIntrinsicStringNormalize = 1u << 3,
+        QuickJSIntrinsicRegExpCompiler = 1u << 4,
+        QuickJSIntrinsicRegExp = 1u << 5, // implies RegExpCompiler
+        QuickJSIntrinsicJSON = 1u << 6,
+        QuickJSIntrinsicProxy = 1u << 7,
+        QuickJSIntrinsicMapSet = 1u << 8,
+        QuickJSIntrinsicTypedArrays = 1u << 9,
+        QuickJSIntrinsicPromise = 1u << 10,
+        QuickJSIntrinsicBigInt = 1u << 11,
+        QuickJSIntrinsicBigFloat = 1u << 12, // only with CONFIG_BIGNUM
+        QuickJSIntrinsicBigDecimal = 1u << 13, // only with CONFIG_BIGNUM
+        QuickJSIntrinsicOperators = 1u << 14, // only with CONFIG_BIGNUM
+
+        // the same set as JS_NewContext
+        QuickJSIntrinsicDefault = QuickJSIntrinsicBaseObjects | QuickJSIntrinsicDate | QuickJSIntrinsicEval |
+                                  QuickJSIntrinsicStringNormalize | QuickJSIntrinsicRegExp | QuickJSIntrinsicJSON |
+                                  QuickJSIntrinsicProxy | QuickJSIntrinsicMapSet | QuickJSIntrinsicTypedArrays |
+                                  QuickJSIntrinsicPromise | QuickJSIntrinsicBigInt,
+    };
+
+    struct QuickJSRuntimeConfig {
+        size_t memoryLimit = 0; // 0: no limit
+        size_t gcThreshold = 256 * 1024; // (size_t)-1: disable automatic GC
+        // Run the automatic cycle collection in slices of about this many microseconds interleaved with the
+        // execution instead of one pause proportional to the heap size. 0: disabled
+        int64_t gcSliceBudgetUs = 0;
+        // Returns the heap size triggering the next collection from the statistics of the last one, see JSGCPolicy.
+        // nullptr: JS_GCAdaptivePolicy with gcPolicyOpaque pointing to a JSGCPolicyParams, or nullptr for the defaults
+        size_t (*gcPolicy)(JSRuntime *rt, const JSGCStats *stats, void *opaque) = nullptr;
+        void *gcPolicyOpaque = nullptr;
+        size_t maxStackSize = 256 * 1024; // 0: disable stack size check
+        uint32_t intrinsics = QuickJSIntrinsicDefault; // QuickJSIntrinsic flags
+        bool stripDebugInfo = false; // evaluate scripts in 'strip' mode: no source, line numbers or local names
+
+        // Optional allocator passed to JS_NewRuntime2, it must outlive the runtime.
+        // The functions are responsible for updating the JSMallocState counters and honoring its malloc_limit.
+        const JSMallocFunctions *mallocFunctions = nullptr;
+        void *mallocOpaque = nullptr;
+
+        // Serve the small engine allocations from a QuickJSSlabAllocator owned by the runtime,
+        // ignored when mallocFunctions is set.
+        bool useSlabAllocator = false;
+    };
+
     std::unique_ptr<facebook::jsi::Runtime> __cdecl makeQuickJSRuntime(JSContext *ctx = nullptr);
+    std::unique_ptr<facebook::jsi::Runtime> __cdecl makeQuickJSRuntime(const QuickJSRuntimeConfig &config);
+
+    // Uses the idle time of a runtime created by makeQuickJSRuntime until deadline, between two requests:
+    // advances the cycle collection, then shrinks the oversized hash tables and returns the free allocator memory
+    // to the system. Returns false if collection work is left for the next idle period.
+    bool __cdecl notifyIdle(facebook::jsi::Runtime &runtime, std::chrono::steady_clock::time_point deadline);
+
+    // Serializes value like JSON.stringify(value) into json as UTF-8, reusing its capacity. Returns false and leaves
+    // json empty if the value has no JSON representation (undefined, function or symbol). Throws a jsi::JSError for
+    // the errors of JSON.stringify, for example a circular reference.
+    bool __cdecl serializeToJsonUtf8(facebook::jsi::Runtime &runtime, const facebook::jsi::Value &value, std::string &json);
 }
@@ -10,6 +10,11 @@ std::vector<RuntimeFactory> runtimeGenerators()
   return { RuntimeFactory([]() -> std::unique_ptr<Runtime>
   {
     return quickjs::makeQuickJSRuntime();
+  }), RuntimeFactory([]() -> std::unique_ptr<Runtime>
+  {
+    quickjs::QuickJSRuntimeConfig config;
+    config.useSlabAllocator = true;
+    return quickjs::makeQuickJSRuntime(config);
   }) };
 }
 
@@ -0,0 +1,290 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "QuickJSRuntime.h"
+
+// Micro benchmarks, run manually: quickjs-bench [filter]
+// Each benchmark evaluates its setup code once, then times `iterations` evaluations of its code and reports the best run.
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Benchmark {
+        const char *name;
+        const char *setup;
+        const char *code;
+        int iterations;
+    };
+
+    double runBenchmark(const Benchmark &benchmark, const quickjs::QuickJSRuntimeConfig &config) {
+        auto runtime = quickjs::makeQuickJSRuntime(config);
+        runtime->evaluateJavaScript(std::make_shared<facebook::jsi::StringBuffer>(benchmark.setup), "<setup>");
+        auto code = std::make_shared<facebook::jsi::StringBuffer>(benchmark.code);
+        double best = 0;
+        for (int i = 0; i < benchmark.iterations; ++i) {
+            auto start = Clock::now();
+            runtime->evaluateJavaScript(code, benchmark.name);
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (i == 0 || ms < best) best = ms;
+        }
+        return best;
+    }
+
+    const Benchmark allocationBenchmarks[] = {
+        {"object-churn",
+         "function churn(n) {\n"
+         "  let live = [];\n"
+         "  for (let i = 0; i < n; i++) {\n"
+         "    live.push({ id: i, name: 'item' + (i & 1023), tags: [i, i + 1], parent: live[live.length - 1] });\n"
+         "    if (live.length > 2000) live = [];\n"
+         "  }\n"
+         "}",
+         "churn(300000)", 5},
+        {"closure-churn",
+         "function make(i) { let x = i; return () => x++; }",
+         "for (let i = 0, s = 0; i < 300000; i++) s += make(i)();", 5},
+        {"string-churn",
+         "",
+         "for (let i = 0, a = []; i < 300000; i++) { a[i & 255] = 'k' + i; }", 5},
+    };
+
+    const Benchmark interpreterBenchmarks[] = {
+        {"property-monomorphic",
+         "var p = { x: 1, y: 2 };",
+         "for (let i = 0; i < 1000000; i++) { p.x = p.y + i; }", 5},
+        {"property-polymorphic",
+         "var ps = [{ x: 1 }, { a: 0, x: 2 }, { b: 0, c: 0, x: 3 }, { d: 0, x: 4 }];",
+         "for (let i = 0, s = 0; i < 1000000; i++) { s += ps[i & 3].x; }", 5},
+        {"method-call",
+         "class Point { constructor(x) { this.x = x; } get() { return this.x; } }\n"
+         "class Point3 extends Point {}\n"
+         "var pt = new Point3(1);",
+         "for (let i = 0, s = 0; i < 1000000; i++) { s += pt.get(); }", 5},
+        {"global-variable",
+         "var counter = 0, step = 1;\n"
+         "function tick() { counter += step; }",
+         "for (let i = 0; i < 1000000; i++) { tick(); }", 5},
+        {"string-append",
+         "var piece = 'log line ';",
+         "{ let s = ''; for (let i = 0; i < 200000; i++) { s += piece + i + '\\n'; } s.charAt(0); }", 5},
+        {"string-template",
+         "function fmt(level, msg, i) { return `[${level}] ${msg} #${i}\\n`; }",
+         "{ let out = ''; for (let i = 0; i < 100000; i++) { out = out + fmt('info', 'request handled', i); }\n"
+         "  out.charAt(out.length - 1); }", 5},
+        {"string-search",
+         "var line = ('2024-01-01T00:00:00Z INFO request id=1234 path=/api/v1/items status=200 ').repeat(40)"
+         " + 'user=\u00e9t\u00e9 latency=12ms';\n"
+         "var wline = line + '\u4e2d';",
+         "for (let i = 0, n = 0; i < 2000; i++) {\n"
+         "  n += line.indexOf('latency=') + wline.indexOf('latency=') + line.includes('ERROR');\n"
+         "  n += line.split(' status=').length + line.replace('user=', 'u=').length;\n"
+         "}", 5},
+        {"json-parse",
+         "var records = [];\n"
+         "for (let i = 0; i < 2000; i++)\n"
+         "  records.push({ id: i, name: 'user' + i, email: 'user' + i + '@example.com', active: (i & 1) == 0,\n"
+         "                 score: i * 1.5, tags: ['a', 'b\\n'], address: { city: 'Paris', zip: '75001' } });\n"
+         "var text = JSON.stringify(records), pretty = JSON.stringify(records, null, 2);",
+         "JSON.parse(text); JSON.parse(pretty);", 20},
+        {"json-stringify",
+         "var records = [];\n"
+         "for (let i = 0; i < 2000; i++)\n"
+         "  records.push({ id: i, name: 'user' + i, email: 'user' + i + '@example.com', active: (i & 1) == 0,\n"
+         "                 score: i * 1.5, tags: ['a', 'b\\n'], address: { city: 'Paris', zip: '75001' } });",
+         "JSON.stringify(records);", 20},
+        {"map-lookup",
+         "var ids = new Map(), names = new Map(), owners = [];\n"
+         "for (let i = 0; i < 500000; i++) { ids.set(i * 7, i); names.set('user' + i, i); }\n"
+         "for (let i = 0; i < 100000; i++) owners.push({ i });\n"
+         "var byOwner = new Map(owners.map(o => [o, o.i]));",
+         "for (let i = 0, n = 0; i < 500000; i++) {\n"
+         "  n += ids.get(i * 7) + (ids.has(i) ? 1 : 0) + names.get('user' + (i & 65535)) + byOwner.get(owners[i % 100000]);\n"
+         "}", 5},
+        {"array-sort",
+         "var records = [], ints = [], names = [];\n"
+         "for (let i = 0, x = 1; i < 50000; i++) {\n"
+         "  x = (x * 1103515245 + 12345) & 0x7fffffff;\n"
+         "  records.push({ id: i, score: x % 1000 }); ints.push(x % 100000); names.push('user' + x);\n"
+         "}",
+         "records.slice().sort((a, b) => a.score - b.score); ints.slice().sort(); names.slice().sort();", 5},
+        {"number-stringify",
+         "var points = [];\n"
+         "for (let i = 0; i < 20000; i++)\n"
+         "  points.push({ x: i / 7, y: Math.sqrt(i) * 1e-3, t: 1.6e12 + i * 0.25, v: -i * 1.1e21 });",
+         "JSON.stringify(points); points.map(p => `${p.x},${p.y}`).join();", 10},
+        {"number-parse",
+         "var nums = [];\n"
+         "for (let i = 0; i < 20000; i++) nums.push(i / 7, Math.sqrt(i) * 1e-3, 1.6e12 + i * 0.25, -i * 1.1e21);\n"
+         "var text = JSON.stringify(nums), strs = nums.map(String);",
+         "JSON.parse(text); for (let i = 0; i < strs.length; i++) parseFloat(strs[i]);", 10},
+        {"typed-array-sort",
+         "var f64 = new Float64Array(1000000), i32 = new Int32Array(1000000), u8 = new Uint8Array(1000000);\n"
+         "for (let i = 0, x = 1; i < f64.length; i++) {\n"
+         "  x = (x * 1103515245 + 12345) & 0x7fffffff;\n"
+         "  f64[i] = (x - 1e9) / 3; i32[i] = x - 1e9; u8[i] = x;\n"
+         "}",
+         "f64.slice().sort(); i32.slice().sort(); u8.slice().sort();", 3},
+        {"array-higher-order",
+         "var arr = [];\n"
+         "for (let i = 0; i < 1000; i++) arr.push(i);",
+         "arr.map(x => x * 2).filter(x => x % 3).reduce((s, x) => s + x, 0);\n"
+         "arr.forEach(x => x); arr.every(x => x >= 0); arr.some(x => x < 0);", 2000},
+        {"for-of-array",
+         "var arr = [], pairs = [];\n"
+         "for (let i = 0; i < 1000; i++) { arr.push(i); pairs.push([i, -i]); }",
+         "var s = 0;\n"
+         "for (const x of arr) s += x;\n"
+         "for (const [a, b] of pairs) s += a + b;\n"
+         "s += Math.max(...arr);", 2000},
+        {"arguments-rest",
+         "function sum() { var t = 0; for (var i = 0; i < arguments.length; i++) t += arguments[i]; return t; }\n"
+         "function first(a, ...rest) { return rest.length ? rest[0] : a; }",
+         "for (let i = 0; i < 1000; i++) { sum(i, 1, 2, 3); first(i, i + 1); }", 200},
+        {"apply-spread",
+         "function on(a, b, c) { return a + b + c; }\n"
+         "var args = [1, 2, 3];",
+         "for (let i = 0; i < 1000; i++) { on.apply(null, args); on(...args); }", 200},
+        {"numeric-kernel",
+         "function matmul(a, b, c, n) {\n"
+         "  for (var i = 0; i < n; i++) for (var j = 0; j < n; j++) {\n"
+         "    var s = 0; for (var k = 0; k < n; k++) s += a[i * n + k] * b[k * n + j];\n"
+         "    c[i * n + j] = s > 1e6 ? 1e6 : s; } }\n"
+         "var n = 32, ma = [], mb = [], mc = [];\n"
+         "for (var i = 0; i < n * n; i++) { ma.push(i * 0.5); mb.push(i * 0.25); mc.push(0); }",
+         "matmul(ma, mb, mc, n);", 50},
+        {"let-loop",
+         "function sumBelow(a, max) { let s = 0; for (let i = 0; i < a.length; i++) { if (a[i] < max) s += a[i]; } return s; }\n"
+         "var data = []; for (var i = 0; i < 1000; i++) data.push(i % 100);",
+         "for (let i = 0; i < 10; i++) sumBelow(data, 50);", 200},
+    };
+} // namespace
+
+int main(int argc, char **argv) {
+    const char *filter = argc > 1 ? argv[1] : nullptr;
+
+    quickjs::QuickJSRuntimeConfig mallocConfig;
+    quickjs::QuickJSRuntimeConfig slabConfig;
+    slabConfig.useSlabAllocator = true;
+
+    std::printf("%-24s %12s %12s\n", "allocation", "malloc (ms)", "slab (ms)");
+    for (const auto &benchmark : allocationBenchmarks) {
+        if (filter && !std::strstr(benchmark.name, filter)) continue;
+        double mallocMs = runBenchmark(benchmark, mallocConfig);
+        double slabMs = runBenchmark(benchmark, slabConfig);
+        std::printf("%-24s %12.2f %12.2f\n", benchmark.name, mallocMs, slabMs);
+    }
+
+    std::printf("\n%-24s %12s\n", "interpreter", "time (ms)");
+    for (const auto &benchmark : interpreterBenchmarks) {
+        if (filter && !std::strstr(benchmark.name, filter)) continue;
+        std::printf("%-24s %12.2f\n", benchmark.name, runBenchmark(benchmark, mallocConfig));
+    }
+
+    // runtime creation and destruction, the slab allocator releases its slabs at once
+    if (!filter || std::strstr("runtime-churn", filter)) {
+        double ms[2];
+        for (int v = 0; v < 2; ++v) {
+            auto start = Clock::now();
+            for (int i = 0; i < 200; ++i) {
+                auto runtime = quickjs::makeQuickJSRuntime(v ? slabConfig : mallocConfig);
+                runtime->evaluateJavaScript(std::make_shared<facebook::jsi::StringBuffer>(
+                    "var o = {}; for (var i = 0; i < 1000; i++) o['p' + i] = [i];"), "<churn>");
+            }
+            ms[v] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        }
+        std::printf("%-24s %12.2f %12.2f\n", "runtime-churn x200", ms[0], ms[1]);
+    }
+
+    // UTF-8 <-> JS string transcoding at the JSI boundary: createFromUtf8() and utf8() of a 64 KiB payload
+    const struct {
+        const char *name;
+        const char *unit;
+    } payloads[] = {
+        {"utf8-ascii", "request handled id=1234 "},
+        {"utf8-latin1", "caf\xc3\xa9 r\xc3\xa9sum\xc3\xa9 na\xc3\xafve "},
+        {"utf8-cjk", "\xe4\xb8\xad\xe6\x96\x87\xe6\xb5\x8b\xe8\xaf\x95 "},
+        {"utf8-emoji", "\xf0\x9f\x98\x80\xf0\x9f\x8e\x89 ok "},
+    };
+    bool header = false;
+    for (const auto &payload : payloads) {
+        if (filter && !std::strstr(payload.name, filter)) continue;
+        if (!header) {
+            std::printf("\n%-24s %12s\n", "transcoding", "time (ms)");
+            header = true;
+        }
+        std::string text;
+        while (text.size() < 65536) text += payload.unit;
+        auto runtime = quickjs::makeQuickJSRuntime(mallocConfig);
+        double best = 0;
+        for (int i = 0; i < 5; ++i) {
+            auto start = Clock::now();
+            size_t total = 0;
+            for (int j = 0; j < 200; ++j) {
+                auto str = facebook::jsi::String::createFromUtf8(*runtime, text);
+                total += str.utf8(*runtime).size();
+            }
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (total != text.size() * 200) std::printf("%s: round trip mismatch\n", payload.name);
+            if (i == 0 || ms < best) best = ms;
+        }
+        std::printf("%-24s %12.2f\n", payload.name, best);
+    }
+
+    // typed array bulk operations per element type and length, each row processes 2^22 elements per operation
+    if (!filter || std::strstr("typed-array-bulk", filter)) {
+        const char *types[] = {"Int8Array", "Uint16Array", "Int32Array", "Float32Array", "Float64Array"};
+        const int lengths[] = {64, 4096, 262144};
+        const char *ops[][2] = {
+            {"fill", "a.fill(i & 127);"},
+            {"indexOf", "a.indexOf(1); a.lastIndexOf(1); a.includes(1);"},
+            {"set", "b.set(a);"},
+            {"set-convert", "c.set(a);"},
+        };
+        std::printf("\n%-32s %12s %12s %12s\n", "typed array bulk", "64 (ms)", "4096 (ms)", "262144 (ms)");
+        for (const char *type : types) {
+            for (const auto &op : ops) {
+                std::printf("%-32s", (std::string(op[0]) + " " + type).c_str());
+                for (int length : lengths) {
+                    std::string setup = "var a = new " + std::string(type) + "(" + std::to_string(length) + "), b = a.slice(), c = " +
+                                        (std::strcmp(type, "Float64Array") ? "new Float64Array(a.length);" : "new Int32Array(a.length);");
+                    std::string code = "for (let i = 0; i < " + std::to_string((1 << 22) / length) + "; i++) { " + op[1] + " }";
+                    Benchmark benchmark = {"typed-array-bulk", setup.c_str(), code.c_str(), 5};
+                    std::printf(" %12.2f", runBenchmark(benchmark, mallocConfig));
+                }
+                std::printf("\n");
+            }
+        }
+    }
+
+    // JSON at the JSI boundary: Value::createFromJsonUtf8() and serializeToJsonUtf8() of 10000 small messages
+    if (!filter || std::strstr("json-bridge", filter)) {
+        auto runtime = quickjs::makeQuickJSRuntime(mallocConfig);
+        runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+            "var message = { id: 42, name: 'user42', email: 'user42@example.com', active: true,\n"
+            "                score: 63.5, tags: ['a', 'b\\n'], address: { city: 'Paris', zip: '75001' } };"),
+            "<setup>");
+        auto message = runtime->global().getProperty(*runtime, "message");
+        std::string json;
+        quickjs::serializeToJsonUtf8(*runtime, message, json);
+        double parseBest = 0, serializeBest = 0;
+        for (int i = 0; i < 5; ++i) {
+            auto start = Clock::now();
+            for (int j = 0; j < 10000; ++j)
+                facebook::jsi::Value::createFromJsonUtf8(*runtime, (const uint8_t *)json.data(), json.size());
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (i == 0 || ms < parseBest) parseBest = ms;
+            std::string out;
+            start = Clock::now();
+            for (int j = 0; j < 10000; ++j) quickjs::serializeToJsonUtf8(*runtime, message, out);
+            ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (out != json) std::printf("json-bridge: round trip mismatch\n");
+            if (i == 0 || ms < serializeBest) serializeBest = ms;
+        }
+        std::printf("\n%-24s %12s\n", "json bridge", "time (ms)");
+        std::printf("%-24s %12.2f\n", "json-from-utf8", parseBest);
+        std::printf("%-24s %12.2f\n", "json-to-utf8", serializeBest);
+    }
+    return 0;
+}
@@ -1,6 +1,11 @@
+#include "quickjs/quickjs.h"
 #include "QuickJSRuntime.h"
+#include "QuickJSSlabAllocator.h"
 #include "gtest/gtest.h"
 
+#include <cstring>
+#include <jsi/instrumentation.h>
+
 TEST(QuickJSRuntimeTest, SimpleTest)
 {
     auto runtime = quickjs::makeQuickJSRuntime();
@@ -14,3 +19,634 @@ TEST(QuickJSRuntimeTest, SimpleTest)
 
     EXPECT_EQ(result.getString(*runtime).utf8(*runtime), "result is 4");
 }
+
+TEST(QuickJSRuntimeTest, ConfigIntrinsics)
+{
+    quickjs::QuickJSRuntimeConfig config;
+    config.intrinsics = quickjs::QuickJSIntrinsicBaseObjects | quickjs::QuickJSIntrinsicJSON;
+    auto runtime = quickjs::makeQuickJSRuntime(config);
+
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var result = [typeof JSON, typeof Proxy, typeof Map, typeof Promise].join();"
+        ), "<test_code>");
+
+    auto result = runtime->global().getProperty(*runtime, "result");
+    EXPECT_EQ(result.getString(*runtime).utf8(*runtime), "object,undefined,undefined,undefined");
+}
+
+TEST(QuickJSRuntimeTest, ConfigMemoryLimit)
+{
+    quickjs::QuickJSRuntimeConfig config;
+    config.memoryLimit = 4 * 1024 * 1024;
+    auto runtime = quickjs::makeQuickJSRuntime(config);
+
+    EXPECT_THROW(runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var a = []; for (;;) a.push({});"
+        ), "<test_code>"), facebook::jsi::JSError);
+}
+
+TEST(QuickJSRuntimeTest, SlabAllocator)
+{
+    quickjs::QuickJSSlabAllocator allocator;
+    JSRuntime *rt = JS_NewRuntime2(&quickjs::QuickJSSlabAllocator::mallocFunctions, &allocator);
+    ASSERT_NE(rt, nullptr);
+
+    void *small = js_malloc_rt(rt, 40);
+    void *large = js_malloc_rt(rt, 1000);
+    void *next = js_malloc_rt(rt, 40);
+    for (void *ptr : {small, large, next}) {
+        EXPECT_EQ((uintptr_t)ptr % alignof(std::max_align_t), 0);
+    }
+    js_free_rt(rt, next);
+    EXPECT_EQ(js_malloc_usable_size_rt(rt, small), 48);
+    EXPECT_EQ(js_malloc_usable_size_rt(rt, large), 1000);
+    small = js_realloc_rt(rt, small, 200);
+    EXPECT_EQ(js_malloc_usable_size_rt(rt, small), 224);
+    js_free_rt(rt, small);
+    js_free_rt(rt, large);
+
+    JSContext *ctx = JS_NewContext(rt);
+    const char code[] = "var a = []; for (var i = 0; i < 10000; i++) a.push({i, s: 'x' + i}); a.length";
+    JSValue result = JS_Eval(ctx, code, sizeof(code) - 1, "<test_code>", JS_EVAL_TYPE_GLOBAL);
+    EXPECT_EQ(JS_VALUE_GET_INT(result), 10000);
+    EXPECT_GT(allocator.slabCount(), 0);
+
+    const char release[] = "a = null";
+    JS_FreeValue(ctx, JS_Eval(ctx, release, sizeof(release) - 1, "<test_code>", JS_EVAL_TYPE_GLOBAL));
+    JS_RunGC(rt);
+    size_t slabCount = allocator.slabCount();
+    EXPECT_GT(allocator.trim(), 0);
+    EXPECT_LT(allocator.slabCount(), slabCount);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+TEST(QuickJSRuntimeTest, IncrementalGC)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JS_SetGCThreshold(rt, (size_t)-1);
+    JSContext *ctx = JS_NewContext(rt);
+    auto eval = [ctx](const char *code) {
+        JSValue result = JS_Eval(ctx, code, strlen(code), "<test_code>", JS_EVAL_TYPE_GLOBAL);
+        EXPECT_FALSE(JS_IsException(result));
+        JS_FreeValue(ctx, result);
+    };
+    auto objectCount = [rt]() {
+        JSMemoryUsage usage;
+        JS_ComputeMemoryUsage(rt, &usage);
+        return usage.obj_count;
+    };
+
+    eval("var live = [];"
+         "for (var i = 0; i < 100; i++) { var a = {i}; a.self = a; live.push(a); }"
+         "function cycles(n) { for (var i = 0; i < n; i++) { var a = {}, b = {a}; a.b = b; } }"
+         "function mutate() { live.push(live.shift()); }");
+    int64_t baseline = objectCount();
+    eval("cycles(10000)");
+    EXPECT_GE(objectCount(), baseline + 20000);
+
+    // the graph is modified between the slices: only the garbage cycles are freed
+    int slices = 1;
+    while (!JS_RunGCSlice(rt, 0)) {
+        EXPECT_FALSE(JS_RunIdleGC(rt, 0));
+        eval("mutate()");
+        slices++;
+    }
+    EXPECT_GT(slices, 1);
+    EXPECT_TRUE(JS_RunIdleGC(rt, 0));
+    EXPECT_LT(objectCount(), baseline + 200);
+
+    const char check[] = "live.filter(a => a.self === a).length";
+    JSValue length = JS_Eval(ctx, check, sizeof(check) - 1, "<test_code>", JS_EVAL_TYPE_GLOBAL);
+    EXPECT_EQ(JS_VALUE_GET_INT(length), 100);
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+TEST(QuickJSRuntimeTest, GCPolicy)
+{
+    struct PolicyState {
+        int calls = 0;
+        size_t lastSizeBefore = 0;
+    } state;
+    quickjs::QuickJSRuntimeConfig config;
+    config.gcThreshold = 1024 * 1024;
+    config.gcPolicy = [](JSRuntime *, const JSGCStats *stats, void *opaque) -> size_t {
+        auto state = (PolicyState *)opaque;
+        state->calls++;
+        state->lastSizeBefore = stats->last_size_before;
+        return stats->last_size_after * 2;
+    };
+    config.gcPolicyOpaque = &state;
+    auto runtime = quickjs::makeQuickJSRuntime(config);
+
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "for (var i = 0; i < 100000; i++) { var a = {}, b = {a}; a.b = b; }"
+        ), "<test_code>");
+    EXPECT_GT(state.calls, 0);
+    // the collection runs before the allocation crossing the threshold
+    EXPECT_GE(state.lastSizeBefore, config.gcThreshold - 1024);
+
+    auto info = runtime->instrumentation().getHeapInfo(true);
+    EXPECT_EQ(info["quickjs_numCollections"], state.calls);
+    EXPECT_GE(info["quickjs_gcThreshold"], (int64_t)config.gcThreshold);
+    EXPECT_GT(info["quickjs_objectCount"], 0);
+    EXPECT_NE(runtime->instrumentation().getRecordedGCStats().find("\"numCollections\":"), std::string::npos);
+}
+
+TEST(QuickJSRuntimeTest, GCAdaptivePolicy)
+{
+    JSGCPolicyParams params{0.05, 1.25, 4.0};
+    JSGCStats stats{};
+    stats.last_size_after = 1000000;
+
+    // no garbage found: grow up to max_growth
+    stats.last_size_before = 1000000;
+    EXPECT_EQ(JS_GCAdaptivePolicy(nullptr, &stats, &params), 4000000);
+
+    // mostly garbage: collect sooner
+    stats.last_size_before = 4000000;
+    EXPECT_EQ(JS_GCAdaptivePolicy(nullptr, &stats, &params), 1250000);
+
+    // the collection would take more than 5% of the time at this allocation rate
+    stats.last_time_us = 1000;
+    stats.last_interval_us = 10000;
+    stats.last_allocated_size = 200000;
+    EXPECT_EQ(JS_GCAdaptivePolicy(nullptr, &stats, &params), 1000000 + 20 * 19 * 1000);
+}
+
+TEST(QuickJSRuntimeTest, NotifyIdle)
+{
+    quickjs::QuickJSRuntimeConfig config;
+    config.useSlabAllocator = true;
+    auto runtime = quickjs::makeQuickJSRuntime(config);
+
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var m = new Map();"
+        "for (var i = 0; i < 100000; i++) { var a = {['k' + i]: i}; a.self = a; m.set(i, a); }"
+        "m.clear(); m = null;"
+        ), "<test_code>");
+    auto &instrumentation = runtime->instrumentation();
+    int64_t collections = instrumentation.getHeapInfo(false)["quickjs_numCollections"];
+    int64_t sizeBefore = instrumentation.getHeapInfo(true)["quickjs_mallocSize"];
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    EXPECT_TRUE(quickjs::notifyIdle(*runtime, deadline));
+    EXPECT_GT(instrumentation.getHeapInfo(false)["quickjs_numCollections"], collections);
+    EXPECT_LT(instrumentation.getHeapInfo(true)["quickjs_mallocSize"], sizeBefore / 2);
+
+    EXPECT_TRUE(quickjs::notifyIdle(*runtime, std::chrono::steady_clock::now()));
+    EXPECT_TRUE(quickjs::notifyIdle(*runtime, deadline));
+}
+
+TEST(QuickJSRuntimeTest, InlineCache)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+
+    // the same accesses run before and after each change of the objects or their prototypes
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "function get(o) { return o.x; }" "\n"
+        "function put(o, v) { o.x = v; }" "\n"
+        "var log = [];" "\n"
+        "function check(o) { get(o); get(o); log.push(String(get(o))); }" "\n"
+        "var shapes = [{x: 1}, {a: 0, x: 2}, {b: 0, x: 3}, {c: 0, x: 4}, {d: 0, x: 5}];" "\n"
+        "shapes.forEach(check);" "\n"
+        "function C() {} C.prototype.x = 'proto';" "\n"
+        "var c = new C(); check(c);" "\n"
+        "C.prototype.x = 'updated'; check(c);" "\n"
+        "Object.defineProperty(C.prototype, 'x', {get() { return 'getter'; }, configurable: true}); check(c);" "\n"
+        "delete C.prototype.x; check(c);" "\n"
+        "c.x = 'own'; check(c);" "\n"
+        "Object.setPrototypeOf(c = {}, {x: 'other'}); check(c);" "\n"
+        "check(new Proxy({x: 0}, {get: () => 'trap'}));" "\n"
+        "check(Object.create(new Proxy({}, {get: () => 'trap2'})));" "\n"
+        "var o = {x: 0}; put(o, 1); put(o, 2); Object.freeze(o); put(o, 3); check(o);" "\n"
+        "var result = log.join();" "\n"
+        ), "<test_code>");
+
+    auto result = runtime->global().getProperty(*runtime, "result");
+    EXPECT_EQ(result.getString(*runtime).utf8(*runtime),
+              "1,2,3,4,5,proto,updated,getter,undefined,own,other,trap,trap2,2");
+}
+
+TEST(QuickJSRuntimeTest, GlobalVariableCache)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    auto eval = [&runtime](const char *code) {
+        runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(code), "<test_code>");
+    };
+
+    eval("var log = [];"
+         "function check() { log.push(String(x)); log.push(String(x)); }"
+         "globalThis.x = 'global'; check();"
+         "globalThis.x = 'updated'; check();"
+         "Object.defineProperty(globalThis, 'x', {get() { return 'getter'; }, configurable: true}); check();"
+         "delete globalThis.x; globalThis.x = 're-added'; check();");
+    // a global lexical declaration shadows the property of the global object
+    eval("let x = 'lexical'; check(); x = 'assigned'; check();");
+
+    auto result = runtime->global().getProperty(*runtime, "log");
+    auto log = result.getObject(*runtime).getArray(*runtime);
+    std::string joined;
+    for (size_t i = 0; i < log.size(*runtime); i += 2) {
+        EXPECT_EQ(log.getValueAtIndex(*runtime, i).getString(*runtime).utf8(*runtime),
+                  log.getValueAtIndex(*runtime, i + 1).getString(*runtime).utf8(*runtime));
+        joined += log.getValueAtIndex(*runtime, i).getString(*runtime).utf8(*runtime) + ",";
+    }
+    EXPECT_EQ(joined, "global,updated,getter,re-added,lexical,assigned,");
+}
+
+TEST(QuickJSRuntimeTest, RopeString)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var s = ''; for (var i = 0; i < 3000; i++) s += i % 10;" "\n"
+        "var p = ''; for (var i = 0; i < 3000; i++) p = i % 10 + p;" "\n"
+        "var w = 'x'.repeat(600) + '\u00e9\u4e2d'.repeat(300) + 'y'.repeat(600);" "\n"
+        "var m = new Map([[s, 'map']]);" "\n"
+        "var checks = [s.length, s[2999], p.slice(0, 3), w.length, w.charCodeAt(601)," "\n"
+        "              s === '0123456789'.repeat(300), s < s + '0', m.get('0123456789'.repeat(300))].join();" "\n"
+        "var r1 = 'a'.repeat(600) + '\u4e2d'.repeat(600), r2 = 'a'.repeat(300) + ('a'.repeat(300) + '\u4e2d'.repeat(600));" "\n"
+        "var equals = [r1 === r2, Object.is(r1, r2), [r2].indexOf(r1), r1 === r1.slice(0, -1) + 'b'].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "checks").getString(*runtime).utf8(*runtime),
+              "3000,9,987,1800,20013,true,true,map");
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "equals").getString(*runtime).utf8(*runtime),
+              "true,true,0,false");
+    auto s = runtime->global().getProperty(*runtime, "s");
+    ASSERT_TRUE(s.isString());
+    std::string expected;
+    for (int i = 0; i < 300; i++) expected += "0123456789";
+    EXPECT_EQ(s.getString(*runtime).utf8(*runtime), expected);
+    EXPECT_TRUE(facebook::jsi::String::strictEquals(
+        *runtime, s.getString(*runtime),
+        facebook::jsi::String::createFromUtf8(*runtime, expected)));
+    auto w = runtime->global().getProperty(*runtime, "w").getString(*runtime).utf8(*runtime);
+    EXPECT_EQ(w.size(), 600 + 300 * 5 + 600);
+}
+
+TEST(QuickJSRuntimeTest, StringSearch)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var a = 'ab'.repeat(100) + 'abc' + 'ab'.repeat(100);" "\n"
+        "var w = '\u4e2d'.repeat(100) + 'x\u4e2dy' + '\u4e2d'.repeat(100);" "\n"
+        "var result = [a.indexOf('abc'), a.indexOf('abc', 201), a.indexOf('bca'), a.indexOf('b', 200)," "\n"
+        "              a.includes('cab'), a.includes('cc'), a.split('c').length, a.replace('ca', '-').length," "\n"
+        "              w.indexOf('x\u4e2dy'), w.indexOf('\u4e2dy'), w.indexOf('y'), w.indexOf('xy'), a.indexOf('\u4e2d')].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "200,-1,201,201,true,false,2,402,100,101,102,-1,-1");
+}
+
+TEST(QuickJSRuntimeTest, Utf8Transcoding)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    std::string ascii(100, 'a');
+    const std::string samples[] = {
+        ascii,
+        ascii + "caf\xc3\xa9" + ascii,
+        ascii + "\xe4\xb8\xad" + ascii + "\xc3\xa9",
+        ascii + "\xf0\x9f\x98\x80" + ascii,
+    };
+    for (const auto &sample : samples) {
+        EXPECT_EQ(facebook::jsi::String::createFromUtf8(*runtime, sample).utf8(*runtime), sample);
+    }
+    EXPECT_EQ(facebook::jsi::String::createFromUtf8(*runtime, "ab\xff").utf8(*runtime), "ab\xef\xbf\xbd");
+
+    runtime->global().setProperty(*runtime, "e", facebook::jsi::String::createFromUtf8(*runtime, samples[3]));
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var result = [e.length, e.charCodeAt(100), e.charCodeAt(101), e.charCodeAt(102)].join();" "\n"
+        "var w = 'x'.repeat(40) + '\u00e9\u4e2d' + 'y'.repeat(40) + '\U0001F600';" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "202,55357,56832,97");
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "w").getString(*runtime).utf8(*runtime),
+              std::string(40, 'x') + "\xc3\xa9\xe4\xb8\xad" + std::string(40, 'y') + "\xf0\x9f\x98\x80");
+}
+
+TEST(QuickJSRuntimeTest, JsonParse)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var a = JSON.parse('[{\"id\":1,\"s\":\"x\\\\ny\"},{\"id\":2,\"s\":\"\\\\u00e9\\\\ud83d\\\\ude00\"},{\"s\":3,\"id\":4}]');" "\n"
+        "var o = JSON.parse(' {\"a\" : 1, \"a\" : 2, \"__proto__\" : [ -0, 1.5e2, 12345678901234567890 ] } ');" "\n"
+        "function error(s) { try { JSON.parse(s); } catch (e) { return e.message; } }" "\n"
+        "a[1].id = 5;" "\n"
+        "var result = [a.length, a[0].s, a[1].s.length, a[1].s.codePointAt(1), Object.keys(a[2]), a[0].id, a[1].id," "\n"
+        "              o.a, Object.getPrototypeOf(o) === Object.prototype, Object.is(o.__proto__[0], -0), o.__proto__[1]," "\n"
+        "              o.__proto__[2], error('[1,]'), error('{\"a\":01}'), error('\"\\\\x41\"')].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "3,x\ny,3,128512,s,id,1,5,2,true,true,150,12345678901234567000,"
+              "unexpected token: ']',unexpected token: '0',");
+}
+
+TEST(QuickJSRuntimeTest, JsonStringify)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var o = { b: 1, a: [1.5, -0, 'x\\ny', '\\ud800', null, undefined], 2: true, 1: { toJSON: function (k) { return 'k' + k; } } };" "\n"
+        "Object.defineProperty(o, 'g', { get: function () { return new Date(0); }, enumerable: true });" "\n"
+        "var m = { p: 1, q: { toJSON: function () { delete m.r; m.p = 2; return 0; } }, r: 3, s: 4 };" "\n"
+        "var c = { a: [] }; c.a.push({ b: c });" "\n"
+        "var e; try { JSON.stringify(c); } catch (err) { e = err.message; }" "\n"
+        "Array.prototype.toJSON = function () { return 'A'; };" "\n"
+        "var r = JSON.stringify({ a: [1] });" "\n"
+        "delete Array.prototype.toJSON;" "\n"
+        "var result = [JSON.stringify(o), JSON.stringify(m), e, r, JSON.stringify([function () {}, Symbol()])].join('|');" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "{\"1\":\"k1\",\"2\":true,\"b\":1,\"a\":[1.5,0,\"x\\ny\",\"\\ud800\",null,null],"
+              "\"g\":\"1970-01-01T00:00:00.000Z\"}|{\"p\":1,\"q\":0,\"s\":4}|circular reference|{\"a\":\"A\"}|[null,null]");
+}
+
+TEST(QuickJSRuntimeTest, JsonUtf8)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    // not null terminated
+    const char json[] = "{\"a\":[1,\"\xc3\xa9\"],\"b\":null}xyz";
+    auto value = facebook::jsi::Value::createFromJsonUtf8(*runtime, (const uint8_t *)json, sizeof(json) - 4);
+    auto a = value.asObject(*runtime).getProperty(*runtime, "a").asObject(*runtime).asArray(*runtime);
+    EXPECT_EQ(a.size(*runtime), 2);
+    EXPECT_EQ(a.getValueAtIndex(*runtime, 1).asString(*runtime).utf8(*runtime), "\xc3\xa9");
+    EXPECT_THROW(facebook::jsi::Value::createFromJsonUtf8(*runtime, (const uint8_t *)json, sizeof(json) - 1),
+                 facebook::jsi::JSError);
+
+    std::string out = "previous content";
+    EXPECT_TRUE(quickjs::serializeToJsonUtf8(*runtime, value, out));
+    EXPECT_EQ(out, std::string(json, sizeof(json) - 4));
+    EXPECT_TRUE(quickjs::serializeToJsonUtf8(*runtime, facebook::jsi::Value(1.5), out));
+    EXPECT_EQ(out, "1.5");
+    EXPECT_FALSE(quickjs::serializeToJsonUtf8(*runtime, facebook::jsi::Value(), out));
+    EXPECT_EQ(out, "");
+
+    auto cyclic = runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var c = { d: new Date(0) }; c.self = c; c"), "<test_code>");
+    EXPECT_THROW(quickjs::serializeToJsonUtf8(*runtime, cyclic, out), facebook::jsi::JSError);
+    EXPECT_TRUE(quickjs::serializeToJsonUtf8(*runtime, cyclic.asObject(*runtime).getProperty(*runtime, "d"), out));
+    EXPECT_EQ(out, "\"1970-01-01T00:00:00.000Z\"");
+}
+
+TEST(QuickJSRuntimeTest, MapHashTable)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var m = new Map([[-0, 'zero'], [NaN, 'nan'], [2n ** 70n, 'big'], ['ab', 'str']]);" "\n"
+        "var r = [m.get(0), m.get(0 / 0), m.get(2n ** 69n * 2n), m.get('a' + 'b'), m.has(1), m.has(2n ** 70n + 1n)];" "\n"
+        "var s = new Set(), order = [];" "\n"
+        "for (var i = 0; i < 1000; i++) s.add(i);" "\n"
+        "for (var v of s) { if (v < 990) s.delete(v); else order.push(v); if (v == 995) s.add(2000); }" "\n"
+        "var w = new WeakMap(), k = {};" "\n"
+        "for (var i = 0; i < 1000; i++) w.set({}, i);" "\n"
+        "w.set(k, 'live');" "\n"
+        "var result = r.concat([s.size, order.join(' '), w.get(k)]).join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "zero,nan,big,str,false,false,11,990 991 992 993 994 995 996 997 998 999 2000,live");
+}
+
+TEST(QuickJSRuntimeTest, ArraySort)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var ints = [10, 9, -1, 100, 1, -10, 2147483647, -2147483648, 0, 1e3].sort();" "\n"
+        "var strs = ['b', 'a' + 'c', 'ab', '\\u00e9', 'a'].sort();" "\n"
+        "var recs = [];" "\n"
+        "for (var i = 0; i < 100; i++) recs.push({ k: (i * 7) % 5, i: i });" "\n"
+        "var calls = 0;" "\n"
+        "recs.sort(function (a, b) { calls++; return a.k - b.k; });" "\n"
+        "var stable = recs.every(function (r, i) { return i == 0 || recs[i - 1].k < r.k || recs[i - 1].i < r.i; });" "\n"
+        "var sorted = recs.slice(), sortedCalls = calls;" "\n"
+        "sorted.sort(function (a, b) { calls++; return a.k - b.k; });" "\n"
+        "var sparse = [3, undefined, , 1, 2]; sparse.sort();" "\n"
+        "var result = [ints.join(' '), strs.join(' '), stable, calls - sortedCalls, sparse.length, 2 in sparse, 4 in sparse].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "-1 -10 -2147483648 0 1 10 100 1000 2147483647 9,a ab ac b \xc3\xa9,true,99,5,true,false");
+}
+
+TEST(QuickJSRuntimeTest, NumberToString)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var nums = [0.1, 0.1 + 0.2, 1e21, 123e-20, 5e-324, 1.7976931348623157e308, 123.456, -1.5e-7, 2 ** -1022, 2 ** 60, -0];" "\n"
+        "var result = nums.map(String).concat([(1.5e300).toExponential(), (0).toExponential(), (25).toExponential(), JSON.stringify([1 / 3, -2.5e-5])]).join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "0.1,0.30000000000000004,1e+21,1.23e-18,5e-324,1.7976931348623157e+308,123.456,-1.5e-7,"
+              "2.2250738585072014e-308,1152921504606847000,0,1.5e+300,0e+0,2.5e+1,[0.3333333333333333,-0.000025]");
+}
+
+TEST(QuickJSRuntimeTest, StringToNumber)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var strs = ['0.1', '9007199254740993', '2.2250738585072011e-308', '4.9e-324', '1.7976931348623159e308', '-0.0e5'," "\n"
+        "            '1.00000000000000011102230246251565404236316680908203125', '123456789012345678901234567890e-10', '1e-400'];" "\n"
+        "var result = strs.map(function (s) { var d = Number(s); return d === parseFloat(s) && d === JSON.parse(s) ? (Object.is(d, -0) ? '-0' : String(d)) : 'mismatch'; })" "\n"
+        "    .concat([1_000.5, 0.1e-0_1, 12345678901234567890123]).join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "0.1,9007199254740992,2.225073858507201e-308,5e-324,Infinity,-0,1,12345678901234567000,0,"
+              "1000.5,0.01,1.2345678901234568e+22");
+}
+
+TEST(QuickJSRuntimeTest, TypedArraySort)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var f = new Float64Array(100), i8 = new Int8Array(100), b = new BigInt64Array(100);" "\n"
+        "for (var i = 0; i < 100; i++) { f[i] = [NaN, 0, -0, 1.5, -Infinity][i % 5]; i8[i] = i * 37; b[i] = BigInt(i % 3) - 1n; }" "\n"
+        "new DataView(f.buffer).setUint32(4, 0xfff80000, true);" "\n"
+        "f.sort(); i8.sort(); b.sort();" "\n"
+        "var result = [f[0], Object.is(f[20], -0), Object.is(f[40], 0), f[60], f[79], f[80], f[99], i8[0], i8[50], i8[99], b[0], b[99]].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "-Infinity,true,true,1.5,1.5,NaN,NaN,-127,3,126,-1,1");
+}
+
+TEST(QuickJSRuntimeTest, TypedArrayBulk)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var a = new Int16Array(100).fill(-2, 3, 97), f = new Float32Array(100).fill(NaN, 50);" "\n"
+        "f[70] = -0; a[90] = 7;" "\n"
+        "var d = new Float64Array([1.5, -1.5, 2 ** 31, -(2 ** 32) - 1, NaN, 300.5, 1e40]);" "\n"
+        "var i32 = new Int32Array(7), u8c = new Uint8ClampedArray(7), f32 = new Float32Array(7);" "\n"
+        "i32.set(d); u8c.set(d); f32.set(d);" "\n"
+        "var buf = new ArrayBuffer(64), src = new Int8Array(buf, 0, 8), dst = new Int32Array(buf, 0, 8);" "\n"
+        "src.set([1, 2, 3, 4, 5, 6, 7, 8]); dst.set(src);" "\n"
+        "var result = [a[2], a[3], a[96], a[97], a.indexOf(7), a.lastIndexOf(-2), a.lastIndexOf(0, 50), f.indexOf(NaN), f.includes(NaN)," "\n"
+        "              f.indexOf(0, 60), f.lastIndexOf(0), i32.join(' '), u8c.join(' '), f32.join(' '), dst.join(' '), new Uint16Array(d).join(' ')].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "0,-2,-2,0,90,96,2,-1,true,70,70,1 -1 -2147483648 -1 0 300 0,2 0 255 0 0 255 255,"
+              "1.5 -1.5 2147483648 -4294967296 NaN 300.5 Infinity,1 2 3 4 5 6 7 8,1 65535 0 65535 0 300 0");
+}
+
+TEST(QuickJSRuntimeTest, ArrayHigherOrder)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var a = [1, 2, 3, 4], h = [1, , 3];" "\n"
+        "var m = a.map(function (x, i, o) { if (i == 0) o.length = 3; x = 0; return arguments[0] + i; });" "\n"
+        "var r = [1, 2, 3, 4].reduce(function (s, x, i, o) { if (i == 1) delete o[2]; return s + x; });" "\n"
+        "class A extends Array {}" "\n"
+        "var f = A.from([5, 6, 7]).filter(x => x > 5);" "\n"
+        "var result = [m.length, m.join(' '), Object.keys(h.map(x => x)).join(' '), r, f instanceof A, f.join(' ')," "\n"
+        "              [1, 2].every(x => x > 0), [1, 2].some(x => x > 1)].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "4,0 1 2 ,0 2,7,true,6 7,true,true");
+}
+
+TEST(QuickJSRuntimeTest, ForOfArray)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var r = [], a = [1, 2, 3], closed = 0;" "\n"
+        "for (var x of a) { r.push(x); if (x == 1) a.push(4); }" "\n"
+        "var [p, , q = 9, ...rest] = [5, 6];" "\n"
+        "var proto = Object.getPrototypeOf([][Symbol.iterator]());" "\n"
+        "proto.return = function () { closed = this.next().value; return {}; };" "\n"
+        "for (var x of [7, 8, 9]) if (x == 8) break;" "\n"
+        "delete proto.return;" "\n"
+        "var next = proto.next;" "\n"
+        "proto.next = function () { var v = next.call(this); if (!v.done) v.value *= 10; return v; };" "\n"
+        "var patched = [...[1, 2]];" "\n"
+        "for (var x of [3]) patched.push(x);" "\n"
+        "proto.next = next;" "\n"
+        "var bad = {[Symbol.iterator]() { return {next: 5, length: 1, 0: 'x', return() { closed = 'bad'; }}; }};" "\n"
+        "function errorOf(f) { try { f(); } catch (e) { return e.constructor.name; } }" "\n"
+        "var errors = [errorOf(() => { for (var x of bad); }), errorOf(() => { var [b] = bad; })," "\n"
+        "              errorOf(() => [...function* () { for (var x of bad) yield x; }()])].join(' ');" "\n"
+        "var result = [r.join(' '), p, q, rest.length, closed, patched.join(' '), errors].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "1 2 3 4,5,9,0,9,10 20 30,TypeError TypeError TypeError");
+}
+
+TEST(QuickJSRuntimeTest, LazyArguments)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "function sum() { var t = 0; for (var i = 0; i < arguments.length; i++) t += arguments[i]; return t; }" "\n"
+        "function mapped(a, b) { a = 10; return [arguments[0], arguments[1], arguments.length].join(' '); }" "\n"
+        "function rest(a, ...r) { return [r.length, r[0], r[1], typeof r[5]].join(' '); }" "\n"
+        "function oob() { return arguments[3]; }" "\n"
+        "Object.prototype[3] = 'p';" "\n"
+        "var o = oob(1);" "\n"
+        "delete Object.prototype[3];" "\n"
+        "var result = [sum(), sum(1, 2, 3), sum.apply(null, [4, 5]), mapped(1), rest(1, 2, 3), o].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "0,6,9,10  1,2 2 3 undefined,p");
+}
+
+TEST(QuickJSRuntimeTest, ApplySpread)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "var arr = [1, 2, 3, 4];" "\n"
+        "function f(a, b) { a = 'a'; return [a, b, arguments[0], arguments[3]].join(' '); }" "\n"
+        "function mut() { arr.length = 0; arr.push(9); return [arguments[0], arguments[3]].join(' '); }" "\n"
+        "class A { constructor(...a) { this.a = a.join(' '); } }" "\n"
+        "class B extends A { constructor(...a) { super(...a, 'b'); } }" "\n"
+        "var lg = [1]; lg.length = 2;" "\n"
+        "var big = []; for (var i = 0; i < 60000; i++) big.push(i);" "\n"
+        "function deep(n) {" "\n"
+        "    if (n > 0) return deep(n - 1);" "\n"
+        "    return [Math.max.apply(null, big), f.apply(null, big), Reflect.apply(Math.min, null, big), Math.max(...big)].join(' ');" "\n"
+        "}" "\n"
+        "var result = [f(...arr), f.apply(null, arr), mut.apply(null, arr), arr.join(' '), new B(...[1]).a," "\n"
+        "              f.apply(null, lg), Math.max(...[1, 5, 3]), deep(30)].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "a 2 a 4,a 2 a 4,1 4,9,1 b,a  a ,5,59999 a 1 a 3 0 59999");
+}
+
+TEST(QuickJSRuntimeTest, QuickenedArrayAccess)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "function get(a, i) { return a[i]; }" "\n"
+        "function put(a, i, v) { a[i] = v; }" "\n"
+        "var arr = [1, 2, 3], r = [], fz = Object.freeze([0]);" "\n"
+        "for (var k = 0; k < 3; k++) {" "\n"
+        "    r.push(get(arr, 1), get(arr, 5), get({1: 'o'}, 1), get('str', 1), get(new Int8Array([4, 5]), 1));" "\n"
+        "    put(arr, 0, k); put(arr, 3, 'a'); put(fz, 0, 1);" "\n"
+        "}" "\n"
+        "var result = [r.slice(0, 5).join(' '), r.slice(10).join(' '), arr.join(' '), fz[0], 0.5 < 1.5, NaN >= NaN].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "2  o t 5,2  o t 5,2 2 3 a,0,true,false");
+}
+
+TEST(QuickJSRuntimeTest, Superinstructions)
+{
+    auto runtime = quickjs::makeQuickJSRuntime();
+    runtime->evaluateJavaScript(std::make_unique<facebook::jsi::StringBuffer>(
+        "function count(n) { let c = 0; for (let i = 0; i < n; i++) c++; return c; }" "\n"
+        "function inc(v) { let x = v; x++; return x; }" "\n"
+        "function tdz() { try { k++; } catch (e) { return e.constructor.name; } let k = 0; }" "\n"
+        "function cmp(a, b) { if (a < b) return 1; return 0; }" "\n"
+        "var result = [count(3), count(2.5), count('2'), count(NaN), inc(2147483647), inc('a'), String(inc(1n)), tdz()," "\n"
+        "              cmp(1, 2), cmp(1.5, 0.5), cmp('a', 'b'), cmp(NaN, 1)].join();" "\n"
+        ), "<test_code>");
+
+    EXPECT_EQ(runtime->global().getProperty(*runtime, "result").getString(*runtime).utf8(*runtime),
+              "3,3,2,0,2147483648,NaN,2,ReferenceError,1,0,1,0");
+}
+
+TEST(QuickJSRuntimeTest, BytecodeRoundTrip)
+{
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = JS_NewContext(rt);
+    const char code[] =
+        "function count(n) { let c = 0; for (let i = 0; i < n; i++) c++; return c; }"
+        "function sum(a) { var s = 0; for (var i = 0; i < a.length; i++) s += a[i]; return s; }"
+        "[count(5), count(2.5), sum([1, 2, 3])].join()";
+    JSValue obj = JS_Eval(ctx, code, sizeof(code) - 1, "<test_code>", JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+    ASSERT_FALSE(JS_IsException(obj));
+    size_t size;
+    uint8_t *buf = JS_WriteObject(ctx, &size, obj, JS_WRITE_OBJ_BYTECODE);
+    JS_FreeValue(ctx, obj);
+    ASSERT_NE(buf, nullptr);
+
+    // the superinstructions are written and read back as they are
+    obj = JS_ReadObject(ctx, buf, size, JS_READ_OBJ_BYTECODE);
+    ASSERT_FALSE(JS_IsException(obj));
+    JSValue result = JS_EvalFunction(ctx, obj);
+    const char *str = JS_ToCString(ctx, result);
+    EXPECT_STREQ(str, "5,3,6");
+    JS_FreeCString(ctx, str);
+    JS_FreeValue(ctx, result);
+
+    // the bytecode of another version is rejected
+    buf[0]++;
+    obj = JS_ReadObject(ctx, buf, size, JS_READ_OBJ_BYTECODE);
+    EXPECT_TRUE(JS_IsException(obj));
+    JS_FreeValue(ctx, JS_GetException(ctx));
+
+    js_free(ctx, buf);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
@@ -0,0 +1,200 @@
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include "quickjs/quickjs.h"
+#include "QuickJSSlabAllocator.h"
+
+namespace quickjs {
+    namespace {
+        // Every block is preceded by a header starting with a word: the owning Slab pointer for slab blocks,
+        // (size << 1) | 1 for blocks from the system allocator. It keeps js_malloc_usable_size exact
+        // without any allocator state. The header is padded so that the blocks keep the malloc alignment.
+        constexpr size_t HeaderSize = alignof(std::max_align_t);
+
+        constexpr uint32_t ClassSizes[] = {16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256};
+
+        // size class index for (size + 15) / 16
+        constexpr uint8_t ClassIndexBySize16[] = {0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11};
+
+        inline uintptr_t &blockHeader(const void *ptr) {
+            return *(uintptr_t *)((char *)ptr - HeaderSize);
+        }
+
+        inline bool isSystemBlock(uintptr_t header) {
+            return header & 1;
+        }
+    } // namespace
+
+    static_assert(sizeof(ClassSizes) / sizeof(ClassSizes[0]) == 12, "ClassCount mismatch");
+    static_assert(ClassSizes[11] == QuickJSSlabAllocator::MaxSlabBlockSize, "MaxSlabBlockSize mismatch");
+
+    struct QuickJSSlabAllocator::Slab {
+        Slab *next;
+        uint32_t classIndex;
+        uint32_t blockSize;
+        size_t usedCount; // allocated blocks, the slab can be released by trim() when it drops to 0
+    };
+
+    const JSMallocFunctions QuickJSSlabAllocator::mallocFunctions = {
+        QuickJSSlabAllocator::jsMalloc,
+        QuickJSSlabAllocator::jsFree,
+        QuickJSSlabAllocator::jsRealloc,
+        QuickJSSlabAllocator::jsMallocUsableSize,
+    };
+
+    QuickJSSlabAllocator::~QuickJSSlabAllocator() {
+        for (auto &sizeClass : _classes) {
+            Slab *slab = sizeClass.slabs;
+            while (slab) {
+                Slab *next = slab->next;
+                std::free(slab);
+                slab = next;
+            }
+            sizeClass = {};
+        }
+        _slabCount = 0;
+    }
+
+    bool QuickJSSlabAllocator::newSlab(SizeClass &sizeClass, uint32_t classIndex) {
+        auto slab = (Slab *)std::malloc(SlabSize);
+        if (!slab) return false;
+        slab->next = sizeClass.slabs;
+        slab->classIndex = classIndex;
+        slab->blockSize = ClassSizes[classIndex];
+        slab->usedCount = 0;
+        sizeClass.slabs = slab;
+        sizeClass.bumpPtr = (char *)slab + ((sizeof(Slab) + 15) & ~(size_t)15);
+        sizeClass.bumpEnd = (char *)slab + SlabSize;
+        ++_slabCount;
+        return true;
+    }
+
+    size_t QuickJSSlabAllocator::trim() {
+        size_t released = 0;
+        for (auto &sizeClass : _classes) {
+            // the first slab is the one of the bump pointer, it is kept
+            if (!sizeClass.slabs || !sizeClass.slabs->next) continue;
+
+            FreeBlock **link = &sizeClass.freeList;
+            while (FreeBlock *block = *link) {
+                auto slab = (Slab *)blockHeader(block);
+                if (slab->usedCount == 0 && slab != sizeClass.slabs) {
+                    *link = block->next;
+                } else {
+                    link = &block->next;
+                }
+            }
+
+            Slab **slabLink = &sizeClass.slabs->next;
+            while (Slab *slab = *slabLink) {
+                if (slab->usedCount == 0) {
+                    *slabLink = slab->next;
+                    std::free(slab);
+                    --_slabCount;
+                    released += SlabSize;
+                } else {
+                    slabLink = &slab->next;
+                }
+            }
+        }
+        return released;
+    }
+
+    void *QuickJSSlabAllocator::allocate(size_t size) {
+        if (size > MaxSlabBlockSize) {
+            auto block = (char *)std::malloc(HeaderSize + size);
+            if (!block) return nullptr;
+            *(uintptr_t *)block = (size << 1) | 1;
+            return block + HeaderSize;
+        }
+
+        uint32_t classIndex = ClassIndexBySize16[(size + 15) >> 4];
+        SizeClass &sizeClass = _classes[classIndex];
+        if (FreeBlock *block = sizeClass.freeList) {
+            sizeClass.freeList = block->next;
+            ((Slab *)blockHeader(block))->usedCount++;
+            return block;
+        }
+
+        size_t stride = HeaderSize + ClassSizes[classIndex];
+        if (sizeClass.bumpPtr + stride > sizeClass.bumpEnd) {
+            if (!newSlab(sizeClass, classIndex)) return nullptr;
+        }
+        char *block = sizeClass.bumpPtr;
+        sizeClass.bumpPtr += stride;
+        *(uintptr_t *)block = (uintptr_t)sizeClass.slabs;
+        sizeClass.slabs->usedCount++;
+        return block + HeaderSize;
+    }
+
+    void QuickJSSlabAllocator::deallocate(void *ptr) {
+        uintptr_t header = blockHeader(ptr);
+        if (isSystemBlock(header)) {
+            std::free((char *)ptr - HeaderSize);
+            return;
+        }
+        auto slab = (Slab *)header;
+        slab->usedCount--;
+        SizeClass &sizeClass = _classes[slab->classIndex];
+        auto block = (FreeBlock *)ptr;
+        block->next = sizeClass.freeList;
+        sizeClass.freeList = block;
+    }
+
+    size_t QuickJSSlabAllocator::jsMallocUsableSize(const void *ptr) {
+        if (!ptr) return 0;
+        uintptr_t header = blockHeader(ptr);
+        return isSystemBlock(header) ? header >> 1 : ((Slab *)header)->blockSize;
+    }
+
+    void *QuickJSSlabAllocator::jsMalloc(JSMallocState *s, size_t size) {
+        if (s->malloc_size + size > s->malloc_limit) return nullptr;
+
+        void *ptr = ((QuickJSSlabAllocator *)s->opaque)->allocate(size);
+        if (!ptr) return nullptr;
+
+        s->malloc_count++;
+        s->malloc_size += jsMallocUsableSize(ptr) + HeaderSize;
+        return ptr;
+    }
+
+    void QuickJSSlabAllocator::jsFree(JSMallocState *s, void *ptr) {
+        if (!ptr) return;
+
+        s->malloc_count--;
+        s->malloc_size -= jsMallocUsableSize(ptr) + HeaderSize;
+        ((QuickJSSlabAllocator *)s->opaque)->deallocate(ptr);
+    }
+
+    void *QuickJSSlabAllocator::jsRealloc(JSMallocState *s, void *ptr, size_t size) {
+        if (!ptr) {
+            if (size == 0) return nullptr;
+            return jsMalloc(s, size);
+        }
+        if (size == 0) {
+            jsFree(s, ptr);
+            return nullptr;
+        }
+
+        size_t oldSize = jsMallocUsableSize(ptr);
+        if (size <= oldSize && (size > oldSize / 2 || oldSize <= 16)) return ptr;
+        if (s->malloc_size + size - oldSize > s->malloc_limit) return nullptr;
+
+        uintptr_t header = blockHeader(ptr);
+        if (isSystemBlock(header) && size > MaxSlabBlockSize) {
+            auto block = (char *)std::realloc((char *)ptr - HeaderSize, HeaderSize + size);
+            if (!block) return nullptr;
+            *(uintptr_t *)block = (size << 1) | 1;
+            s->malloc_size += size - oldSize;
+            return block + HeaderSize;
+        }
+
+        void *newPtr = ((QuickJSSlabAllocator *)s->opaque)->allocate(size);
+        if (!newPtr) return nullptr;
+        std::memcpy(newPtr, ptr, size < oldSize ? size : oldSize);
+        s->malloc_size += jsMallocUsableSize(newPtr) - oldSize;
+        ((QuickJSSlabAllocator *)s->opaque)->deallocate(ptr);
+        return newPtr;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct JSMallocState;
+struct JSMallocFunctions;
+
+namespace quickjs {
+    // Size-class allocator for one QuickJS runtime, installed with JS_NewRuntime2(&mallocFunctions, allocator).
+    // Small blocks (objects, shapes, short strings, var refs, property arrays and the JSI pointer values) are carved
+    // with a bump pointer from slabs dedicated to one size class and recycled through per-class free lists,
+    // bigger blocks go to the system allocator. Like the runtime it must only be used by one thread at a time.
+    class QuickJSSlabAllocator {
+    public:
+        static const JSMallocFunctions mallocFunctions;
+
+        static constexpr size_t SlabSize = 64 * 1024;
+        static constexpr size_t MaxSlabBlockSize = 256;
+
+        QuickJSSlabAllocator() = default;
+        // Releases all slabs in O(#slabs), the runtime must have been freed before.
+        ~QuickJSSlabAllocator();
+
+        QuickJSSlabAllocator(const QuickJSSlabAllocator &) = delete;
+        QuickJSSlabAllocator &operator=(const QuickJSSlabAllocator &) = delete;
+
+        [[nodiscard]] size_t slabCount() const { return _slabCount; }
+        // Returns the slabs without allocated blocks to the system allocator, returns the number of bytes released.
+        size_t trim();
+
+    private:
+        static constexpr size_t ClassCount = 12;
+
+        struct Slab;
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+        struct SizeClass {
+            FreeBlock *freeList{};
+            char *bumpPtr{};
+            char *bumpEnd{};
+            Slab *slabs{};
+        };
+
+        static void *jsMalloc(JSMallocState *s, size_t size);
+        static void jsFree(JSMallocState *s, void *ptr);
+        static void *jsRealloc(JSMallocState *s, void *ptr, size_t size);
+        static size_t jsMallocUsableSize(const void *ptr);
+
+        void *allocate(size_t size);
+        void deallocate(void *ptr);
+        bool newSlab(SizeClass &sizeClass, uint32_t classIndex);
+
+        SizeClass _classes[ClassCount];
+        size_t _slabCount{};
+    };
+}
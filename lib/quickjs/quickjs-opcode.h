@@ -78,6 +78,9 @@ DEF(      push_true, 1, 0, 1, none)
 DEF(         object, 1, 0, 1, none)
 DEF( special_object, 2, 0, 1, u8) /* only used at the start of a function */
 DEF(           rest, 3, 0, 1, u16) /* only used at the start of a function */
+DEF(       get_argc, 3, 0, 1, u16) /* number of arguments from index u16 */
+DEF(get_arguments_el, 2, 1, 1, u8) /* arguments[idx] without arguments object, u8: special object type */
+DEF(    get_rest_el, 3, 1, 1, u16) /* rest[idx] without rest array, u16: first argument */
 
 DEF(           drop, 1, 1, 0, none) /* a -> */
 DEF(            nip, 1, 2, 1, none) /* a b -> b */
@@ -123,11 +126,11 @@ DEF(      get_super, 1, 1, 1, none)
 DEF(         import, 1, 1, 1, none) /* dynamic module import */
 
 DEF(      check_var, 5, 0, 1, atom) /* check if a variable exists */
-DEF(  get_var_undef, 5, 0, 1, atom) /* push undefined if the variable does not exist */
-DEF(        get_var, 5, 0, 1, atom) /* throw an exception if the variable does not exist */
-DEF(        put_var, 5, 1, 0, atom) /* must come after get_var */
+DEF(  get_var_undef, 7, 0, 1, atom_u16) /* push undefined if the variable does not exist. u16: global variable cache index */
+DEF(        get_var, 7, 0, 1, atom_u16) /* throw an exception if the variable does not exist */
+DEF(        put_var, 7, 1, 0, atom_u16) /* must come after get_var */
 DEF(   put_var_init, 5, 1, 0, atom) /* must come after put_var. Used to initialize a global lexical variable */
-DEF( put_var_strict, 5, 2, 0, atom) /* for strict mode variable write */
+DEF( put_var_strict, 7, 2, 0, atom_u16) /* for strict mode variable write */
 
 DEF(  get_ref_value, 1, 2, 3, none)
 DEF(  put_ref_value, 1, 3, 0, none)
@@ -135,9 +138,9 @@ DEF(  put_ref_value, 1, 3, 0, none)
 DEF(     define_var, 6, 0, 0, atom_u8)
 DEF(check_define_var, 6, 0, 0, atom_u8)
 DEF(    define_func, 6, 1, 0, atom_u8)
-DEF(      get_field, 5, 1, 1, atom)
-DEF(     get_field2, 5, 1, 2, atom)
-DEF(      put_field, 5, 2, 0, atom)
+DEF(      get_field, 7, 1, 1, atom_u16) /* u16: inline cache index */
+DEF(     get_field2, 7, 1, 2, atom_u16)
+DEF(      put_field, 7, 2, 0, atom_u16)
 DEF( get_private_field, 1, 2, 1, none) /* obj prop -> value */
 DEF( put_private_field, 1, 3, 0, none) /* obj value prop -> */
 DEF(define_private_field, 1, 3, 1, none) /* obj prop value -> obj */
@@ -262,6 +265,18 @@ DEF(     private_in, 1, 2, 1, none)
 DEF(      mul_pow10, 1, 2, 1, none)
 DEF(       math_mod, 1, 2, 1, none)
 #endif
+/* quickened opcodes: never emitted by the compiler. The interpreter
+   rewrites the generic opcode in place when it observes these operand
+   types and restores it when they change. */
+DEF(get_array_el_fast, 1, 2, 1, none) /* fast array, int index */
+DEF(put_array_el_fast, 1, 3, 0, none) /* fast array, int index */
+
+/* superinstructions: replace the first opcode of a sequence and execute
+   it entirely. The following opcodes are kept unchanged, hence the
+   size and the stack effect are the ones of the first opcode. */
+DEF(    lt_if_false, 1, 2, 1, none) /* lt if_false(8) */
+DEF(  inc_loc_check, 3, 0, 1, loc) /* get_loc_check(n) post_inc put_loc_check(n) drop */
+
 /* must be the last non short and non temporary opcode */
 DEF(            nop, 1, 0, 0, none)
 
@@ -286,7 +301,7 @@ def(scope_get_private_field, 7, 1, 1, atom_u16) /* obj -> value, emitted in phas
 def(scope_get_private_field2, 7, 1, 2, atom_u16) /* obj -> obj value, emitted in phase 1, removed in phase 2 */
 def(scope_put_private_field, 7, 2, 0, atom_u16) /* obj value ->, emitted in phase 1, removed in phase 2 */
 def(scope_in_private_field, 7, 1, 1, atom_u16) /* obj -> res emitted in phase 1, removed in phase 2 */
-def(get_field_opt_chain, 5, 1, 1, atom) /* emitted in phase 1, removed in phase 2 */
+def(get_field_opt_chain, 7, 1, 1, atom_u16) /* emitted in phase 1, removed in phase 2 */
 def(get_array_el_opt_chain, 1, 2, 1, none) /* emitted in phase 1, removed in phase 2 */
 def( set_class_name, 5, 1, 1, u32) /* emitted in phase 1, removed in phase 2 */
 
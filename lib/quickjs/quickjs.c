@@ -39,6 +39,11 @@
 #elif defined(__FreeBSD__)
 #include <malloc_np.h>
 #endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "cutils.h"
 #include "list.h"
@@ -46,6 +51,7 @@
 #include "libregexp.h"
 #include "libunicode.h"
 #include "libbf.h"
+#include "dtoa-table.h"
 
 #define OPTIMIZE         1
 #define SHORT_OPCODES    1
@@ -105,6 +111,9 @@
 //#define DUMP_MODULE_RESOLVE
 //#define DUMP_PROMISE
 //#define DUMP_READ_OBJECT
+/* dump the most frequent pairs of consecutively executed opcodes in
+   JS_FreeRuntime (used to select the superinstructions) */
+//#define DUMP_OPCODE_PAIRS
 
 /* test the GC by forcing it before each object allocation */
 //#define FORCE_GC_AT_MALLOC
@@ -200,6 +209,7 @@ typedef enum JSErrorEnum {
 
 #define JS_MAX_LOCAL_VARS 65535
 #define JS_STACK_SIZE_MAX 65534
+#define JS_MAX_APPLY_STACK_ARGS 256 /* apply() arguments copied with alloca() */
 #define JS_STRING_LEN_MAX ((1 << 30) - 1)
 
 #define __exception __attribute__((warn_unused_result))
@@ -214,6 +224,21 @@ typedef enum {
     JS_GC_PHASE_REMOVE_CYCLES,
 } JSGCPhaseEnum;
 
+/* phases of the incremental cycle collection, see JS_RunGCSlice() */
+typedef enum {
+    JS_GC_INC_PHASE_NONE,
+    JS_GC_INC_PHASE_COUNT, /* count the references between the GC objects */
+    JS_GC_INC_PHASE_ROOTS, /* find the objects referenced from outside */
+    JS_GC_INC_PHASE_SCAN, /* propagate the reachability from them */
+} JSGCIncPhaseEnum;
+
+/* entry of the table of internal reference counts used by the
+   incremental cycle collection */
+typedef struct JSGCRefCountEntry {
+    JSGCObjectHeader *obj; /* NULL if free */
+    uint32_t count;
+} JSGCRefCountEntry;
+
 typedef enum OPCodeEnum OPCodeEnum;
 
 /* function pointers are used for numeric operations so that it is
@@ -259,6 +284,29 @@ struct JSRuntime {
     struct list_head tmp_obj_list; /* used during GC */
     JSGCPhaseEnum gc_phase : 8;
     size_t malloc_gc_threshold;
+    size_t malloc_gc_threshold_min; /* set by JS_SetGCThreshold() */
+    JSGCPolicy *gc_policy;
+    void *gc_policy_opaque;
+    JSGCStats gc_stats;
+    int64_t gc_last_end; /* time of the end of the last collection */
+
+    /* incremental cycle collection. The GC objects not processed yet
+       are moved from gc_obj_list to the following lists. */
+    JSGCIncPhaseEnum gc_inc_phase : 8;
+    BOOL gc_inc_running : 8;
+    BOOL gc_inc_oom : 8; /* the reference count table could not be allocated */
+    int64_t gc_slice_budget; /* in us, 0 if the incremental mode is disabled */
+    int64_t gc_inc_time; /* time spent in the slices of the collection */
+    size_t gc_inc_next_slice; /* malloc_size triggering the next slice */
+    struct list_head gc_inc_list; /* objects to count, then candidates */
+    struct list_head gc_inc_white_list; /* counted objects */
+    struct list_head gc_inc_grey_list; /* reached objects to scan */
+    /* objects outside the freed cycles whose refcount reached zero
+       while freeing them */
+    struct list_head gc_inc_zero_ref_count_list;
+    JSGCRefCountEntry *gc_inc_refs;
+    uint32_t gc_inc_refs_size; /* power of two */
+    uint32_t gc_inc_refs_count;
 #ifdef DUMP_LEAKS
     struct list_head string_list; /* list of JSString.link */
 #endif
@@ -296,6 +344,9 @@ struct JSRuntime {
     int shape_hash_size;
     int shape_hash_count; /* number of hashed shapes */
     JSShape **shape_hash;
+    /* incremented when the properties of a global object or of a
+       global lexical scope are added, removed or reconfigured */
+    uint64_t global_var_gen;
     bf_context_t bf_ctx;
     JSNumericOperations bigint_ops;
 #ifdef CONFIG_BIGNUM
@@ -345,13 +396,22 @@ typedef enum {
     JS_GC_OBJ_TYPE_JS_CONTEXT,
 } JSGCObjectTypeEnum;
 
+typedef enum {
+    JS_GC_MARK_NONE,
+    JS_GC_MARK_DECREF, /* children decremented by the cycle collector */
+    /* incremental cycle collection */
+    JS_GC_MARK_INC_WHITE, /* not reached: candidate for the cycle removal */
+    JS_GC_MARK_INC_GREY, /* reached, in gc_inc_grey_list */
+    JS_GC_MARK_INC_LIVE, /* candidate referenced from outside the candidates */
+} JSGCMarkEnum;
+
 /* header for GC objects. GC objects are C data structures with a
    reference count that can reference other GC objects. JS Objects are
    a particular type of GC object. */
 struct JSGCObjectHeader {
     int ref_count; /* must come first, 32-bit */
     JSGCObjectTypeEnum gc_obj_type : 4;
-    uint8_t mark : 4; /* used by the GC */
+    uint8_t mark : 4; /* used by the GC, see JSGCMarkEnum */
     uint8_t dummy1; /* not used by the GC */
     uint16_t dummy2; /* not used by the GC */
     struct list_head link;
@@ -430,6 +490,7 @@ struct JSContext {
     JSValue iterator_proto;
     JSValue async_iterator_proto;
     JSValue array_proto_values;
+    JSValue array_iterator_next;
     JSValue throw_type_error;
     JSValue eval_obj;
 
@@ -503,6 +564,24 @@ struct JSString {
     } u;
 };
 
+/* concatenations shorter than this length give a flat string. It is
+   also the maximum length of the leaf extended by short appends. */
+#define JS_STRING_ROPE_SHORT_LEN 512
+/* the rope is rebalanced when it would become deeper */
+#define JS_STRING_ROPE_MAX_DEPTH 64
+
+/* lazy concatenation of two strings (JS_TAG_STRING_ROPE). It is
+   immutable except when flattened: 'left' then holds the flat string,
+   'right' is JS_UNDEFINED and 'depth' is 0. */
+typedef struct JSStringRope {
+    JSRefCountHeader header; /* must come first, 32-bit */
+    uint32_t len : 31;
+    uint8_t is_wide_char : 1;
+    uint8_t depth; /* 0 if flattened */
+    JSValue left; /* JS_TAG_STRING or JS_TAG_STRING_ROPE */
+    JSValue right;
+} JSStringRope;
+
 typedef struct JSClosureVar {
     uint8_t is_local : 1;
     uint8_t is_arg : 1;
@@ -582,6 +661,38 @@ typedef enum JSFunctionKindEnum {
     JS_FUNC_ASYNC_GENERATOR = (JS_FUNC_GENERATOR | JS_FUNC_ASYNC),
 } JSFunctionKindEnum;
 
+#define JS_IC_ENTRY_COUNT 4 /* maximum number of shapes per inline cache */
+#define JS_IC_MAX_DEPTH   2 /* maximum number of traversed prototypes */
+#define JS_IC_MAX_EVICT   64 /* the cache is no longer updated after
+                                this number of evictions */
+#define JS_IC_NONE        0xffff /* index of the accesses without cache */
+
+/* Only hashed shapes are cached: they are never modified while they
+   are shared, so a referenced shape keeps the same property layout
+   and a property change gives a new shape to the object. */
+typedef struct JSInlineCacheEntry {
+    JSShape *shape; /* shape of the object, NULL if the entry is free */
+    /* shapes of the prototypes traversed to reach the property */
+    JSShape *proto_shape[JS_IC_MAX_DEPTH];
+    uint32_t prop_index; /* index of the property in its holder */
+    uint8_t depth; /* number of traversed prototypes */
+    uint8_t is_getter : 1;
+} JSInlineCacheEntry;
+
+typedef struct JSInlineCache {
+    JSInlineCacheEntry entries[JS_IC_ENTRY_COUNT];
+    uint8_t next_evict;
+    uint8_t evict_count;
+} JSInlineCache;
+
+/* slot of a global variable, valid while JSRuntime.global_var_gen is
+   unchanged */
+typedef struct JSGlobalVarCache {
+    uint64_t gen; /* 0 if not set */
+    uint32_t prop_index;
+    uint8_t is_lexical; /* in the global lexical scope */
+} JSGlobalVarCache;
+
 typedef struct JSFunctionBytecode {
     JSGCObjectHeader header; /* must come first */
     uint8_t js_mode;
@@ -613,6 +724,14 @@ typedef struct JSFunctionBytecode {
     JSValue *cpool; /* constant pool (self pointer) */
     int cpool_count;
     int closure_var_count;
+    /* inline caches of OP_get_field, OP_get_field2 and OP_put_field,
+       allocated on the first miss */
+    int ic_count;
+    JSInlineCache *ic;
+    /* caches of OP_get_var, OP_get_var_undef, OP_put_var and
+       OP_put_var_strict, allocated on the first miss */
+    int gv_cache_count;
+    JSGlobalVarCache *gv_cache;
     struct {
         /* debug info, move to separate structure to save memory? */
         JSAtom filename;
@@ -873,6 +992,10 @@ struct JSShape {
        <= n <= 2^31-1. If false, the shape is guaranteed not to have
        small array index properties */
     uint8_t has_small_array_index;
+    /* true if the shape belongs to a global object or a global lexical
+       scope. Such a shape is never hashed, so that it is modified in
+       place and keeps this flag. */
+    uint8_t is_global;
     uint32_t hash; /* current hash value */
     uint32_t prop_hash_mask;
     int prop_size; /* allocated properties */
@@ -1054,6 +1177,11 @@ static __maybe_unused void JS_PrintValue(JSContext *ctx,
                                                   const char *str,
                                                   JSValueConst val);
 static __maybe_unused void JS_DumpShapes(JSRuntime *rt);
+#ifdef DUMP_OPCODE_PAIRS
+/* accumulated over all the runtimes and dumped at exit */
+static uint64_t js_opcode_pair_count[256][256];
+static void js_dump_opcode_pairs(void);
+#endif
 static JSValue js_function_apply(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv, int magic);
 static void js_array_finalizer(JSRuntime *rt, JSValue val);
@@ -1121,6 +1249,8 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
 static JSValue js_regexp_constructor_internal(JSContext *ctx, JSValueConst ctor,
                                               JSValue pattern, JSValue bc);
 static void gc_decref(JSRuntime *rt);
+static void map_hash_trim(JSRuntime *rt, struct JSMapState *s);
+static int64_t js_get_monotonic_us(void);
 static int JS_NewClass1(JSRuntime *rt, JSClassID class_id,
                         const JSClassDef *class_def, JSAtom name);
 
@@ -1295,14 +1425,35 @@ static void js_trigger_gc(JSRuntime *rt, size_t size)
     force_gc = ((rt->malloc_state.malloc_size + size) >
                 rt->malloc_gc_threshold);
 #endif
+    if (rt->gc_slice_budget > 0) {
+        /* incremental mode: once the threshold is reached, run a slice
+           every time the heap grows by 1/16 of its size */
+        if (rt->gc_inc_phase != JS_GC_INC_PHASE_NONE) {
+            if (rt->malloc_state.malloc_size + size <= rt->gc_inc_next_slice)
+                return;
+        } else if (!force_gc) {
+            return;
+        }
+        if (rt->gc_inc_running)
+            return;
+        /* the threshold is updated by the policy when the collection
+           completes */
+        if (!JS_RunGCSlice(rt, rt->gc_slice_budget)) {
+            rt->gc_inc_next_slice = rt->malloc_state.malloc_size +
+                max_int(rt->malloc_state.malloc_size >> 4, 64 * 1024);
+        }
+        return;
+    }
     if (force_gc) {
 #ifdef DUMP_GC
         printf("GC: size=%" PRIu64 "\n",
                (uint64_t)rt->malloc_state.malloc_size);
 #endif
-        JS_RunGC(rt);
-        rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
-            (rt->malloc_state.malloc_size >> 1);
+        /* finish the collection started by JS_RunIdleGC() if any */
+        if (rt->gc_inc_phase != JS_GC_INC_PHASE_NONE)
+            JS_RunGCSlice(rt, -1);
+        else
+            JS_RunGC(rt);
     }
 }
 
@@ -1627,6 +1778,15 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     JSRuntime *rt;
     JSMallocState ms;
 
+#ifdef DUMP_OPCODE_PAIRS
+    {
+        static BOOL dump_registered;
+        if (!dump_registered) {
+            atexit(js_dump_opcode_pairs);
+            dump_registered = TRUE;
+        }
+    }
+#endif
     memset(&ms, 0, sizeof(ms));
     ms.opaque = opaque;
     ms.malloc_limit = -1;
@@ -1642,6 +1802,9 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     }
     rt->malloc_state = ms;
     rt->malloc_gc_threshold = 256 * 1024;
+    rt->malloc_gc_threshold_min = rt->malloc_gc_threshold;
+    rt->gc_stats.threshold = rt->malloc_gc_threshold;
+    rt->gc_last_end = js_get_monotonic_us();
 
     bf_context_init(&rt->bf_ctx, js_bf_realloc, rt);
     set_dummy_numeric_ops(&rt->bigint_ops);
@@ -1654,6 +1817,11 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     init_list_head(&rt->gc_obj_list);
     init_list_head(&rt->gc_zero_ref_count_list);
     rt->gc_phase = JS_GC_PHASE_NONE;
+    rt->gc_inc_phase = JS_GC_INC_PHASE_NONE;
+    init_list_head(&rt->gc_inc_list);
+    init_list_head(&rt->gc_inc_white_list);
+    init_list_head(&rt->gc_inc_grey_list);
+    init_list_head(&rt->gc_inc_zero_ref_count_list);
 
 #ifdef DUMP_LEAKS
     init_list_head(&rt->string_list);
@@ -1793,6 +1961,7 @@ void JS_SetMemoryLimit(JSRuntime *rt, size_t limit)
 void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold)
 {
     rt->malloc_gc_threshold = gc_threshold;
+    rt->malloc_gc_threshold_min = gc_threshold;
 }
 
 #define malloc(s) malloc_is_forbidden(s)
@@ -2261,6 +2430,7 @@ static void JS_MarkContext(JSRuntime *rt, JSContext *ctx,
     JS_MarkValue(rt, ctx->eval_obj, mark_func);
 
     JS_MarkValue(rt, ctx->array_proto_values, mark_func);
+    JS_MarkValue(rt, ctx->array_iterator_next, mark_func);
     for(i = 0; i < JS_NATIVE_ERROR_COUNT; i++) {
         JS_MarkValue(rt, ctx->native_error_proto[i], mark_func);
     }
@@ -2324,6 +2494,7 @@ void JS_FreeContext(JSContext *ctx)
     JS_FreeValue(ctx, ctx->eval_obj);
 
     JS_FreeValue(ctx, ctx->array_proto_values);
+    JS_FreeValue(ctx, ctx->array_iterator_next);
     for(i = 0; i < JS_NATIVE_ERROR_COUNT; i++) {
         JS_FreeValue(ctx, ctx->native_error_proto[i]);
     }
@@ -2590,6 +2761,18 @@ static int JS_ResizeAtomHash(JSRuntime *rt, int new_hash_size)
     return 0;
 }
 
+/* shrink the atom hash table if it is oversized */
+static void JS_TrimAtomHash(JSRuntime *rt)
+{
+    int new_hash_size;
+
+    new_hash_size = rt->atom_hash_size;
+    while (new_hash_size > 256 && rt->atom_count * 4 < new_hash_size)
+        new_hash_size >>= 1;
+    if (new_hash_size != rt->atom_hash_size)
+        JS_ResizeAtomHash(rt, new_hash_size);
+}
+
 static int JS_InitAtoms(JSRuntime *rt)
 {
     int i, len, atom_type;
@@ -3882,6 +4065,183 @@ static JSValue string_buffer_end(StringBuffer *s)
     return JS_MKPTR(JS_TAG_STRING, str);
 }
 
+/* return the length of the ASCII prefix of p[0..len-1] */
+static size_t utf8_ascii_len(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        uint32_t mask = _mm256_movemask_epi8(a);
+        if (mask)
+            return i + ctz32(mask);
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        uint32_t mask = _mm_movemask_epi8(a);
+        if (mask)
+            return i + ctz32(mask);
+    }
+#else
+    for (; i + 8 <= len; i += 8) {
+        if (get_u64(p + i) & 0x8080808080808080)
+            break;
+    }
+#endif
+    while (i < len && p[i] < 0x80)
+        i++;
+    return i;
+}
+
+#if defined(__AVX2__)
+#define UTF8_BLOCK_SIZE 32
+#else
+#define UTF8_BLOCK_SIZE 16
+#endif
+
+/* return TRUE if the UTF8_BLOCK_SIZE bytes at p are ASCII */
+static inline BOOL utf8_block_is_ascii(const uint8_t *p)
+{
+#if defined(__AVX2__)
+    return _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)p)) == 0;
+#elif defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)) == 0;
+#else
+    return ((get_u64(p) | get_u64(p + 8)) & 0x8080808080808080) == 0;
+#endif
+}
+
+/* return TRUE if the UTF8_BLOCK_SIZE / 2 characters at p are ASCII */
+static inline BOOL utf16_block_is_ascii(const uint16_t *p)
+{
+#if defined(__AVX2__)
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    return _mm256_testz_si256(a, _mm256_set1_epi16(0xff80));
+#elif defined(__SSE2__)
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    a = _mm_and_si128(a, _mm_set1_epi16(0xff80));
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(a, _mm_setzero_si128())) == 0xffff;
+#else
+    int i;
+    uint16_t v = 0;
+    for(i = 0; i < UTF8_BLOCK_SIZE / 2; i++)
+        v |= p[i];
+    return v < 0x80;
+#endif
+}
+
+/* Decode the multi-byte UTF-8 sequence at p if it is well formed and
+   encodes a code point in 0x80..0x10FFFF. Return its length in bytes,
+   or 0 if the generic decoder must handle it. */
+static inline int utf8_decode_fast(const uint8_t *p, const uint8_t *p_end,
+                                   uint32_t *pc)
+{
+    uint32_t c = p[0];
+    size_t n = p_end - p;
+
+    if (c >= 0xc2 && c <= 0xdf) {
+        if (n >= 2 && (p[1] & 0xc0) == 0x80) {
+            *pc = ((c & 0x1f) << 6) | (p[1] & 0x3f);
+            return 2;
+        }
+    } else if (c >= 0xe0 && c <= 0xef) {
+        if (n >= 3 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80) {
+            c = ((c & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+            if (c >= 0x800) {
+                *pc = c;
+                return 3;
+            }
+        }
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        if (n >= 4 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80 &&
+            (p[3] & 0xc0) == 0x80) {
+            c = ((c & 0x07) << 18) | ((p[1] & 0x3f) << 12) |
+                ((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+            if (c >= 0x10000 && c <= 0x10ffff) {
+                *pc = c;
+                return 4;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Decode the well formed UTF-8 sequences of [*pp, p_end) into b, whose
+   size must allow p_end - *pp more characters, and stop at the first
+   sequence that needs the generic decoder. The blocks of ASCII
+   characters are copied after a single SIMD test. */
+static int string_buffer_write_utf8_fast(StringBuffer *b, const uint8_t **pp,
+                                         const uint8_t *p_end)
+{
+    const uint8_t *p = *pp, *p_next;
+    uint32_t c;
+    int i, l, len = b->len;
+
+    if (!b->is_wide_char) {
+        uint8_t *q = b->str->u.str8;
+        while (p < p_end) {
+            if (p_end - p >= UTF8_BLOCK_SIZE && utf8_block_is_ascii(p)) {
+                memcpy(q + len, p, UTF8_BLOCK_SIZE);
+                len += UTF8_BLOCK_SIZE;
+                p += UTF8_BLOCK_SIZE;
+                continue;
+            }
+            p_next = p + min_int(p_end - p, UTF8_BLOCK_SIZE);
+            while (p < p_next) {
+                if (*p < 0x80) {
+                    q[len++] = *p++;
+                } else {
+                    l = utf8_decode_fast(p, p_end, &c);
+                    if (l == 0)
+                        goto done;
+                    if (c >= 0x100)
+                        goto widen;
+                    q[len++] = c;
+                    p += l;
+                }
+            }
+        }
+        goto done;
+    widen:
+        b->len = len;
+        if (string_buffer_widen(b, b->size))
+            return -1;
+    }
+    {
+        uint16_t *q = b->str->u.str16;
+        while (p < p_end) {
+            if (p_end - p >= UTF8_BLOCK_SIZE && utf8_block_is_ascii(p)) {
+                for (i = 0; i < UTF8_BLOCK_SIZE; i++)
+                    q[len + i] = p[i];
+                len += UTF8_BLOCK_SIZE;
+                p += UTF8_BLOCK_SIZE;
+                continue;
+            }
+            p_next = p + min_int(p_end - p, UTF8_BLOCK_SIZE);
+            while (p < p_next) {
+                if (*p < 0x80) {
+                    q[len++] = *p++;
+                } else {
+                    l = utf8_decode_fast(p, p_end, &c);
+                    if (l == 0)
+                        goto done;
+                    if (c >= 0x10000) {
+                        q[len++] = get_hi_surrogate(c);
+                        c = get_lo_surrogate(c);
+                    }
+                    q[len++] = c;
+                    p += l;
+                }
+            }
+        }
+    }
+ done:
+    b->len = len;
+    *pp = p;
+    return 0;
+}
+
 /* create a string from a UTF-8 buffer */
 JSValue JS_NewStringLen(JSContext *ctx, const char *buf, size_t buf_len)
 {
@@ -3892,10 +4252,8 @@ JSValue JS_NewStringLen(JSContext *ctx, const char *buf, size_t buf_len)
 
     p_start = (const uint8_t *)buf;
     p_end = p_start + buf_len;
-    p = p_start;
-    while (p < p_end && *p < 128)
-        p++;
-    len1 = p - p_start;
+    len1 = utf8_ascii_len(p_start, buf_len);
+    p = p_start + len1;
     if (len1 > JS_STRING_LEN_MAX)
         return JS_ThrowInternalError(ctx, "string too long");
     if (p == p_end) {
@@ -3905,6 +4263,8 @@ JSValue JS_NewStringLen(JSContext *ctx, const char *buf, size_t buf_len)
         if (string_buffer_init(ctx, b, buf_len))
             goto fail;
         string_buffer_write8(b, p_start, len1);
+        if (string_buffer_write_utf8_fast(b, &p, p_end))
+            goto fail;
         while (p < p_end) {
             if (*p < 128) {
                 string_buffer_putc8(b, *p++);
@@ -3995,7 +4355,7 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
 {
     JSValue val;
     JSString *str, *str_new;
-    int pos, len, c, c1;
+    int pos, len, c, c1, i, n;
     uint8_t *q;
 
     if (JS_VALUE_GET_TAG(val1) != JS_TAG_STRING) {
@@ -4016,28 +4376,44 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
         /* Scanning the whole string is required for ASCII strings,
            and computing the number of non-ASCII bytes is less expensive
            than testing each byte, hence this method is faster for ASCII
-           strings, which is the most common case.
+           strings, which is the most common case. The ASCII prefix is
+           skipped with SIMD, then the bytes are counted 8 at a time.
          */
-        count = 0;
-        for (pos = 0; pos < len; pos++) {
-            count += src[pos] >> 7;
-        }
-        if (count == 0) {
+        pos = utf8_ascii_len(src, len);
+        if (pos == len) {
             if (plen)
                 *plen = len;
             return (const char *)src;
         }
+        count = 0;
+        for (; pos + 8 <= len; pos += 8) {
+            count += (((get_u64(src + pos) >> 7) & 0x0101010101010101) *
+                      0x0101010101010101) >> 56;
+        }
+        for (; pos < len; pos++) {
+            count += src[pos] >> 7;
+        }
         str_new = js_alloc_string(ctx, len + count, 0);
         if (!str_new)
             goto fail;
         q = str_new->u.str8;
-        for (pos = 0; pos < len; pos++) {
-            c = src[pos];
-            if (c < 0x80) {
-                *q++ = c;
-            } else {
-                *q++ = (c >> 6) | 0xc0;
-                *q++ = (c & 0x3f) | 0x80;
+        pos = 0;
+        while (pos < len) {
+            if (len - pos >= UTF8_BLOCK_SIZE && utf8_block_is_ascii(src + pos)) {
+                memcpy(q, src + pos, UTF8_BLOCK_SIZE);
+                q += UTF8_BLOCK_SIZE;
+                pos += UTF8_BLOCK_SIZE;
+                continue;
+            }
+            n = min_int(len, pos + UTF8_BLOCK_SIZE);
+            for (; pos < n; pos++) {
+                c = src[pos];
+                if (c < 0x80) {
+                    *q++ = c;
+                } else {
+                    *q++ = (c >> 6) | 0xc0;
+                    *q++ = (c & 0x3f) | 0x80;
+                }
             }
         }
     } else {
@@ -4051,26 +4427,38 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
         q = str_new->u.str8;
         pos = 0;
         while (pos < len) {
-            c = src[pos++];
-            if (c < 0x80) {
-                *q++ = c;
-            } else {
-                if (is_hi_surrogate(c)) {
-                    if (pos < len && !cesu8) {
-                        c1 = src[pos];
-                        if (is_lo_surrogate(c1)) {
-                            pos++;
-                            c = from_surrogate(c, c1);
-                        } else {
-                            /* Keep unmatched surrogate code points */
-                            /* c = 0xfffd; */ /* error */
-                        }
-                    } else {
-                        /* Keep unmatched surrogate code points */
-                        /* c = 0xfffd; */ /* error */
-                    }
+            if (len - pos >= UTF8_BLOCK_SIZE / 2 && utf16_block_is_ascii(src + pos)) {
+                for (i = 0; i < UTF8_BLOCK_SIZE / 2; i++)
+                    q[i] = src[pos + i];
+                q += UTF8_BLOCK_SIZE / 2;
+                pos += UTF8_BLOCK_SIZE / 2;
+                continue;
+            }
+            n = min_int(len, pos + UTF8_BLOCK_SIZE / 2);
+            while (pos < n) {
+                c = src[pos++];
+                if (c < 0x80) {
+                    *q++ = c;
+                } else if (c < 0x800) {
+                    *q++ = (c >> 6) | 0xc0;
+                    *q++ = (c & 0x3f) | 0x80;
+                } else if (!is_surrogate(c)) {
+                    *q++ = (c >> 12) | 0xe0;
+                    *q++ = ((c >> 6) & 0x3f) | 0x80;
+                    *q++ = (c & 0x3f) | 0x80;
+                } else if (is_hi_surrogate(c) && pos < len && !cesu8 &&
+                           is_lo_surrogate(c1 = src[pos])) {
+                    pos++;
+                    c = from_surrogate(c, c1);
+                    *q++ = (c >> 18) | 0xf0;
+                    *q++ = ((c >> 12) & 0x3f) | 0x80;
+                    *q++ = ((c >> 6) & 0x3f) | 0x80;
+                    *q++ = (c & 0x3f) | 0x80;
+                } else {
+                    /* Keep unmatched surrogate code points */
+                    /* c = 0xfffd; */ /* error */
+                    q += unicode_to_utf8(q, c);
                 }
-                q += unicode_to_utf8(q, c);
             }
         }
     }
@@ -4229,6 +4617,344 @@ static BOOL JS_ConcatStringInPlace(JSContext *ctx, JSString *p1, JSValueConst op
     return FALSE;
 }
 
+static inline BOOL tag_is_string(uint32_t tag)
+{
+    return tag == JS_TAG_STRING || tag == JS_TAG_STRING_ROPE;
+}
+
+/* 'val' must be a string or a rope */
+static inline uint32_t js_string_value_len(JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING)
+        return JS_VALUE_GET_STRING(val)->len;
+    else
+        return ((JSStringRope *)JS_VALUE_GET_PTR(val))->len;
+}
+
+static inline int js_string_value_depth(JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING)
+        return 0;
+    else
+        return ((JSStringRope *)JS_VALUE_GET_PTR(val))->depth;
+}
+
+/* 'left' and 'right' are freed. No rebalancing is done. */
+static JSValue js_new_string_rope(JSContext *ctx, JSValue left, JSValue right)
+{
+    JSStringRope *r;
+    int is_wide_char;
+
+    if (JS_IsException(left) || JS_IsException(right))
+        goto fail;
+    r = js_malloc(ctx, sizeof(*r));
+    if (!r)
+        goto fail;
+    r->header.ref_count = 1;
+    r->len = js_string_value_len(left) + js_string_value_len(right);
+    if (JS_VALUE_GET_TAG(left) == JS_TAG_STRING)
+        is_wide_char = JS_VALUE_GET_STRING(left)->is_wide_char;
+    else
+        is_wide_char = ((JSStringRope *)JS_VALUE_GET_PTR(left))->is_wide_char;
+    if (JS_VALUE_GET_TAG(right) == JS_TAG_STRING)
+        is_wide_char |= JS_VALUE_GET_STRING(right)->is_wide_char;
+    else
+        is_wide_char |= ((JSStringRope *)JS_VALUE_GET_PTR(right))->is_wide_char;
+    r->is_wide_char = is_wide_char;
+    r->depth = max_int(js_string_value_depth(left),
+                       js_string_value_depth(right)) + 1;
+    r->left = left;
+    r->right = right;
+    return JS_MKPTR(JS_TAG_STRING_ROPE, r);
+ fail:
+    JS_FreeValue(ctx, left);
+    JS_FreeValue(ctx, right);
+    return JS_EXCEPTION;
+}
+
+static void js_string_rope_copy(JSString *p, uint32_t pos, JSValueConst val)
+{
+    JSStringRope *r;
+    JSString *p1;
+
+    for(;;) {
+        if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING) {
+            p1 = JS_VALUE_GET_STRING(val);
+            if (p->is_wide_char)
+                copy_str16(p->u.str16 + pos, p1, 0, p1->len);
+            else
+                memcpy(p->u.str8 + pos, p1->u.str8, p1->len);
+            break;
+        }
+        r = JS_VALUE_GET_PTR(val);
+        if (r->depth != 0) {
+            js_string_rope_copy(p, pos, r->left);
+            pos += js_string_value_len(r->left);
+            val = r->right;
+        } else {
+            val = r->left;
+        }
+    }
+}
+
+/* Flatten the rope in place. Return its flat string, which is not
+   duplicated and lives as long as the rope, or JS_EXCEPTION. */
+static JSValueConst js_string_rope_flatten(JSContext *ctx, JSValueConst val)
+{
+    JSStringRope *r = JS_VALUE_GET_PTR(val);
+    JSString *p;
+
+    if (r->depth == 0)
+        return r->left;
+    p = js_alloc_string(ctx, r->len, r->is_wide_char);
+    if (!p)
+        return JS_EXCEPTION;
+    js_string_rope_copy(p, 0, val);
+    if (!p->is_wide_char)
+        p->u.str8[p->len] = '\0';
+    JS_FreeValue(ctx, r->left);
+    JS_FreeValue(ctx, r->right);
+    r->left = JS_MKPTR(JS_TAG_STRING, p);
+    r->right = JS_UNDEFINED;
+    r->depth = 0;
+    return r->left;
+}
+
+/* return 'val' with a rope replaced by its flat string. 'val' is freed. */
+static JSValue js_flatten_string(JSContext *ctx, JSValue val)
+{
+    JSValue str;
+
+    if (likely(JS_VALUE_GET_TAG(val) != JS_TAG_STRING_ROPE))
+        return val;
+    str = JS_DupValue(ctx, js_string_rope_flatten(ctx, val));
+    JS_FreeValue(ctx, val);
+    return str;
+}
+
+/* iterator on the flat strings of a string or a rope. It does not
+   allocate memory. */
+typedef struct JSStringRopeIter {
+    /* right subtrees to visit, bounded by the depth of the rope */
+    JSValueConst stack[JS_STRING_ROPE_MAX_DEPTH];
+    int stack_len;
+} JSStringRopeIter;
+
+static void js_string_rope_iter_init(JSStringRopeIter *it, JSValueConst val)
+{
+    it->stack[0] = val;
+    it->stack_len = 1;
+}
+
+/* return the next non empty flat string or NULL at the end */
+static JSString *js_string_rope_iter_next(JSStringRopeIter *it)
+{
+    JSValueConst val;
+    JSStringRope *r;
+    JSString *p;
+
+    while (it->stack_len > 0) {
+        val = it->stack[--it->stack_len];
+        for(;;) {
+            if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING) {
+                p = JS_VALUE_GET_STRING(val);
+                if (p->len != 0)
+                    return p;
+                break;
+            }
+            r = JS_VALUE_GET_PTR(val);
+            if (r->depth != 0) {
+                assert(it->stack_len < JS_STRING_ROPE_MAX_DEPTH);
+                it->stack[it->stack_len++] = r->right;
+            }
+            val = r->left;
+        }
+    }
+    return NULL;
+}
+
+/* return TRUE if the strings or ropes 'op1' and 'op2' of the same
+   length have the same characters. The ropes are not flattened, so it
+   cannot fail. */
+static BOOL js_string_value_eq(JSValueConst op1, JSValueConst op2)
+{
+    JSStringRopeIter it1, it2;
+    JSString *p1, *p2;
+    uint32_t pos1, pos2, len;
+    int res;
+
+    js_string_rope_iter_init(&it1, op1);
+    js_string_rope_iter_init(&it2, op2);
+    p1 = js_string_rope_iter_next(&it1);
+    p2 = js_string_rope_iter_next(&it2);
+    pos1 = pos2 = 0;
+    while (p1 && p2) {
+        len = min_uint32(p1->len - pos1, p2->len - pos2);
+        if (!p1->is_wide_char) {
+            if (!p2->is_wide_char)
+                res = memcmp(p1->u.str8 + pos1, p2->u.str8 + pos2, len);
+            else
+                res = memcmp16_8(p2->u.str16 + pos2, p1->u.str8 + pos1, len);
+        } else {
+            if (!p2->is_wide_char)
+                res = memcmp16_8(p1->u.str16 + pos1, p2->u.str8 + pos2, len);
+            else
+                res = memcmp16(p1->u.str16 + pos1, p2->u.str16 + pos2, len);
+        }
+        if (res != 0)
+            return FALSE;
+        pos1 += len;
+        pos2 += len;
+        if (pos1 == p1->len) {
+            p1 = js_string_rope_iter_next(&it1);
+            pos1 = 0;
+        }
+        if (pos2 == p2->len) {
+            p2 = js_string_rope_iter_next(&it2);
+            pos2 = 0;
+        }
+    }
+    return TRUE;
+}
+
+/* replace a flattened rope by its string. 'val' is freed. */
+static JSValue js_string_rope_unwrap(JSContext *ctx, JSValue val)
+{
+    JSStringRope *r;
+    JSValue str;
+
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(val);
+        if (r->depth == 0) {
+            str = JS_DupValue(ctx, r->left);
+            JS_FreeValue(ctx, val);
+            return str;
+        }
+    }
+    return val;
+}
+
+/* collect the strings and the ropes of depth <= JS_STRING_ROPE_MAX_DEPTH / 2
+   composing 'val' */
+static int js_string_rope_collect(JSContext *ctx, JSValue **ptab, int *psize,
+                                  int *pcount, JSValueConst val)
+{
+    JSStringRope *r;
+
+    for(;;) {
+        if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING)
+            break;
+        r = JS_VALUE_GET_PTR(val);
+        if (r->depth == 0) {
+            val = r->left;
+        } else if (r->depth > JS_STRING_ROPE_MAX_DEPTH / 2) {
+            if (js_string_rope_collect(ctx, ptab, psize, pcount, r->left))
+                return -1;
+            val = r->right;
+        } else {
+            break;
+        }
+    }
+    if (js_resize_array(ctx, (void **)ptab, sizeof(**ptab), psize, *pcount + 1))
+        return -1;
+    (*ptab)[(*pcount)++] = JS_DupValue(ctx, val);
+    return 0;
+}
+
+/* the elements of tab[] are freed */
+static JSValue js_build_string_rope(JSContext *ctx, JSValue *tab, int count)
+{
+    JSValue left;
+    int n;
+
+    if (count == 1)
+        return tab[0];
+    n = count / 2;
+    left = js_build_string_rope(ctx, tab, n);
+    return js_new_string_rope(ctx, left,
+                              js_build_string_rope(ctx, tab + n, count - n));
+}
+
+/* 'left' and 'right' are freed */
+static JSValue js_concat_string_rope(JSContext *ctx, JSValue left, JSValue right)
+{
+    JSValue *tab, ret;
+    int size, count, i;
+
+    if (max_int(js_string_value_depth(left),
+                js_string_value_depth(right)) < JS_STRING_ROPE_MAX_DEPTH)
+        return js_new_string_rope(ctx, left, right);
+
+    /* the depth of the result is bounded by
+       JS_STRING_ROPE_MAX_DEPTH / 2 + log2(count) */
+    tab = NULL;
+    size = count = 0;
+    if (js_string_rope_collect(ctx, &tab, &size, &count, left) ||
+        js_string_rope_collect(ctx, &tab, &size, &count, right)) {
+        for(i = 0; i < count; i++)
+            JS_FreeValue(ctx, tab[i]);
+        ret = JS_EXCEPTION;
+    } else {
+        ret = js_build_string_rope(ctx, tab, count);
+    }
+    js_free(ctx, tab);
+    JS_FreeValue(ctx, left);
+    JS_FreeValue(ctx, right);
+    return ret;
+}
+
+/* concatenate two strings or ropes of total length >=
+   JS_STRING_ROPE_SHORT_LEN. op1 and op2 are freed. */
+static JSValue JS_ConcatStringRope(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSStringRope *r;
+    JSValue ret;
+
+    op1 = js_string_rope_unwrap(ctx, op1);
+    op2 = js_string_rope_unwrap(ctx, op2);
+    if (js_string_value_len(op1) + js_string_value_len(op2) > JS_STRING_LEN_MAX) {
+        JS_ThrowInternalError(ctx, "string too long");
+        goto fail;
+    }
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE &&
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
+        /* append a short string to the last leaf */
+        r = JS_VALUE_GET_PTR(op1);
+        if (r->depth != 0 &&
+            JS_VALUE_GET_TAG(r->right) == JS_TAG_STRING &&
+            js_string_value_len(r->right) +
+            js_string_value_len(op2) <= JS_STRING_ROPE_SHORT_LEN) {
+            ret = js_new_string_rope(ctx, JS_DupValue(ctx, r->left),
+                                     JS_ConcatString1(ctx, JS_VALUE_GET_STRING(r->right),
+                                                      JS_VALUE_GET_STRING(op2)));
+            goto done;
+        }
+    } else if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+               JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE) {
+        /* prepend a short string to the first leaf */
+        r = JS_VALUE_GET_PTR(op2);
+        if (r->depth != 0 &&
+            JS_VALUE_GET_TAG(r->left) == JS_TAG_STRING &&
+            js_string_value_len(op1) +
+            js_string_value_len(r->left) <= JS_STRING_ROPE_SHORT_LEN) {
+            ret = js_new_string_rope(ctx,
+                                     JS_ConcatString1(ctx, JS_VALUE_GET_STRING(op1),
+                                                      JS_VALUE_GET_STRING(r->left)),
+                                     JS_DupValue(ctx, r->right));
+            goto done;
+        }
+    }
+    return js_concat_string_rope(ctx, op1, op2);
+ done:
+    JS_FreeValue(ctx, op1);
+    JS_FreeValue(ctx, op2);
+    return ret;
+ fail:
+    JS_FreeValue(ctx, op1);
+    JS_FreeValue(ctx, op2);
+    return JS_EXCEPTION;
+}
+
 /* op1 and op2 are converted to strings. For convenience, op1 or op2 =
    JS_EXCEPTION are accepted and return JS_EXCEPTION.  */
 static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
@@ -4236,25 +4962,38 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
     JSValue ret;
     JSString *p1, *p2;
 
-    if (unlikely(JS_VALUE_GET_TAG(op1) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op1)))) {
         op1 = JS_ToStringFree(ctx, op1);
         if (JS_IsException(op1)) {
             JS_FreeValue(ctx, op2);
             return JS_EXCEPTION;
         }
     }
-    if (unlikely(JS_VALUE_GET_TAG(op2) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op2)))) {
         op2 = JS_ToStringFree(ctx, op2);
         if (JS_IsException(op2)) {
             JS_FreeValue(ctx, op1);
             return JS_EXCEPTION;
         }
     }
-    p1 = JS_VALUE_GET_STRING(op1);
-    if (JS_ConcatStringInPlace(ctx, p1, op2)) {
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+        JS_ConcatStringInPlace(ctx, JS_VALUE_GET_STRING(op1), op2)) {
+        JS_FreeValue(ctx, op2);
+        return op1;
+    }
+    if (js_string_value_len(op2) == 0) {
         JS_FreeValue(ctx, op2);
         return op1;
     }
+    if (js_string_value_len(op1) == 0) {
+        JS_FreeValue(ctx, op1);
+        return op2;
+    }
+    if (JS_VALUE_GET_TAG(op1) != JS_TAG_STRING ||
+        JS_VALUE_GET_TAG(op2) != JS_TAG_STRING ||
+        js_string_value_len(op1) + js_string_value_len(op2) >= JS_STRING_ROPE_SHORT_LEN)
+        return JS_ConcatStringRope(ctx, op1, op2);
+    p1 = JS_VALUE_GET_STRING(op1);
     p2 = JS_VALUE_GET_STRING(op2);
     ret = JS_ConcatString1(ctx, p1, p2);
     JS_FreeValue(ctx, op1);
@@ -4293,6 +5032,7 @@ static inline JSShapeProperty *get_shape_prop(JSShape *sh)
 static int init_shape_hash(JSRuntime *rt)
 {
     rt->shape_hash_bits = 4;   /* 16 shapes */
+    rt->global_var_gen = 1; /* 0 is an invalid generation */
     rt->shape_hash_size = 1 << rt->shape_hash_bits;
     rt->shape_hash_count = 0;
     rt->shape_hash = js_mallocz_rt(rt, sizeof(rt->shape_hash[0]) *
@@ -4349,6 +5089,19 @@ static int resize_shape_hash(JSRuntime *rt, int new_shape_hash_bits)
     return 0;
 }
 
+/* shrink the shape hash table if it is oversized */
+static void js_trim_shape_hash(JSRuntime *rt)
+{
+    int new_shape_hash_bits;
+
+    new_shape_hash_bits = rt->shape_hash_bits;
+    while (new_shape_hash_bits > 4 &&
+           8 * (rt->shape_hash_count + 1) <= (1 << new_shape_hash_bits))
+        new_shape_hash_bits--;
+    if (new_shape_hash_bits != rt->shape_hash_bits)
+        resize_shape_hash(rt, new_shape_hash_bits);
+}
+
 static void js_shape_hash_link(JSRuntime *rt, JSShape *sh)
 {
     uint32_t h;
@@ -4404,6 +5157,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
     sh->hash = shape_initial_hash(proto);
     sh->is_hashed = TRUE;
     sh->has_small_array_index = FALSE;
+    sh->is_global = FALSE;
     js_shape_hash_link(ctx->rt, sh);
     return sh;
 }
@@ -4483,6 +5237,48 @@ static void js_free_shape_null(JSRuntime *rt, JSShape *sh)
         js_free_shape(rt, sh);
 }
 
+static void free_ic_entry(JSRuntime *rt, JSInlineCacheEntry *e)
+{
+    int i;
+
+    if (e->shape) {
+        js_free_shape(rt, e->shape);
+        for(i = 0; i < e->depth; i++)
+            js_free_shape(rt, e->proto_shape[i]);
+        e->shape = NULL;
+    }
+}
+
+static void free_function_ic(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    int i, j;
+
+    for(i = 0; i < b->ic_count; i++) {
+        for(j = 0; j < JS_IC_ENTRY_COUNT; j++)
+            free_ic_entry(rt, &b->ic[i].entries[j]);
+    }
+    js_free_rt(rt, b->ic);
+    b->ic = NULL;
+}
+
+static void mark_function_ic(JSRuntime *rt, JSFunctionBytecode *b,
+                             JS_MarkFunc *mark_func)
+{
+    JSInlineCacheEntry *e;
+    int i, j, k;
+
+    for(i = 0; i < b->ic_count; i++) {
+        for(j = 0; j < JS_IC_ENTRY_COUNT; j++) {
+            e = &b->ic[i].entries[j];
+            if (e->shape) {
+                mark_func(rt, &e->shape->header);
+                for(k = 0; k < e->depth; k++)
+                    mark_func(rt, &e->proto_shape[k]->header);
+            }
+        }
+    }
+}
+
 /* make space to hold at least 'count' properties */
 static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
                                        JSObject *p, uint32_t count)
@@ -4519,6 +5315,7 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
     /* copy all the shape properties */
     memcpy(sh, old_sh,
            sizeof(JSShape) + sizeof(sh->prop[0]) * old_sh->prop_count);
+    sh->header.mark = JS_GC_MARK_NONE;
     list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
 
     if (new_hash_size != (sh->prop_hash_mask + 1)) {
@@ -4575,6 +5372,7 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     sh = get_shape_from_alloc(sh_alloc, new_hash_size);
     list_del(&old_sh->header.link);
     memcpy(sh, old_sh, sizeof(JSShape));
+    sh->header.mark = JS_GC_MARK_NONE;
     list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
 
     memset(prop_hash_end(sh) - new_hash_size, 0,
@@ -4622,6 +5420,8 @@ static int add_shape_property(JSContext *ctx, JSShape **psh,
     uint32_t hash_mask, new_shape_hash = 0;
     intptr_t h;
 
+    if (sh->is_global)
+        rt->global_var_gen++;
     /* update the shape hash */
     if (sh->is_hashed) {
         js_shape_hash_unlink(rt, sh);
@@ -5546,6 +6346,14 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
             }
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(v);
+            JS_FreeValueRT(rt, r->left);
+            JS_FreeValueRT(rt, r->right);
+            js_free_rt(rt, r);
+        }
+        break;
     case JS_TAG_OBJECT:
     case JS_TAG_FUNCTION_BYTECODE:
         {
@@ -5556,6 +6364,11 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
                 if (rt->gc_phase == JS_GC_PHASE_NONE) {
                     free_zero_refcount(rt);
                 }
+            } else if (p->mark == JS_GC_MARK_NONE) {
+                /* not part of the freed cycles (only possible with the
+                   incremental collection): freed after them */
+                list_del(&p->link);
+                list_add_tail(&p->link, &rt->gc_inc_zero_ref_count_list);
             }
         }
         break;
@@ -5603,7 +6416,7 @@ void __JS_FreeValue(JSContext *ctx, JSValue v)
 static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
                           JSGCObjectTypeEnum type)
 {
-    h->mark = 0;
+    h->mark = JS_GC_MARK_NONE;
     h->gc_obj_type = type;
     list_add_tail(&h->link, &rt->gc_obj_list);
 }
@@ -5682,6 +6495,8 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
             }
             if (b->realm)
                 mark_func(rt, &b->realm->header);
+            if (b->ic)
+                mark_function_ic(rt, b, mark_func);
         }
         break;
     case JS_GC_OBJ_TYPE_VAR_REF:
@@ -5740,7 +6555,7 @@ static void gc_decref_child(JSRuntime *rt, JSGCObjectHeader *p)
 {
     assert(p->ref_count > 0);
     p->ref_count--;
-    if (p->ref_count == 0 && p->mark == 1) {
+    if (p->ref_count == 0 && p->mark == JS_GC_MARK_DECREF) {
         list_del(&p->link);
         list_add_tail(&p->link, &rt->tmp_obj_list);
     }
@@ -5758,9 +6573,9 @@ static void gc_decref(JSRuntime *rt)
        tmp_obj_list */
     list_for_each_safe(el, el1, &rt->gc_obj_list) {
         p = list_entry(el, JSGCObjectHeader, link);
-        assert(p->mark == 0);
+        assert(p->mark == JS_GC_MARK_NONE);
         mark_children(rt, p, gc_decref_child);
-        p->mark = 1;
+        p->mark = JS_GC_MARK_DECREF;
         if (p->ref_count == 0) {
             list_del(&p->link);
             list_add_tail(&p->link, &rt->tmp_obj_list);
@@ -5776,7 +6591,7 @@ static void gc_scan_incref_child(JSRuntime *rt, JSGCObjectHeader *p)
            end of gc_obj_list */
         list_del(&p->link);
         list_add_tail(&p->link, &rt->gc_obj_list);
-        p->mark = 0; /* reset the mark for the next GC call */
+        p->mark = JS_GC_MARK_NONE; /* reset the mark for the next GC call */
     }
 }
 
@@ -5794,7 +6609,7 @@ static void gc_scan(JSRuntime *rt)
     list_for_each(el, &rt->gc_obj_list) {
         p = list_entry(el, JSGCObjectHeader, link);
         assert(p->ref_count > 0);
-        p->mark = 0; /* reset the mark for the next GC call */
+        p->mark = JS_GC_MARK_NONE; /* reset the mark for the next GC call */
         mark_children(rt, p, gc_scan_incref_child);
     }
 
@@ -5854,10 +6669,469 @@ static void gc_free_cycles(JSRuntime *rt)
     }
 
     init_list_head(&rt->gc_zero_ref_count_list);
+
+    if (!list_empty(&rt->gc_inc_zero_ref_count_list)) {
+        list_splice_tail(&rt->gc_inc_zero_ref_count_list,
+                         &rt->gc_zero_ref_count_list);
+        free_zero_refcount(rt);
+    }
+}
+
+/* Incremental cycle collection
+
+   The work of the cycle collector is split in slices interleaved
+   with the execution:
+
+   - COUNT: the references between the GC objects are counted in the
+     gc_inc_refs table. The counted objects are marked white.
+
+   - ROOTS: the white objects with more references than counted are
+     referenced from outside the GC objects: they are marked grey.
+
+   - SCAN: the white objects referenced by grey objects become grey,
+     the scanned grey objects go back to gc_obj_list.
+
+   - the remaining white objects are candidates: the usual trial
+     deletion is done on them in one step (gc_inc_free_candidates).
+
+   Since the execution modifies the object graph between the slices,
+   the counts and the marks are only hints: the objects created or
+   modified during the collection can only be kept alive (they are not
+   candidates or a reference from outside the candidates is found in
+   the final step), so the trial deletion on the candidates stays
+   exact. No barrier on the reference counts is needed. */
+
+static inline uint32_t gc_inc_refs_hash(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    uint64_t h = (uintptr_t)p * 0x9E3779B97F4A7C15;
+    return (uint32_t)(h >> 32) & (rt->gc_inc_refs_size - 1);
+}
+
+static JSGCRefCountEntry *gc_inc_refs_find(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCRefCountEntry *e;
+    uint32_t h;
+
+    if (!rt->gc_inc_refs)
+        return NULL;
+    h = gc_inc_refs_hash(rt, p);
+    for(;;) {
+        e = &rt->gc_inc_refs[h];
+        if (e->obj == p)
+            return e;
+        if (!e->obj)
+            return NULL;
+        h = (h + 1) & (rt->gc_inc_refs_size - 1);
+    }
+}
+
+static int gc_inc_refs_resize(JSRuntime *rt, uint32_t new_size)
+{
+    JSGCRefCountEntry *new_refs, *e;
+    uint32_t i, h, old_size;
+
+    new_refs = js_mallocz_rt(rt, sizeof(new_refs[0]) * new_size);
+    if (!new_refs)
+        return -1;
+    old_size = rt->gc_inc_refs_size;
+    rt->gc_inc_refs_size = new_size;
+    for(i = 0; i < old_size; i++) {
+        e = &rt->gc_inc_refs[i];
+        if (e->obj) {
+            h = gc_inc_refs_hash(rt, e->obj);
+            while (new_refs[h].obj)
+                h = (h + 1) & (new_size - 1);
+            new_refs[h] = *e;
+        }
+    }
+    js_free_rt(rt, rt->gc_inc_refs);
+    rt->gc_inc_refs = new_refs;
+    return 0;
+}
+
+static void gc_inc_count_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCRefCountEntry *e;
+    uint32_t h;
+
+    if (rt->gc_inc_refs_count * 2 >= rt->gc_inc_refs_size) {
+        if (gc_inc_refs_resize(rt, max_int(rt->gc_inc_refs_size * 2, 1024))) {
+            rt->gc_inc_oom = TRUE;
+            return;
+        }
+    }
+    h = gc_inc_refs_hash(rt, p);
+    for(;;) {
+        e = &rt->gc_inc_refs[h];
+        if (e->obj == p) {
+            e->count++;
+            return;
+        }
+        if (!e->obj)
+            break;
+        h = (h + 1) & (rt->gc_inc_refs_size - 1);
+    }
+    e->obj = p;
+    e->count = 1;
+    rt->gc_inc_refs_count++;
+}
+
+static void gc_inc_scan_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark == JS_GC_MARK_INC_WHITE) {
+        p->mark = JS_GC_MARK_INC_GREY;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_inc_grey_list);
+    }
+}
+
+static void gc_inc_free_refs(JSRuntime *rt)
+{
+    js_free_rt(rt, rt->gc_inc_refs);
+    rt->gc_inc_refs = NULL;
+    rt->gc_inc_refs_size = 0;
+    rt->gc_inc_refs_count = 0;
+}
+
+static void gc_inc_reset_list(JSRuntime *rt, struct list_head *head)
+{
+    struct list_head *el;
+    JSGCObjectHeader *p;
+
+    list_for_each(el, head) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->mark = JS_GC_MARK_NONE;
+    }
+    list_splice_tail(head, &rt->gc_obj_list);
+}
+
+/* cancel the incremental collection in progress, if any */
+static void gc_inc_abort(JSRuntime *rt)
+{
+    if (rt->gc_inc_phase == JS_GC_INC_PHASE_NONE)
+        return;
+    gc_inc_reset_list(rt, &rt->gc_inc_list);
+    gc_inc_reset_list(rt, &rt->gc_inc_white_list);
+    gc_inc_reset_list(rt, &rt->gc_inc_grey_list);
+    gc_inc_free_refs(rt);
+    rt->gc_inc_phase = JS_GC_INC_PHASE_NONE;
+}
+
+/* only the references between candidates are considered */
+static void gc_inc_decref_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark == JS_GC_MARK_INC_WHITE || p->mark == JS_GC_MARK_DECREF)
+        gc_decref_child(rt, p);
+}
+
+static void gc_inc_scan_incref_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark == JS_GC_MARK_DECREF || p->mark == JS_GC_MARK_INC_LIVE) {
+        p->ref_count++;
+        if (p->ref_count == 1) {
+            /* ref_count was 0: remove from tmp_obj_list and add at the
+               end of the candidates to scan */
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->gc_inc_list);
+        }
+    }
+}
+
+static void gc_inc_scan_incref_child2(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark == JS_GC_MARK_DECREF || p->mark == JS_GC_MARK_INC_LIVE)
+        p->ref_count++;
+}
+
+/* same as gc_decref(), gc_scan() and gc_free_cycles() restricted to
+   the candidates in gc_inc_list */
+static void gc_inc_free_candidates(JSRuntime *rt)
+{
+    struct list_head *el, *el1;
+    JSGCObjectHeader *p;
+
+    init_list_head(&rt->tmp_obj_list);
+    list_for_each_safe(el, el1, &rt->gc_inc_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        assert(p->mark == JS_GC_MARK_INC_WHITE);
+        mark_children(rt, p, gc_inc_decref_child);
+        p->mark = JS_GC_MARK_DECREF;
+        if (p->ref_count == 0) {
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->tmp_obj_list);
+        }
+    }
+
+    list_for_each(el, &rt->gc_inc_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        assert(p->ref_count > 0);
+        p->mark = JS_GC_MARK_INC_LIVE;
+        mark_children(rt, p, gc_inc_scan_incref_child);
+    }
+
+    list_for_each(el, &rt->tmp_obj_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        mark_children(rt, p, gc_inc_scan_incref_child2);
+    }
+
+    gc_inc_reset_list(rt, &rt->gc_inc_list);
+    gc_free_cycles(rt);
+}
+
+static void gc_inc_start(JSRuntime *rt)
+{
+    list_splice_tail(&rt->gc_obj_list, &rt->gc_inc_list);
+    rt->gc_inc_oom = FALSE;
+    rt->gc_inc_time = 0;
+    rt->gc_inc_phase = JS_GC_INC_PHASE_COUNT;
+}
+
+static int64_t js_get_monotonic_us(void)
+{
+#if defined(_WIN32)
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+size_t JS_GCAdaptivePolicy(JSRuntime *rt, const JSGCStats *s, void *opaque)
+{
+    static const JSGCPolicyParams default_params = { 0.05, 1.25, 4.0 };
+    const JSGCPolicyParams *p = opaque ? opaque : &default_params;
+    double live, freed_ratio, growth, headroom, rate;
+
+    live = s->last_size_after;
+    freed_ratio = 0;
+    if (s->last_size_before > s->last_size_after) {
+        freed_ratio = (double)(s->last_size_before - s->last_size_after) /
+            s->last_size_before;
+    }
+    /* few cycles: the collections are mostly wasted, collect less
+       often. Many cycles: collect sooner to limit the heap growth. */
+    growth = p->max_growth - (p->max_growth - 1.0) * fmin(freed_ratio * 2, 1.0);
+    headroom = live * (growth - 1.0);
+    /* at the last allocation rate, the next collection must not start
+       before the time spent in this one represents target_overhead of
+       the time */
+    if (s->last_interval_us > 0 && p->target_overhead > 0) {
+        rate = (double)s->last_allocated_size / s->last_interval_us;
+        headroom = fmax(headroom, rate * s->last_time_us *
+                        (1.0 / p->target_overhead - 1.0));
+    }
+    headroom = fmax(headroom, live * (p->min_growth - 1.0));
+    headroom = fmin(headroom, live * (p->max_growth - 1.0));
+    return (size_t)(live + headroom);
+}
+
+void JS_SetGCPolicy(JSRuntime *rt, JSGCPolicy *policy, void *opaque)
+{
+    rt->gc_policy = policy;
+    rt->gc_policy_opaque = opaque;
+}
+
+void JS_GetGCStats(JSRuntime *rt, JSGCStats *s)
+{
+    *s = rt->gc_stats;
+}
+
+static void gc_end_slice(JSRuntime *rt, int64_t start)
+{
+    int64_t t = js_get_monotonic_us() - start;
+    rt->gc_stats.slice_count++;
+    rt->gc_stats.total_time_us += t;
+    rt->gc_stats.max_pause_us = max_int64(rt->gc_stats.max_pause_us, t);
+    rt->gc_inc_time += t;
+}
+
+/* update the statistics and ask the policy for the next threshold */
+static void gc_end_collection(JSRuntime *rt, size_t size_before,
+                              int64_t gc_time)
+{
+    JSGCStats *s = &rt->gc_stats;
+    int64_t end;
+    size_t threshold;
+
+    end = js_get_monotonic_us();
+    s->gc_count++;
+    s->last_time_us = gc_time;
+    s->last_interval_us = max_int64(end - rt->gc_last_end - gc_time, 0);
+    s->last_allocated_size = size_before > s->last_size_after ?
+        size_before - s->last_size_after : 0;
+    s->last_size_before = size_before;
+    s->last_size_after = rt->malloc_state.malloc_size;
+    if (rt->gc_policy)
+        threshold = rt->gc_policy(rt, s, rt->gc_policy_opaque);
+    else
+        threshold = JS_GCAdaptivePolicy(rt, s, NULL);
+    /* collect before reaching the memory limit */
+    if (threshold > rt->malloc_state.malloc_limit &&
+        s->last_size_after < rt->malloc_state.malloc_limit) {
+        threshold = s->last_size_after +
+            (rt->malloc_state.malloc_limit - s->last_size_after) / 2;
+    }
+    if (threshold < rt->malloc_gc_threshold_min)
+        threshold = rt->malloc_gc_threshold_min;
+    s->threshold = threshold;
+    rt->malloc_gc_threshold = threshold;
+    rt->gc_last_end = end;
+#ifdef DUMP_GC
+    printf("GC: %" PRIu64 " -> %" PRIu64 " bytes in %" PRId64 " us, next at %" PRIu64 "\n",
+           (uint64_t)size_before, (uint64_t)s->last_size_after,
+           gc_time, (uint64_t)threshold);
+#endif
+}
+
+JS_BOOL JS_RunIdleGC(JSRuntime *rt, int64_t budget_us)
+{
+    JSGCStats *s = &rt->gc_stats;
+    size_t size, growth;
+
+    if (budget_us <= 0)
+        return rt->gc_inc_phase == JS_GC_INC_PHASE_NONE;
+    if (rt->gc_inc_phase == JS_GC_INC_PHASE_NONE) {
+        /* start a collection only if the heap grew by a quarter or is
+           half way to the next automatic one */
+        size = rt->malloc_state.malloc_size;
+        if (rt->malloc_gc_threshold == (size_t)-1 ||
+            size <= s->last_size_after + 64 * 1024)
+            return TRUE;
+        growth = size - s->last_size_after;
+        /* the policy may return a threshold below the live heap size */
+        if (growth < s->last_size_after / 4 &&
+            rt->malloc_gc_threshold > s->last_size_after &&
+            size < s->last_size_after +
+            (rt->malloc_gc_threshold - s->last_size_after) / 2)
+            return TRUE;
+    }
+    return JS_RunGCSlice(rt, budget_us);
+}
+
+void JS_TrimMemory(JSRuntime *rt)
+{
+    struct list_head *lists[] = { &rt->gc_obj_list, &rt->gc_inc_list,
+                                  &rt->gc_inc_white_list, &rt->gc_inc_grey_list };
+    struct list_head *el;
+    JSGCObjectHeader *gp;
+    JSObject *p;
+    int i;
+
+    JS_TrimAtomHash(rt);
+    js_trim_shape_hash(rt);
+    for(i = 0; i < countof(lists); i++) {
+        list_for_each(el, lists[i]) {
+            gp = list_entry(el, JSGCObjectHeader, link);
+            if (gp->gc_obj_type != JS_GC_OBJ_TYPE_JS_OBJECT)
+                continue;
+            p = (JSObject *)gp;
+            if (p->class_id >= JS_CLASS_MAP && p->class_id <= JS_CLASS_WEAKSET &&
+                p->u.map_state)
+                map_hash_trim(rt, p->u.map_state);
+        }
+    }
+}
+
+void JS_SetGCSliceBudget(JSRuntime *rt, int64_t slice_budget_us)
+{
+    rt->gc_slice_budget = max_int64(slice_budget_us, 0);
+}
+
+JS_BOOL JS_RunGCSlice(JSRuntime *rt, int64_t budget_us)
+{
+    struct list_head *el;
+    JSGCObjectHeader *p;
+    JSGCRefCountEntry *e;
+    int64_t start, deadline;
+    size_t size_before;
+    int n;
+
+    if (rt->gc_inc_running || rt->gc_phase != JS_GC_PHASE_NONE)
+        return FALSE;
+    start = js_get_monotonic_us();
+    deadline = budget_us < 0 ? INT64_MAX : start + budget_us;
+    rt->gc_inc_running = TRUE;
+    if (rt->gc_inc_phase == JS_GC_INC_PHASE_NONE)
+        gc_inc_start(rt);
+
+    for(n = 1;; n++) {
+        switch(rt->gc_inc_phase) {
+        case JS_GC_INC_PHASE_COUNT:
+            el = rt->gc_inc_list.next;
+            if (el == &rt->gc_inc_list) {
+                list_splice_tail(&rt->gc_inc_white_list, &rt->gc_inc_list);
+                rt->gc_inc_phase = JS_GC_INC_PHASE_ROOTS;
+                break;
+            }
+            p = list_entry(el, JSGCObjectHeader, link);
+            mark_children(rt, p, gc_inc_count_child);
+            p->mark = JS_GC_MARK_INC_WHITE;
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->gc_inc_white_list);
+            break;
+        case JS_GC_INC_PHASE_ROOTS:
+            el = rt->gc_inc_list.next;
+            if (el == &rt->gc_inc_list) {
+                /* the candidates are the objects left white */
+                list_splice_tail(&rt->gc_inc_white_list, &rt->gc_inc_list);
+                gc_inc_free_refs(rt);
+                rt->gc_inc_phase = JS_GC_INC_PHASE_SCAN;
+                break;
+            }
+            p = list_entry(el, JSGCObjectHeader, link);
+            e = gc_inc_refs_find(rt, p);
+            list_del(&p->link);
+            if (!e || e->count < p->ref_count) {
+                p->mark = JS_GC_MARK_INC_GREY;
+                list_add_tail(&p->link, &rt->gc_inc_grey_list);
+            } else {
+                list_add_tail(&p->link, &rt->gc_inc_white_list);
+            }
+            break;
+        case JS_GC_INC_PHASE_SCAN:
+            el = rt->gc_inc_grey_list.next;
+            if (el == &rt->gc_inc_grey_list) {
+                size_before = rt->malloc_state.malloc_size;
+                gc_inc_free_candidates(rt);
+                rt->gc_inc_phase = JS_GC_INC_PHASE_NONE;
+                gc_end_slice(rt, start);
+                gc_end_collection(rt, size_before, rt->gc_inc_time);
+                rt->gc_inc_running = FALSE;
+                return TRUE;
+            }
+            p = list_entry(el, JSGCObjectHeader, link);
+            mark_children(rt, p, gc_inc_scan_child);
+            p->mark = JS_GC_MARK_NONE;
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->gc_obj_list);
+            break;
+        default:
+            abort();
+        }
+        if (unlikely(rt->gc_inc_oom)) {
+            gc_inc_abort(rt);
+            break;
+        }
+        if ((n & 127) == 0 && js_get_monotonic_us() >= deadline)
+            break;
+    }
+    gc_end_slice(rt, start);
+    rt->gc_inc_running = FALSE;
+    return FALSE;
 }
 
 void JS_RunGC(JSRuntime *rt)
 {
+    int64_t start, t;
+    size_t size_before;
+
+    gc_inc_abort(rt);
+    start = js_get_monotonic_us();
+    size_before = rt->malloc_state.malloc_size;
+
     /* decrement the reference of the children of each object. mark =
        1 after this pass. */
     gc_decref(rt);
@@ -5867,6 +7141,11 @@ void JS_RunGC(JSRuntime *rt)
 
     /* free the GC objects in a cycle */
     gc_free_cycles(rt);
+
+    t = js_get_monotonic_us() - start;
+    rt->gc_stats.total_time_us += t;
+    rt->gc_stats.max_pause_us = max_int64(rt->gc_stats.max_pause_us, t);
+    gc_end_collection(rt, size_before, t);
 }
 
 /* Return false if not an object or if the object has already been
@@ -5925,6 +7204,14 @@ static void compute_bytecode_size(JSFunctionBytecode *b, JSMemoryUsage_helper *h
     if (b->closure_var) {
         js_func_size += b->closure_var_count * sizeof(*b->closure_var);
     }
+    if (b->ic) {
+        memory_used_count++;
+        js_func_size += b->ic_count * sizeof(*b->ic);
+    }
+    if (b->gv_cache) {
+        memory_used_count++;
+        js_func_size += b->gv_cache_count * sizeof(*b->gv_cache);
+    }
     if (!b->read_only_bytecode && b->byte_code_buf) {
         hp->js_func_code_size += b->byte_code_len;
     }
@@ -5951,6 +7238,16 @@ static void compute_value_size(JSValueConst val, JSMemoryUsage_helper *hp)
     case JS_TAG_STRING:
         compute_jsstring_size(JS_VALUE_GET_STRING(val), hp);
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(val);
+            double s_ref_count = r->header.ref_count;
+            hp->str_count += 1 / s_ref_count;
+            hp->str_size += sizeof(*r) / s_ref_count;
+            compute_value_size(r->left, hp);
+            compute_value_size(r->right, hp);
+        }
+        break;
     case JS_TAG_BIG_INT:
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_FLOAT:
@@ -5967,6 +7264,9 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
     int i;
     JSMemoryUsage_helper mem = { 0 }, *hp = &mem;
 
+    /* all the GC objects must be in gc_obj_list */
+    gc_inc_abort(rt);
+
     memset(s, 0, sizeof(*s));
     s->malloc_count = rt->malloc_state.malloc_count;
     s->malloc_size = rt->malloc_state.malloc_size;
@@ -6960,6 +8260,7 @@ static JSValueConst JS_GetPrototypePrimitive(JSContext *ctx, JSValueConst val)
         val = ctx->class_proto[JS_CLASS_BOOLEAN];
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = ctx->class_proto[JS_CLASS_STRING];
         break;
     case JS_TAG_SYMBOL:
@@ -7173,6 +8474,20 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
                 }
             }
             break;
+        case JS_TAG_STRING_ROPE:
+            {
+                JSStringRope *r = JS_VALUE_GET_PTR(obj);
+                if (__JS_AtomIsTaggedInt(prop)) {
+                    JSValueConst str = js_string_rope_flatten(ctx, obj);
+                    if (JS_IsException(str))
+                        return JS_EXCEPTION;
+                    return JS_GetPropertyInternal(ctx, str, prop, this_obj,
+                                                  throw_ref_error);
+                } else if (prop == JS_ATOM_length) {
+                    return JS_NewInt32(ctx, r->len);
+                }
+            }
+            break;
         default:
             break;
         }
@@ -9018,6 +10333,8 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
     uint32_t idx = 0;    /* prevent warning */
 
     sh = p->shape;
+    if (sh->is_global)
+        ctx->rt->global_var_gen++;
     if (sh->is_hashed) {
         if (sh->header.ref_count != 1) {
             if (pprs)
@@ -9708,6 +11025,111 @@ static int JS_SetGlobalVar(JSContext *ctx, JSAtom prop, JSValue val,
     return JS_SetPropertyInternal(ctx, ctx->global_obj, prop, val, ctx->global_obj, flags);
 }
 
+/* the modifications of the properties of 'obj' invalidate the global
+   variable caches */
+static void js_set_global_shape(JSContext *ctx, JSValueConst obj)
+{
+    JSObject *p;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return;
+    p = JS_VALUE_GET_OBJ(obj);
+    /* get an unhashed shape which is modified in place */
+    if (js_shape_prepare_update(ctx, p, NULL))
+        return;
+    p->shape->is_global = TRUE;
+}
+
+/* cache the slot of a global data property. Only the writable
+   properties are cached for the assignments. */
+static void update_global_var_cache(JSContext *ctx, JSFunctionBytecode *b,
+                                    int cache_idx, JSAtom prop, BOOL is_put)
+{
+    JSObject *p;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSGlobalVarCache *c;
+    BOOL is_lexical;
+
+    if (cache_idx == JS_IC_NONE)
+        return;
+    p = JS_VALUE_GET_OBJ(ctx->global_var_obj);
+    prs = find_own_property(&pr, p, prop);
+    is_lexical = (prs != NULL);
+    if (!prs) {
+        p = JS_VALUE_GET_OBJ(ctx->global_obj);
+        prs = find_own_property(&pr, p, prop);
+        if (!prs)
+            return;
+    }
+    if (!p->shape->is_global ||
+        (prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL ||
+        (is_put && !(prs->flags & JS_PROP_WRITABLE)))
+        return;
+    if (!b->gv_cache) {
+        b->gv_cache = js_mallocz_rt(ctx->rt, sizeof(b->gv_cache[0]) *
+                                    b->gv_cache_count);
+        if (!b->gv_cache)
+            return;
+    }
+    c = &b->gv_cache[cache_idx];
+    c->gen = ctx->rt->global_var_gen;
+    c->prop_index = pr - p->prop;
+    c->is_lexical = is_lexical;
+}
+
+/* return the cached slot of a global variable or NULL */
+static inline JSProperty *find_global_var_cache(JSContext *ctx,
+                                                JSFunctionBytecode *b,
+                                                int cache_idx)
+{
+    JSGlobalVarCache *c;
+    JSObject *p;
+    JSProperty *pr;
+
+    if (unlikely(!b->gv_cache))
+        return NULL;
+    c = &b->gv_cache[cache_idx];
+    if (unlikely(c->gen != ctx->rt->global_var_gen))
+        return NULL;
+    p = JS_VALUE_GET_OBJ(c->is_lexical ? ctx->global_var_obj : ctx->global_obj);
+    pr = &p->prop[c->prop_index];
+    /* the lexical variables are checked by the slow path */
+    if (unlikely(JS_IsUninitialized(pr->u.value)))
+        return NULL;
+    return pr;
+}
+
+static inline JSValue get_global_var_cache(JSContext *ctx,
+                                           JSFunctionBytecode *b,
+                                           int cache_idx, JSAtom prop,
+                                           BOOL throw_ref_error)
+{
+    JSProperty *pr;
+
+    pr = find_global_var_cache(ctx, b, cache_idx);
+    if (likely(pr))
+        return JS_DupValue(ctx, pr->u.value);
+    update_global_var_cache(ctx, b, cache_idx, prop, FALSE);
+    return JS_GetGlobalVar(ctx, prop, throw_ref_error);
+}
+
+/* 'flag' is 0 or 2 as in JS_SetGlobalVar() */
+static inline int put_global_var_cache(JSContext *ctx, JSFunctionBytecode *b,
+                                       int cache_idx, JSAtom prop,
+                                       JSValue val, int flag)
+{
+    JSProperty *pr;
+
+    pr = find_global_var_cache(ctx, b, cache_idx);
+    if (likely(pr)) {
+        set_value(ctx, &pr->u.value, val);
+        return 0;
+    }
+    update_global_var_cache(ctx, b, cache_idx, prop, TRUE);
+    return JS_SetGlobalVar(ctx, prop, val, flag);
+}
+
 /* return -1, FALSE or TRUE. return FALSE if not configurable or
    invalid object. return -1 in case of exception.
    flags can be 0, JS_PROP_THROW or JS_PROP_THROW_STRICT */
@@ -10056,6 +11478,158 @@ static inline int to_digit(int c)
         return 36;
 }
 
+/* 64x64 -> 128 bit multiplication. Return the low part. */
+static inline uint64_t dtoa_mul64(uint64_t a, uint64_t b, uint64_t *phi)
+{
+#if LIMB_BITS == 64
+    uint128_t r = (uint128_t)a * b;
+    *phi = r >> 64;
+    return (uint64_t)r;
+#else
+    uint32_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint32_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t t0, t1, t2, t3, mid;
+    t0 = (uint64_t)a_lo * b_lo;
+    t1 = (uint64_t)a_lo * b_hi;
+    t2 = (uint64_t)a_hi * b_lo;
+    t3 = (uint64_t)a_hi * b_hi;
+    mid = (t0 >> 32) + (uint32_t)t1 + (uint32_t)t2;
+    *phi = t3 + (t1 >> 32) + (t2 >> 32) + (mid >> 32);
+    return (mid << 32) | (uint32_t)t0;
+#endif
+}
+
+/* Compute w * 10^q correctly rounded to a normal float64 using the
+   Eisel-Lemire algorithm (D. Lemire, "Number Parsing at a Gigabyte per
+   Second", 2021). Return FALSE if the result could not be decided
+   (rare halfway cases, subnormals and overflows). 'w' is not zero. */
+static BOOL js_eisel_lemire(uint64_t w, int q, double *pd)
+{
+    const uint64_t *pow10;
+    uint64_t hi, lo, hi2, lo2, mant, exp2, msb;
+    JSFloat64Union u;
+    int lz;
+
+    if (q < DTOA_POW10_MIN || q > DTOA_POW10_MAX)
+        return FALSE;
+    pow10 = dtoa_pow10_split[q - DTOA_POW10_MIN];
+    lz = clz64(w);
+    w <<= lz;
+    /* floor(q * log2(10)) + 64 + bias */
+    exp2 = (uint64_t)(((217706 * q) >> 16) + 64 + 1023 - lz);
+    lo = dtoa_mul64(w, pow10[1], &hi);
+    if ((hi & 0x1ff) == 0x1ff && lo + w < w) {
+        /* the truncated product may be too small: use the full 128
+           bit multiplier */
+        lo2 = dtoa_mul64(w, pow10[0], &hi2);
+        lo += hi2;
+        hi += (lo < hi2);
+        if ((hi & 0x1ff) == 0x1ff && lo + 1 == 0 && lo2 + w < w)
+            return FALSE;
+    }
+    msb = hi >> 63;
+    mant = hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+    /* halfway between two floats: the exact value is needed */
+    if (lo == 0 && (hi & 0x1ff) == 0 && (mant & 3) == 1)
+        return FALSE;
+    /* round to 53 bits */
+    mant += mant & 1;
+    mant >>= 1;
+    if (mant >> 53) {
+        mant >>= 1;
+        exp2++;
+    }
+    if (exp2 - 1 >= 0x7ff - 1)
+        return FALSE;
+    u.u64 = (exp2 << 52) | (mant & ((UINT64_C(1) << 52) - 1));
+    *pd = u.d;
+    return TRUE;
+}
+
+/* Parse the decimal number [p, p_end) made of digits, an optional
+   fraction and an optional exponent. Return FALSE if the number
+   contains separators or if its value cannot be decided without
+   arbitrary precision. */
+static BOOL js_atod10(const char *p, const char *p_end, BOOL is_neg,
+                      double *pd)
+{
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    uint64_t w;
+    int n_digits, exp10, e, c;
+    BOOL truncated, exp_neg;
+    double d, d1;
+
+    w = 0;
+    n_digits = 0;
+    exp10 = 0;
+    truncated = FALSE;
+    /* keep the 19 first significant digits, which fit in 64 bits */
+    while (p < p_end && is_digit((uint8_t)*p)) {
+        c = *p++ - '0';
+        if (n_digits < 19) {
+            w = w * 10 + c;
+            n_digits += (w != 0);
+        } else {
+            exp10++;
+            truncated |= (c != 0);
+        }
+    }
+    if (p < p_end && *p == '.') {
+        p++;
+        while (p < p_end && is_digit((uint8_t)*p)) {
+            c = *p++ - '0';
+            if (n_digits < 19) {
+                w = w * 10 + c;
+                n_digits += (w != 0);
+                exp10--;
+            } else {
+                truncated |= (c != 0);
+            }
+        }
+    }
+    if (p < p_end && (*p == 'e' || *p == 'E')) {
+        p++;
+        exp_neg = FALSE;
+        if (p < p_end && (*p == '+' || *p == '-'))
+            exp_neg = (*p++ == '-');
+        e = 0;
+        while (p < p_end && is_digit((uint8_t)*p)) {
+            if (e < 100000)
+                e = e * 10 + (*p - '0');
+            p++;
+        }
+        exp10 += exp_neg ? -e : e;
+    }
+    if (p != p_end)
+        return FALSE;
+
+    if (w == 0) {
+        d = 0;
+    } else if (!truncated) {
+        if (w <= ((uint64_t)1 << 53) && exp10 >= -22 && exp10 <= 22) {
+            /* both w and 10^|exp10| are exact float64 values */
+            d = (double)w;
+            if (exp10 < 0)
+                d /= pow10[-exp10];
+            else
+                d *= pow10[exp10];
+        } else if (!js_eisel_lemire(w, exp10, &d)) {
+            return FALSE;
+        }
+    } else {
+        /* the value is between w and w + 1 times 10^exp10 */
+        if (!js_eisel_lemire(w, exp10, &d) ||
+            !js_eisel_lemire(w + 1, exp10, &d1) || d != d1)
+            return FALSE;
+    }
+    *pd = is_neg ? -d : d;
+    return TRUE;
+}
+
 /* XXX: remove */
 static double js_strtod(const char *str, int radix, BOOL is_float)
 {
@@ -10213,7 +11787,7 @@ static JSValue js_atof(JSContext *ctx, const char *str, const char **pp,
                        int radix, int flags)
 #endif
 {
-    const char *p, *p_start;
+    const char *p, *p_start, *p_end;
     int sep, is_neg;
     BOOL is_float, has_legacy_octal;
     int atod_type = flags & ATOD_TYPE_MASK;
@@ -10339,25 +11913,7 @@ static JSValue js_atof(JSContext *ctx, const char *str, const char **pp,
     }
     if (p == p_start)
         goto fail;
-
-    buf = buf1;
-    buf_allocated = FALSE;
-    len = p - p_start;
-    if (unlikely((len + 2) > sizeof(buf1))) {
-        buf = js_malloc_rt(ctx->rt, len + 2); /* no exception raised */
-        if (!buf)
-            goto mem_error;
-        buf_allocated = TRUE;
-    }
-    /* remove the separators and the radix prefixes */
-    j = 0;
-    if (is_neg)
-        buf[j++] = '-';
-    for (i = 0; i < len; i++) {
-        if (p_start[i] != '_')
-            buf[j++] = p_start[i];
-    }
-    buf[j] = '\0';
+    p_end = p;
 
     if (flags & ATOD_ACCEPT_SUFFIX) {
         if (*p == 'n') {
@@ -10399,6 +11955,34 @@ static JSValue js_atof(JSContext *ctx, const char *str, const char **pp,
         }
     }
 
+    if (atod_type == ATOD_TYPE_FLOAT64 && radix == 10) {
+        double d;
+        /* common case: no need to copy the digits */
+        if (js_atod10(p_start, p_end, is_neg, &d)) {
+            val = JS_NewFloat64(ctx, d);
+            goto done;
+        }
+    }
+
+    buf = buf1;
+    buf_allocated = FALSE;
+    len = p_end - p_start;
+    if (unlikely((len + 2) > sizeof(buf1))) {
+        buf = js_malloc_rt(ctx->rt, len + 2); /* no exception raised */
+        if (!buf)
+            goto mem_error;
+        buf_allocated = TRUE;
+    }
+    /* remove the separators and the radix prefixes */
+    j = 0;
+    if (is_neg)
+        buf[j++] = '-';
+    for (i = 0; i < len; i++) {
+        if (p_start[i] != '_')
+            buf[j++] = p_start[i];
+    }
+    buf[j] = '\0';
+
     switch(atod_type) {
     case ATOD_TYPE_FLOAT64:
         {
@@ -10507,6 +12091,7 @@ static JSValue JS_ToNumberHintFree(JSContext *ctx, JSValue val,
             return JS_EXCEPTION;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str;
             const char *p;
@@ -10914,6 +12499,34 @@ int JS_ToInt64Ext(JSContext *ctx, int64_t *pres, JSValueConst val)
         return JS_ToInt64(ctx, pres, val);
 }
 
+/* ToInt32() of a float64 */
+static inline int32_t js_float64_to_int32(double d)
+{
+    JSFloat64Union u;
+    int32_t ret;
+    int e;
+
+    u.d = d;
+    /* we avoid doing fmod(x, 2^32) */
+    e = (u.u64 >> 52) & 0x7ff;
+    if (likely(e <= (1023 + 30))) {
+        /* fast case */
+        ret = (int32_t)d;
+    } else if (e <= (1023 + 30 + 53)) {
+        uint64_t v;
+        /* remainder modulo 2^32 */
+        v = (u.u64 & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52);
+        v = v << ((e - 1023) - 52 + 32);
+        ret = v >> 32;
+        /* take the sign into account */
+        if (u.u64 >> 63)
+            ret = -(uint32_t)ret;
+    } else {
+        ret = 0; /* also handles NaN and +inf */
+    }
+    return ret;
+}
+
 /* return (<0, 0) in case of exception */
 static int JS_ToInt32Free(JSContext *ctx, int32_t *pres, JSValue val)
 {
@@ -10930,30 +12543,7 @@ static int JS_ToInt32Free(JSContext *ctx, int32_t *pres, JSValue val)
         ret = JS_VALUE_GET_INT(val);
         break;
     case JS_TAG_FLOAT64:
-        {
-            JSFloat64Union u;
-            double d;
-            int e;
-            d = JS_VALUE_GET_FLOAT64(val);
-            u.d = d;
-            /* we avoid doing fmod(x, 2^32) */
-            e = (u.u64 >> 52) & 0x7ff;
-            if (likely(e <= (1023 + 30))) {
-                /* fast case */
-                ret = (int32_t)d;
-            } else if (e <= (1023 + 30 + 53)) {
-                uint64_t v;
-                /* remainder modulo 2^32 */
-                v = (u.u64 & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52);
-                v = v << ((e - 1023) - 52 + 32);
-                ret = v >> 32;
-                /* take the sign into account */
-                if (u.u64 >> 63)
-                    ret = -ret;
-            } else {
-                ret = 0; /* also handles NaN and +inf */
-            }
-        }
+        ret = js_float64_to_int32(JS_VALUE_GET_FLOAT64(val));
         break;
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_FLOAT:
@@ -11369,6 +12959,207 @@ static char *i64toa(char *buf_end, int64_t n, unsigned int base)
     return q;
 }
 
+/* Shortest round trip double to decimal conversion using the Ryu
+   algorithm (Ulf Adams, "Ryu: fast float-to-string conversion",
+   PLDI 2018). The multipliers are in dtoa-table.h. */
+
+#define DTOA_POW5_INV_BITCOUNT 125
+#define DTOA_POW5_BITCOUNT     125
+
+/* ceil(log2(5^e)) for 1 <= e <= 3528, 1 for e = 0 */
+static inline int dtoa_pow5bits(int e)
+{
+    return ((e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)) for 0 <= e <= 1650 */
+static inline int dtoa_log10_pow2(int e)
+{
+    return (e * 78913) >> 18;
+}
+
+/* floor(log10(5^e)) for 0 <= e <= 2620 */
+static inline int dtoa_log10_pow5(int e)
+{
+    return (e * 732923) >> 20;
+}
+
+static inline BOOL dtoa_multiple_of_pow5(uint64_t v, int p)
+{
+    int count = 0;
+    /* v != 0 */
+    while ((v % 5) == 0) {
+        v /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+static inline BOOL dtoa_multiple_of_pow2(uint64_t v, int p)
+{
+    return (v & ((UINT64_C(1) << p) - 1)) == 0;
+}
+
+/* (m * mul) >> j with mul a 128 bit multiplier and 64 <= j < 128 */
+static inline uint64_t dtoa_mul_shift(uint64_t m, const uint64_t *mul, int j)
+{
+#if LIMB_BITS == 64
+    uint128_t b0, b2;
+    b0 = (uint128_t)m * mul[0];
+    b2 = (uint128_t)m * mul[1];
+    return (uint64_t)(((b0 >> 64) + b2) >> (j - 64));
+#else
+    uint64_t b0_hi, b2_lo, b2_hi, lo, hi;
+    dtoa_mul64(m, mul[0], &b0_hi);
+    b2_lo = dtoa_mul64(m, mul[1], &b2_hi);
+    lo = b0_hi + b2_lo;
+    hi = b2_hi + (lo < b0_hi);
+    j -= 64;
+    if (j == 0)
+        return lo;
+    return (hi << (64 - j)) | (lo >> j);
+#endif
+}
+
+/* 'd' must be finite and non zero. Store the shortest decimal digits
+   'buf' such that 0.buf * 10^decpt rounds to 'd'. When several
+   candidates have the same length, the closest to 'd' is chosen. Return
+   the number of digits. */
+static int js_dtoa_shortest(double d, int *decpt, int *sign, char *buf)
+{
+    JSFloat64Union u;
+    uint64_t a, mant, m2, mv, vr, vp, vm, output, q10;
+    int exp, e2, e10, q, i, k, removed, last_removed_digit, n, j;
+    BOOL accept_bounds, vm_is_trailing_zeros, vr_is_trailing_zeros;
+    uint32_t mm_shift;
+    char tmp[24];
+
+    u.d = d;
+    a = u.u64;
+    *sign = a >> 63;
+    mant = a & ((UINT64_C(1) << 52) - 1);
+    exp = (a >> 52) & 0x7ff;
+    if (exp == 0) {
+        e2 = 1 - 1023 - 52 - 2;
+        m2 = mant;
+    } else {
+        e2 = exp - 1023 - 52 - 2;
+        m2 = (UINT64_C(1) << 52) | mant;
+    }
+    accept_bounds = (m2 & 1) == 0;
+    /* the interval of the numbers rounding to 'd' is [mv - 2 -
+       mm_shift, mv + 2] * 2^e2, with closed bounds if accept_bounds */
+    mv = 4 * m2;
+    mm_shift = (mant != 0 || exp <= 1);
+    vm_is_trailing_zeros = FALSE;
+    vr_is_trailing_zeros = FALSE;
+    if (e2 >= 0) {
+        q = dtoa_log10_pow2(e2) - (e2 > 3);
+        e10 = q;
+        k = DTOA_POW5_INV_BITCOUNT + dtoa_pow5bits(q) - 1;
+        i = -e2 + q + k;
+        vr = dtoa_mul_shift(4 * m2, dtoa_pow5_inv_split[q], i);
+        vp = dtoa_mul_shift(4 * m2 + 2, dtoa_pow5_inv_split[q], i);
+        vm = dtoa_mul_shift(4 * m2 - 1 - mm_shift, dtoa_pow5_inv_split[q], i);
+        if (q <= 21) {
+            /* only one of mp, mv and mm can be a multiple of 5 */
+            if ((mv % 5) == 0) {
+                vr_is_trailing_zeros = dtoa_multiple_of_pow5(mv, q);
+            } else if (accept_bounds) {
+                vm_is_trailing_zeros = dtoa_multiple_of_pow5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= dtoa_multiple_of_pow5(mv + 2, q);
+            }
+        }
+    } else {
+        q = dtoa_log10_pow5(-e2) - (-e2 > 1);
+        e10 = q + e2;
+        i = -e2 - q;
+        k = dtoa_pow5bits(i) - DTOA_POW5_BITCOUNT;
+        j = q - k;
+        vr = dtoa_mul_shift(4 * m2, dtoa_pow5_split[i], j);
+        vp = dtoa_mul_shift(4 * m2 + 2, dtoa_pow5_split[i], j);
+        vm = dtoa_mul_shift(4 * m2 - 1 - mm_shift, dtoa_pow5_split[i], j);
+        if (q <= 1) {
+            /* mv has at least q trailing zero bits, so vr too */
+            vr_is_trailing_zeros = TRUE;
+            if (accept_bounds) {
+                vm_is_trailing_zeros = (mm_shift == 1);
+            } else {
+                vp--;
+            }
+        } else if (q < 63) {
+            vr_is_trailing_zeros = dtoa_multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* remove the digits shared by vm and vp */
+    removed = 0;
+    last_removed_digit = 0;
+    if (vm_is_trailing_zeros || vr_is_trailing_zeros) {
+        /* rare case: exact halfway and inclusive bounds must be tracked */
+        while (vp / 10 > vm / 10) {
+            vm_is_trailing_zeros &= (vm % 10) == 0;
+            vr_is_trailing_zeros &= (last_removed_digit == 0);
+            last_removed_digit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_is_trailing_zeros) {
+            while ((vm % 10) == 0) {
+                vr_is_trailing_zeros &= (last_removed_digit == 0);
+                last_removed_digit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_is_trailing_zeros && last_removed_digit == 5 && (vr % 2) == 0) {
+            /* round to even */
+            last_removed_digit = 4;
+        }
+        output = vr + ((vr == vm && (!accept_bounds || !vm_is_trailing_zeros)) ||
+                       last_removed_digit >= 5);
+    } else {
+        BOOL round_up = FALSE;
+        if (vp / 100 > vm / 100) {
+            round_up = (vr % 100) >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = (vr % 10) >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    /* the result is output * 10^(e10 + removed) */
+    n = 0;
+    while (output >= 10 && (output % 10) == 0) {
+        output /= 10;
+        removed++;
+    }
+    do {
+        q10 = output / 10;
+        tmp[n++] = '0' + (int)(output - q10 * 10);
+        output = q10;
+    } while (output != 0);
+    for(i = 0; i < n; i++)
+        buf[i] = tmp[n - 1 - i];
+    buf[n] = '\0';
+    *decpt = n + e10 + removed;
+    return n;
+}
+
 /* buf1 contains the printf result */
 static void js_ecvt1(double d, int n_digits, int *decpt, int *sign, char *buf,
                      int rounding_mode, char *buf1, int buf1_size)
@@ -11392,7 +13183,8 @@ static void js_ecvt1(double d, int n_digits, int *decpt, int *sign, char *buf,
 #define JS_DTOA_BUF_SIZE 128
 
 /* needed because ecvt usually limits the number of digits to
-   17. Return the number of digits. */
+   17. If 'is_fixed' is false, use the minimum number of digits. Return
+   the number of digits. */
 static int js_ecvt(double d, int n_digits, int *decpt, int *sign, char *buf,
                    BOOL is_fixed)
 {
@@ -11400,25 +13192,14 @@ static int js_ecvt(double d, int n_digits, int *decpt, int *sign, char *buf,
     char buf_tmp[JS_DTOA_BUF_SIZE];
 
     if (!is_fixed) {
-        unsigned int n_digits_min, n_digits_max;
-        /* find the minimum amount of digits (XXX: inefficient but simple) */
-        n_digits_min = 1;
-        n_digits_max = 17;
-        while (n_digits_min < n_digits_max) {
-            n_digits = (n_digits_min + n_digits_max) / 2;
-            js_ecvt1(d, n_digits, decpt, sign, buf, FE_TONEAREST,
-                     buf_tmp, sizeof(buf_tmp));
-            if (strtod(buf_tmp, NULL) == d) {
-                /* no need to keep the trailing zeros */
-                while (n_digits >= 2 && buf[n_digits - 1] == '0')
-                    n_digits--;
-                n_digits_max = n_digits;
-            } else {
-                n_digits_min = n_digits + 1;
-            }
+        if (d == 0) {
+            *sign = (signbit(d) != 0);
+            buf[0] = '0';
+            buf[1] = '\0';
+            *decpt = 1;
+            return 1;
         }
-        n_digits = n_digits_max;
-        rounding_mode = FE_TONEAREST;
+        return js_dtoa_shortest(d, decpt, sign, buf);
     } else {
         rounding_mode = FE_TONEAREST;
 #ifdef CONFIG_PRINTF_RNDN
@@ -11595,9 +13376,18 @@ static void js_dtoa1(char (*buf)[JS_DTOA_BUF_SIZE], double d,
                 }
                 *q++ = 'e';
                 p = n - 1;
-                if (p >= 0)
+                if (p >= 0) {
                     *q++ = '+';
-                snprintf(q, *buf + sizeof(*buf) - q, "%d", p);
+                } else {
+                    *q++ = '-';
+                    p = -p;
+                }
+                if (p >= 100)
+                    *q++ = '0' + p / 100;
+                if (p >= 10)
+                    *q++ = '0' + (p / 10) % 10;
+                *q++ = '0' + p % 10;
+                *q = '\0';
             }
         }
     }
@@ -11695,6 +13485,8 @@ JSValue JS_ToStringInternal(JSContext *ctx, JSValueConst val, BOOL is_ToProperty
     switch(tag) {
     case JS_TAG_STRING:
         return JS_DupValue(ctx, val);
+    case JS_TAG_STRING_ROPE:
+        return JS_DupValue(ctx, js_string_rope_flatten(ctx, val));
     case JS_TAG_INT:
         snprintf(buf, sizeof(buf), "%d", JS_VALUE_GET_INT(val));
         str = buf;
@@ -11779,26 +13571,61 @@ static JSValue JS_ToStringCheckObject(JSContext *ctx, JSValueConst val)
     return JS_ToString(ctx, val);
 }
 
-static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
+/* return the first character of [p, p_end) which must be escaped in a
+   quoted string: '"', '\\' or a control character */
+static const uint8_t *quoted_string_scan8(const uint8_t *p, const uint8_t *p_end)
+{
+#if defined(__AVX2__)
+    while (p_end - p >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, _mm256_set1_epi8(0x1f)),
+                                                      _mm256_set1_epi8(0x1f)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(a, _mm256_set1_epi8('"')),
+                                                    _mm256_cmpeq_epi8(a, _mm256_set1_epi8('\\'))));
+        uint32_t mask = _mm256_movemask_epi8(m);
+        if (mask)
+            return p + ctz32(mask);
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    while (p_end - p >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(a, _mm_set1_epi8(0x1f)),
+                                                _mm_set1_epi8(0x1f)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8('"')),
+                                              _mm_cmpeq_epi8(a, _mm_set1_epi8('\\'))));
+        uint32_t mask = _mm_movemask_epi8(m);
+        if (mask)
+            return p + ctz32(mask);
+        p += 16;
+    }
+#endif
+    while (p < p_end && *p >= 0x20 && *p != '"' && *p != '\\')
+        p++;
+    return p;
+}
+
+/* append the JSON quoted form of 'p' to 'b' */
+static int string_buffer_put_quoted(StringBuffer *b, JSString *p)
 {
-    JSValue val;
-    JSString *p;
-    int i;
+    int i, j;
     uint32_t c;
-    StringBuffer b_s, *b = &b_s;
     char buf[16];
 
-    val = JS_ToStringCheckObject(ctx, val1);
-    if (JS_IsException(val))
-        return val;
-    p = JS_VALUE_GET_STRING(val);
-
-    if (string_buffer_init(ctx, b, p->len + 2))
-        goto fail;
-
     if (string_buffer_putc8(b, '\"'))
-        goto fail;
+        return -1;
     for(i = 0; i < p->len; ) {
+        if (!p->is_wide_char) {
+            /* copy the characters which need no escape at once */
+            j = quoted_string_scan8(p->u.str8 + i, p->u.str8 + p->len) - p->u.str8;
+            if (j > i) {
+                if (string_buffer_write8(b, p->u.str8 + i, j - i))
+                    return -1;
+                i = j;
+                if (i >= p->len)
+                    break;
+            }
+        }
         c = string_getc(p, &i);
         switch(c) {
         case '\t':
@@ -11820,23 +13647,39 @@ static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
         case '\\':
         quote:
             if (string_buffer_putc8(b, '\\'))
-                goto fail;
+                return -1;
             if (string_buffer_putc8(b, c))
-                goto fail;
+                return -1;
             break;
         default:
             if (c < 32 || is_surrogate(c)) {
                 snprintf(buf, sizeof(buf), "\\u%04x", c);
                 if (string_buffer_puts8(b, buf))
-                    goto fail;
+                    return -1;
             } else {
                 if (string_buffer_putc(b, c))
-                    goto fail;
+                    return -1;
             }
             break;
         }
     }
-    if (string_buffer_putc8(b, '\"'))
+    return string_buffer_putc8(b, '\"');
+}
+
+static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
+{
+    JSValue val;
+    JSString *p;
+    StringBuffer b_s, *b = &b_s;
+
+    val = JS_ToStringCheckObject(ctx, val1);
+    if (JS_IsException(val))
+        return val;
+    p = JS_VALUE_GET_STRING(val);
+
+    if (string_buffer_init(ctx, b, p->len + 2))
+        goto fail;
+    if (string_buffer_put_quoted(b, p))
         goto fail;
     JS_FreeValue(ctx, val);
     return string_buffer_end(b);
@@ -12061,6 +13904,16 @@ static __maybe_unused void JS_DumpValueShort(JSRuntime *rt,
             JS_DumpString(rt, p);
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(val);
+            if (r->depth == 0) {
+                JS_DumpValueShort(rt, r->left);
+            } else {
+                printf("[rope len=%u depth=%u]", r->len, r->depth);
+            }
+        }
+        break;
     case JS_TAG_FUNCTION_BYTECODE:
         {
             JSFunctionBytecode *b = JS_VALUE_GET_PTR(val);
@@ -12273,6 +14126,7 @@ static bf_t *JS_ToBigIntFree(JSContext *ctx, bf_t *buf, JSValue val)
         break;
 #endif
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_StringToBigIntErr(ctx, val);
         if (JS_IsException(val))
             return NULL;
@@ -13675,10 +15529,10 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         /* try to call an overloaded operator */
         if ((tag1 == JS_TAG_OBJECT &&
              (tag2 != JS_TAG_NULL && tag2 != JS_TAG_UNDEFINED &&
-              tag2 != JS_TAG_STRING)) ||
+              !tag_is_string(tag2))) ||
             (tag2 == JS_TAG_OBJECT &&
              (tag1 != JS_TAG_NULL && tag1 != JS_TAG_UNDEFINED &&
-              tag1 != JS_TAG_STRING))) {
+              !tag_is_string(tag1)))) {
             JSValue res;
             int ret = js_call_binary_op_fallback(ctx, &res, op1, op2, OP_add,
                                                  FALSE, HINT_NONE);
@@ -13709,7 +15563,7 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         tag2 = JS_VALUE_GET_NORM_TAG(op2);
     }
 
-    if (tag1 == JS_TAG_STRING || tag2 == JS_TAG_STRING) {
+    if (tag_is_string(tag1) || tag_is_string(tag2)) {
         sp[-2] = JS_ConcatString(ctx, op1, op2);
         if (JS_IsException(sp[-2]))
             goto exception;
@@ -14003,6 +15857,13 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
         JS_FreeValue(ctx, op1);
         goto exception;
     }
+    op1 = js_flatten_string(ctx, op1);
+    op2 = js_flatten_string(ctx, op2);
+    if (JS_IsException(op1) || JS_IsException(op2)) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        goto exception;
+    }
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
 
@@ -14146,6 +16007,13 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
     op1 = sp[-2];
     op2 = sp[-1];
  redo:
+    op1 = js_flatten_string(ctx, op1);
+    op2 = js_flatten_string(ctx, op2);
+    if (JS_IsException(op1) || JS_IsException(op2)) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        goto exception;
+    }
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
     if (tag_is_number(tag1) && tag_is_number(tag2)) {
@@ -14422,14 +16290,18 @@ static BOOL js_strict_eq2(JSContext *ctx, JSValue op1, JSValue op2,
         res = (tag1 == tag2);
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             JSString *p1, *p2;
-            if (tag1 != tag2) {
+            if (!tag_is_string(tag2) ||
+                js_string_value_len(op1) != js_string_value_len(op2)) {
                 res = FALSE;
-            } else {
+            } else if (tag1 == JS_TAG_STRING && tag2 == JS_TAG_STRING) {
                 p1 = JS_VALUE_GET_STRING(op1);
                 p2 = JS_VALUE_GET_STRING(op2);
                 res = (js_string_compare(ctx, p1, p2) == 0);
+            } else {
+                res = js_string_value_eq(op1, op2);
             }
         }
         break;
@@ -14728,6 +16600,7 @@ static __exception int js_operator_typeof(JSContext *ctx, JSValueConst op1)
         atom = JS_ATOM_boolean;
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         atom = JS_ATOM_string;
         break;
     case JS_TAG_OBJECT:
@@ -15206,6 +17079,21 @@ static JSValue JS_GetIterator2(JSContext *ctx, JSValueConst obj,
     return enum_obj;
 }
 
+/* 'method' is the Symbol.iterator method of 'obj'. It is freed. */
+static JSValue JS_GetIteratorFree(JSContext *ctx, JSValueConst obj,
+                                  JSValue method)
+{
+    JSValue ret;
+
+    if (!JS_IsFunction(ctx, method)) {
+        JS_FreeValue(ctx, method);
+        return JS_ThrowTypeError(ctx, "value is not iterable");
+    }
+    ret = JS_GetIterator2(ctx, obj, method);
+    JS_FreeValue(ctx, method);
+    return ret;
+}
+
 static JSValue JS_GetIterator(JSContext *ctx, JSValueConst obj, BOOL is_async)
 {
     JSValue method, ret, sync_iter;
@@ -15231,13 +17119,7 @@ static JSValue JS_GetIterator(JSContext *ctx, JSValueConst obj, BOOL is_async)
         if (JS_IsException(method))
             return method;
     }
-    if (!JS_IsFunction(ctx, method)) {
-        JS_FreeValue(ctx, method);
-        return JS_ThrowTypeError(ctx, "value is not iterable");
-    }
-    ret = JS_GetIterator2(ctx, obj, method);
-    JS_FreeValue(ctx, method);
-    return ret;
+    return JS_GetIteratorFree(ctx, obj, method);
 }
 
 /* return *pdone = 2 if the iterator object is not parsed */
@@ -15352,13 +17234,55 @@ static int JS_IteratorClose(JSContext *ctx, JSValueConst enum_obj,
     return res;
 }
 
-/* obj -> enum_rec (3 slots) */
+static BOOL js_is_fast_array(JSContext *ctx, JSValueConst obj);
+static JSValue js_create_array_iterator(JSContext *ctx, JSValueConst this_val,
+                                        int argc, JSValueConst *argv, int magic);
+static int js_for_of_create_iterator(JSContext *ctx, JSValue *penum);
+
+/* Return TRUE if iterating an array with 'method' as Symbol.iterator
+   method is not observable: the array iterator can then be replaced
+   by an index. */
+static BOOL js_is_default_array_iterator(JSContext *ctx, JSValueConst method)
+{
+    JSObject *p;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    if (!JS_IsCFunction(ctx, method, (JSCFunction *)js_create_array_iterator,
+                        JS_ITERATOR_KIND_VALUE))
+        return FALSE;
+    /* the 'next' method is read in the iterator prototype */
+    p = JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_ARRAY_ITERATOR]);
+    prs = find_own_property(&pr, p, JS_ATOM_next);
+    return prs && (prs->flags & JS_PROP_TMASK) == JS_PROP_NORMAL &&
+        JS_VALUE_GET_TAG(pr->u.value) == JS_TAG_OBJECT &&
+        JS_VALUE_GET_PTR(pr->u.value) == JS_VALUE_GET_PTR(ctx->array_iterator_next);
+}
+
+/* obj -> enum_rec (3 slots). If 'use_index' is TRUE and 'obj' is a
+   fast array iterated with the default iterator, no iterator is
+   created: the enumeration record holds the array and the index of the
+   next element in place of the iterator and its 'next' method. It is
+   FALSE in generators, where yield* and the return of async generators
+   use the iterator directly. */
 static __exception int js_for_of_start(JSContext *ctx, JSValue *sp,
-                                       BOOL is_async)
+                                       BOOL is_async, BOOL use_index)
 {
     JSValue op1, obj, method;
     op1 = sp[-1];
-    obj = JS_GetIterator(ctx, op1, is_async);
+    if (use_index && js_is_fast_array(ctx, op1)) {
+        method = JS_GetProperty(ctx, op1, JS_ATOM_Symbol_iterator);
+        if (JS_IsException(method))
+            return -1;
+        if (js_is_default_array_iterator(ctx, method)) {
+            JS_FreeValue(ctx, method);
+            sp[0] = JS_NewInt32(ctx, 0);
+            return 0;
+        }
+        obj = JS_GetIteratorFree(ctx, op1, method);
+    } else {
+        obj = JS_GetIterator(ctx, op1, is_async);
+    }
     if (JS_IsException(obj))
         return -1;
     JS_FreeValue(ctx, op1);
@@ -15366,10 +17290,43 @@ static __exception int js_for_of_start(JSContext *ctx, JSValue *sp,
     method = JS_GetProperty(ctx, obj, JS_ATOM_next);
     if (JS_IsException(method))
         return -1;
+    /* an integer 'next' would be taken for an index. Calling null
+       throws the same TypeError as calling any other non object. */
+    if (JS_VALUE_GET_TAG(method) != JS_TAG_OBJECT) {
+        JS_FreeValue(ctx, method);
+        method = JS_NULL;
+    }
     sp[0] = method;
     return 0;
 }
 
+/* Equivalent of the array iterator 'next' method for an enumeration
+   record holding an array and an index. */
+static JSValue js_for_of_array_next(JSContext *ctx, JSValue *penum,
+                                    int *pdone)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(penum[0]);
+    uint32_t idx, len;
+
+    idx = JS_VALUE_GET_INT(penum[1]);
+    if (likely(p->fast_array && idx < p->u.array.count)) {
+        penum[1] = JS_NewInt32(ctx, idx + 1);
+        *pdone = FALSE;
+        return JS_DupValue(ctx, p->u.array.u.values[idx]);
+    }
+    if (js_get_length32(ctx, &len, penum[0])) {
+        *pdone = FALSE;
+        return JS_EXCEPTION;
+    }
+    if (idx >= len) {
+        *pdone = TRUE;
+        return JS_UNDEFINED;
+    }
+    penum[1] = JS_NewInt32(ctx, idx + 1);
+    *pdone = FALSE;
+    return JS_GetPropertyUint32(ctx, penum[0], idx);
+}
+
 /* enum_rec [objs] -> enum_rec [objs] value done. There are 'offset'
    objs. If 'done' is true or in case of exception, 'enum_rec' is set
    to undefined. If 'done' is true, 'value' is always set to
@@ -15380,7 +17337,10 @@ static __exception int js_for_of_next(JSContext *ctx, JSValue *sp, int offset)
     int done = 1;
 
     if (likely(!JS_IsUndefined(sp[offset]))) {
-        value = JS_IteratorNext(ctx, sp[offset], sp[offset + 1], 0, NULL, &done);
+        if (JS_VALUE_GET_TAG(sp[offset + 1]) == JS_TAG_INT)
+            value = js_for_of_array_next(ctx, sp + offset, &done);
+        else
+            value = JS_IteratorNext(ctx, sp[offset], sp[offset + 1], 0, NULL, &done);
         if (JS_IsException(value))
             done = -1;
         if (done) {
@@ -15401,6 +17361,37 @@ static __exception int js_for_of_next(JSContext *ctx, JSValue *sp, int offset)
     return 0;
 }
 
+/* Return TRUE if the array iterators may have a 'return' method. The
+   prototypes are inspected without side effects. */
+static BOOL js_array_iterator_has_return(JSContext *ctx)
+{
+    JSObject *p;
+    JSProperty *pr;
+
+    p = JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_ARRAY_ITERATOR]);
+    while (p != NULL) {
+        if (p->is_exotic || find_own_property(&pr, p, JS_ATOM_return))
+            return TRUE;
+        p = p->shape->proto;
+    }
+    return FALSE;
+}
+
+/* Close the iterator of the enumeration record 'penum'. The record is
+   not freed. Return < 0 in case of exception. */
+static int js_for_of_close(JSContext *ctx, JSValue *penum,
+                           BOOL is_exception_pending)
+{
+    if (JS_VALUE_GET_TAG(penum[1]) == JS_TAG_INT && !JS_IsUndefined(penum[0])) {
+        /* the iterator is only needed to call its 'return' method */
+        if (!js_array_iterator_has_return(ctx))
+            return 0;
+        if (js_for_of_create_iterator(ctx, penum))
+            return -1;
+    }
+    return JS_IteratorClose(ctx, penum[0], is_exception_pending);
+}
+
 static JSValue JS_IteratorGetCompleteValue(JSContext *ctx, JSValueConst obj,
                                            BOOL *pdone)
 {
@@ -15465,9 +17456,6 @@ static JSValue js_array_iterator_next(JSContext *ctx, JSValueConst this_val,
                                       int argc, JSValueConst *argv,
                                       BOOL *pdone, int magic);
 
-static JSValue js_create_array_iterator(JSContext *ctx, JSValueConst this_val,
-                                        int argc, JSValueConst *argv, int magic);
-
 static BOOL js_is_fast_array(JSContext *ctx, JSValueConst obj)
 {
     /* Try and handle fast arrays explicitly */
@@ -15496,10 +17484,28 @@ static BOOL js_get_fast_array(JSContext *ctx, JSValueConst obj,
     return FALSE;
 }
 
+/* Return TRUE if 'obj' is a fast array without holes which can be
+   used as an argument list. Its length is then read without property
+   lookup. */
+static BOOL js_get_dense_array_args(JSValueConst obj, uint32_t *plen)
+{
+    JSObject *p;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(obj);
+    if (p->class_id != JS_CLASS_ARRAY || !p->fast_array ||
+        JS_VALUE_GET_TAG(p->prop[0].u.value) != JS_TAG_INT ||
+        JS_VALUE_GET_INT(p->prop[0].u.value) != p->u.array.count ||
+        p->u.array.count > JS_MAX_LOCAL_VARS)
+        return FALSE;
+    *plen = p->u.array.count;
+    return TRUE;
+}
+
 static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
 {
-    JSValue iterator, enumobj, method, value;
-    int is_array_iterator;
+    JSValue enumobj, method, value;
     JSValue *arrp;
     uint32_t i, count32, pos;
 
@@ -15510,21 +17516,29 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
 
     pos = JS_VALUE_GET_INT(sp[-2]);
 
-    /* XXX: further optimisations:
-       - use ctx->array_proto_values?
-       - check if array_iterator_prototype next method is built-in and
-         avoid constructing actual iterator object?
-       - build this into js_for_of_start and use in all `for (x of o)` loops
-     */
-    iterator = JS_GetProperty(ctx, sp[-1], JS_ATOM_Symbol_iterator);
-    if (JS_IsException(iterator))
+    method = JS_GetProperty(ctx, sp[-1], JS_ATOM_Symbol_iterator);
+    if (JS_IsException(method))
         return -1;
-    is_array_iterator = JS_IsCFunction(ctx, iterator,
-                                       (JSCFunction *)js_create_array_iterator,
-                                       JS_ITERATOR_KIND_VALUE);
-    JS_FreeValue(ctx, iterator);
-
-    enumobj = JS_GetIterator(ctx, sp[-1], FALSE);
+    if (js_is_default_array_iterator(ctx, method)
+    &&  js_get_fast_array(ctx, sp[-1], &arrp, &count32)) {
+        uint32_t len;
+        if (js_get_length32(ctx, &len, sp[-1]))
+            goto exception1;
+        /* if len > count32, the elements >= count32 might be read in
+           the prototypes and might have side effects */
+        if (len == count32) {
+            /* Handle fast arrays explicitly: the iterator is not
+               observable so it is not created */
+            JS_FreeValue(ctx, method);
+            for (i = 0; i < count32; i++) {
+                if (JS_DefinePropertyValueUint32(ctx, sp[-3], pos++,
+                                                 JS_DupValue(ctx, arrp[i]), JS_PROP_C_W_E) < 0)
+                    return -1;
+            }
+            goto done;
+        }
+    }
+    enumobj = JS_GetIteratorFree(ctx, sp[-1], method);
     if (JS_IsException(enumobj))
         return -1;
     method = JS_GetProperty(ctx, enumobj, JS_ATOM_next);
@@ -15532,46 +17546,29 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
         JS_FreeValue(ctx, enumobj);
         return -1;
     }
-    if (is_array_iterator
-    &&  JS_IsCFunction(ctx, method, (JSCFunction *)js_array_iterator_next, 0)
-    &&  js_get_fast_array(ctx, sp[-1], &arrp, &count32)) {
-        uint32_t len;
-        if (js_get_length32(ctx, &len, sp[-1]))
+    for (;;) {
+        BOOL done;
+        value = JS_IteratorNext(ctx, enumobj, method, 0, NULL, &done);
+        if (JS_IsException(value))
             goto exception;
-        /* if len > count32, the elements >= count32 might be read in
-           the prototypes and might have side effects */
-        if (len != count32)
-            goto general_case;
-        /* Handle fast arrays explicitly */
-        for (i = 0; i < count32; i++) {
-            if (JS_DefinePropertyValueUint32(ctx, sp[-3], pos++,
-                                             JS_DupValue(ctx, arrp[i]), JS_PROP_C_W_E) < 0)
-                goto exception;
-        }
-    } else {
-    general_case:
-        for (;;) {
-            BOOL done;
-            value = JS_IteratorNext(ctx, enumobj, method, 0, NULL, &done);
-            if (JS_IsException(value))
-                goto exception;
-            if (done) {
-                /* value is JS_UNDEFINED */
-                break;
-            }
-            if (JS_DefinePropertyValueUint32(ctx, sp[-3], pos++, value, JS_PROP_C_W_E) < 0)
-                goto exception;
+        if (done) {
+            /* value is JS_UNDEFINED */
+            break;
         }
+        if (JS_DefinePropertyValueUint32(ctx, sp[-3], pos++, value, JS_PROP_C_W_E) < 0)
+            goto exception;
     }
-    /* Note: could raise an error if too many elements */
-    sp[-2] = JS_NewInt32(ctx, pos);
     JS_FreeValue(ctx, enumobj);
     JS_FreeValue(ctx, method);
+ done:
+    /* Note: could raise an error if too many elements */
+    sp[-2] = JS_NewInt32(ctx, pos);
     return 0;
 
 exception:
     JS_IteratorClose(ctx, enumobj, TRUE);
     JS_FreeValue(ctx, enumobj);
+ exception1:
     JS_FreeValue(ctx, method);
     return -1;
 }
@@ -16138,6 +18135,184 @@ static JSValue js_call_bound_function(JSContext *ctx, JSValueConst func_obj,
     }
 }
 
+/* return FALSE if the property lookup of 'atom' may depend on the
+   exotic behavior of the fast arrays and typed arrays */
+static BOOL js_atom_is_ic_cacheable(JSRuntime *rt, JSAtom atom)
+{
+    JSAtomStruct *p;
+    int c;
+
+    if (__JS_AtomIsTaggedInt(atom))
+        return FALSE;
+    p = rt->atom_array[atom];
+    if (p->atom_type != JS_ATOM_TYPE_STRING || p->len == 0)
+        return TRUE;
+    /* conservative test for the canonical numeric strings */
+    c = string_get(p, 0);
+    return !(is_num(c) || c == '-' || c == 'I' || c == 'N');
+}
+
+/* return the property of 'p' cached in 'ic' or NULL */
+static inline JSProperty *find_ic_property(JSInlineCache *ic, JSObject *p,
+                                           JSInlineCacheEntry **pe)
+{
+    JSInlineCacheEntry *e;
+    JSObject *holder;
+    int i, j;
+
+    if (unlikely(p->is_exotic && !p->fast_array))
+        return NULL;
+    for(i = 0; i < JS_IC_ENTRY_COUNT; i++) {
+        e = &ic->entries[i];
+        if (e->shape == p->shape) {
+            holder = p;
+            for(j = 0; j < e->depth; j++) {
+                holder = holder->shape->proto;
+                if (holder->shape != e->proto_shape[j])
+                    return NULL;
+            }
+            *pe = e;
+            return &holder->prop[e->prop_index];
+        }
+    }
+    return NULL;
+}
+
+/* cache the lookup of 'atom' in 'p'. Only the own writable data
+   properties are cached for the assignments. */
+static void update_ic(JSContext *ctx, JSFunctionBytecode *b, int ic_idx,
+                      JSObject *p, JSAtom atom, BOOL is_put)
+{
+    JSRuntime *rt = ctx->rt;
+    JSShape *proto_shape[JS_IC_MAX_DEPTH];
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSObject *holder;
+    JSInlineCache *ic;
+    JSInlineCacheEntry *e;
+    int depth, i, is_getter;
+
+    if (ic_idx == JS_IC_NONE ||
+        (p->is_exotic && !p->fast_array) ||
+        !p->shape->is_hashed ||
+        !js_atom_is_ic_cacheable(rt, atom))
+        return;
+    if (b->ic && b->ic[ic_idx].evict_count >= JS_IC_MAX_EVICT)
+        return; /* megamorphic access */
+
+    holder = p;
+    depth = 0;
+    for(;;) {
+        prs = find_own_property(&pr, holder, atom);
+        if (prs)
+            break;
+        if (is_put || depth == JS_IC_MAX_DEPTH)
+            return;
+        holder = holder->shape->proto;
+        if (!holder || !holder->shape->is_hashed ||
+            (holder->is_exotic && !holder->fast_array))
+            return;
+        proto_shape[depth++] = holder->shape;
+    }
+    switch(prs->flags & JS_PROP_TMASK) {
+    case JS_PROP_NORMAL:
+        if (is_put &&
+            (prs->flags & (JS_PROP_WRITABLE | JS_PROP_LENGTH)) != JS_PROP_WRITABLE)
+            return;
+        is_getter = FALSE;
+        break;
+    case JS_PROP_GETSET:
+        if (is_put)
+            return;
+        is_getter = TRUE;
+        break;
+    default:
+        return;
+    }
+
+    if (!b->ic) {
+        b->ic = js_mallocz_rt(rt, sizeof(b->ic[0]) * b->ic_count);
+        if (!b->ic)
+            return;
+    }
+    ic = &b->ic[ic_idx];
+    for(i = 0; i < JS_IC_ENTRY_COUNT; i++) {
+        if (!ic->entries[i].shape)
+            break;
+    }
+    if (i < JS_IC_ENTRY_COUNT) {
+        e = &ic->entries[i];
+    } else {
+        e = &ic->entries[ic->next_evict];
+        ic->next_evict = (ic->next_evict + 1) % JS_IC_ENTRY_COUNT;
+        ic->evict_count++;
+        free_ic_entry(rt, e);
+    }
+    e->shape = js_dup_shape(p->shape);
+    for(i = 0; i < depth; i++)
+        e->proto_shape[i] = js_dup_shape(proto_shape[i]);
+    e->depth = depth;
+    e->prop_index = pr - holder->prop;
+    e->is_getter = is_getter;
+}
+
+static no_inline JSValue get_field_ic_miss(JSContext *ctx,
+                                           JSFunctionBytecode *b, int ic_idx,
+                                           JSValueConst obj, JSAtom atom)
+{
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)
+        update_ic(ctx, b, ic_idx, JS_VALUE_GET_OBJ(obj), atom, FALSE);
+    return JS_GetProperty(ctx, obj, atom);
+}
+
+static inline JSValue get_field_ic(JSContext *ctx, JSFunctionBytecode *b,
+                                   int ic_idx, JSValueConst obj, JSAtom atom)
+{
+    JSInlineCacheEntry *e;
+    JSProperty *pr;
+
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT && b->ic)) {
+        pr = find_ic_property(&b->ic[ic_idx], JS_VALUE_GET_OBJ(obj), &e);
+        if (likely(pr)) {
+            if (likely(!e->is_getter))
+                return JS_DupValue(ctx, pr->u.value);
+            if (!pr->u.getset.getter)
+                return JS_UNDEFINED;
+            return JS_CallFree(ctx, JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, pr->u.getset.getter)),
+                               obj, 0, NULL);
+        }
+    }
+    return get_field_ic_miss(ctx, b, ic_idx, obj, atom);
+}
+
+static no_inline int put_field_ic_miss(JSContext *ctx, JSFunctionBytecode *b,
+                                       int ic_idx, JSValueConst obj,
+                                       JSAtom atom, JSValue val)
+{
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)
+        update_ic(ctx, b, ic_idx, JS_VALUE_GET_OBJ(obj), atom, TRUE);
+    return JS_SetPropertyInternal(ctx, obj, atom, val, obj,
+                                  JS_PROP_THROW_STRICT);
+}
+
+/* 'val' is freed */
+static inline int put_field_ic(JSContext *ctx, JSFunctionBytecode *b,
+                               int ic_idx, JSValueConst obj, JSAtom atom,
+                               JSValue val)
+{
+    JSInlineCacheEntry *e;
+    JSProperty *pr;
+
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT && b->ic)) {
+        pr = find_ic_property(&b->ic[ic_idx], JS_VALUE_GET_OBJ(obj), &e);
+        if (likely(pr)) {
+            set_value(ctx, &pr->u.value, val);
+            return TRUE;
+        }
+    }
+    return put_field_ic_miss(ctx, b, ic_idx, obj, atom, val);
+}
+
 /* argument of OP_special_object */
 typedef enum {
     OP_SPECIAL_OBJECT_ARGUMENTS,
@@ -16154,6 +18329,69 @@ typedef enum {
 #define FUNC_RET_YIELD_STAR    2
 #define FUNC_RET_INITIAL_YIELD 3
 
+/* Read 'prop' in an arguments object or a rest parameter which was
+   not created because the function only reads its elements and its
+   length (see is_lazy_arguments()). 'prop' is not an element so the
+   object is created for this access. 'type' is the special object type
+   or OP_rest. 'prop' is freed. */
+static JSValue js_get_lazy_arguments_prop(JSContext *ctx, JSStackFrame *sf,
+                                          int type, int first, int argc,
+                                          JSValueConst *argv, int arg_count,
+                                          JSValue prop)
+{
+    JSValue obj, val;
+
+    if (type == OP_SPECIAL_OBJECT_ARGUMENTS)
+        obj = js_build_arguments(ctx, argc, argv);
+    else if (type == OP_SPECIAL_OBJECT_MAPPED_ARGUMENTS)
+        obj = js_build_mapped_arguments(ctx, argc, argv, sf, arg_count);
+    else
+        obj = js_build_rest(ctx, first, argc, argv);
+    if (JS_IsException(obj)) {
+        JS_FreeValue(ctx, prop);
+        return obj;
+    }
+    val = JS_GetPropertyValue(ctx, obj, prop);
+    JS_FreeValue(ctx, obj);
+    return val;
+}
+
+/* Return TRUE if 'obj[prop]' is an existing element of a fast array */
+static inline BOOL js_is_fast_array_el(JSValueConst obj, JSValueConst prop)
+{
+    JSObject *p;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT ||
+        JS_VALUE_GET_TAG(prop) != JS_TAG_INT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(obj);
+    return p->class_id == JS_CLASS_ARRAY &&
+        (uint32_t)JS_VALUE_GET_INT(prop) < p->u.array.count;
+}
+
+/* Replace the opcode being executed by its quickened version
+   'op'. The bytecode stored in read-only memory is not modified. */
+#define QUICKEN(op) do {                        \
+        if (!b->read_only_bytecode)             \
+            ((uint8_t *)pc)[-1] = (op);         \
+    } while (0)
+
+/* Restore the generic opcode 'op' and execute it */
+#define UNQUICKEN(op) do {                      \
+        ((uint8_t *)pc)[-1] = (op);             \
+        pc--;                                   \
+    } while (0)
+
+#ifdef DUMP_OPCODE_PAIRS
+static inline int js_count_opcode_pair(int *plast_opcode, int opcode)
+{
+    if (*plast_opcode >= 0)
+        js_opcode_pair_count[*plast_opcode][opcode]++;
+    *plast_opcode = opcode;
+    return opcode;
+}
+#endif
+
 /* argv[] is modified if (flags & JS_CALL_FLAG_COPY_ARGV) = 0. */
 static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                                JSValueConst this_obj, JSValueConst new_target,
@@ -16170,8 +18408,15 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     JSVarRef **var_refs;
     size_t alloca_size;
 
+#ifdef DUMP_OPCODE_PAIRS
+    int last_opcode = -1;
+#define COUNT_OPCODE_PAIR(op) js_count_opcode_pair(&last_opcode, op)
+#else
+#define COUNT_OPCODE_PAIR(op) (op)
+#endif
+
 #if !DIRECT_DISPATCH
-#define SWITCH(pc)      switch (opcode = *pc++)
+#define SWITCH(pc)      switch (opcode = COUNT_OPCODE_PAIR(*pc++))
 #define CASE(op)        case op
 #define DEFAULT         default
 #define BREAK           break
@@ -16186,7 +18431,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 #include "quickjs-opcode.h"
         [ OP_COUNT ... 255 ] = &&case_default
     };
-#define SWITCH(pc)      goto *dispatch_table[opcode = *pc++];
+#define SWITCH(pc)      goto *dispatch_table[opcode = COUNT_OPCODE_PAIR(*pc++)];
 #define CASE(op)        case_ ## op
 #define DEFAULT         case_default
 #define BREAK           SWITCH(pc)
@@ -16430,6 +18675,53 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     goto exception;
             }
             BREAK;
+        CASE(OP_get_argc):
+            {
+                int first = get_u16(pc);
+                pc += 2;
+                *sp++ = JS_NewInt32(ctx, max_int(argc - first, 0));
+            }
+            BREAK;
+        CASE(OP_get_arguments_el):
+            {
+                int arg = *pc++;
+                uint32_t idx;
+
+                if (likely(JS_VALUE_GET_TAG(sp[-1]) == JS_TAG_INT &&
+                           (idx = JS_VALUE_GET_INT(sp[-1])) < argc)) {
+                    /* the mapped arguments alias the parameters */
+                    if (idx < b->arg_count)
+                        sp[-1] = JS_DupValue(ctx, arg_buf[idx]);
+                    else
+                        sp[-1] = JS_DupValue(ctx, argv[idx]);
+                } else {
+                    sp[-1] = js_get_lazy_arguments_prop(ctx, sf, arg, 0, argc,
+                                                        (JSValueConst *)argv,
+                                                        min_int(argc, b->arg_count),
+                                                        sp[-1]);
+                    if (unlikely(JS_IsException(sp[-1])))
+                        goto exception;
+                }
+            }
+            BREAK;
+        CASE(OP_get_rest_el):
+            {
+                int first = get_u16(pc);
+                uint32_t idx;
+                pc += 2;
+
+                if (likely(JS_VALUE_GET_TAG(sp[-1]) == JS_TAG_INT &&
+                           (idx = JS_VALUE_GET_INT(sp[-1])) < max_int(argc - first, 0))) {
+                    sp[-1] = JS_DupValue(ctx, argv[first + idx]);
+                } else {
+                    sp[-1] = js_get_lazy_arguments_prop(ctx, sf, OP_rest, first, argc,
+                                                        (JSValueConst *)argv, 0,
+                                                        sp[-1]);
+                    if (unlikely(JS_IsException(sp[-1])))
+                        goto exception;
+                }
+            }
+            BREAK;
 
         CASE(OP_drop):
             JS_FreeValue(ctx, sp[-1]);
@@ -16674,10 +18966,27 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_apply):
             {
                 int magic;
+                uint32_t len;
                 magic = get_u16(pc);
                 pc += 2;
 
-                ret_val = js_function_apply(ctx, sp[-3], 2, (JSValueConst *)&sp[-2], magic);
+                if (likely(JS_IsFunction(ctx, sp[-3]) &&
+                           js_get_dense_array_args(sp[-1], &len) &&
+                           JS_VALUE_GET_OBJ(sp[-1])->header.ref_count == 1)) {
+                    /* the argument array was built by the caller and
+                       is not reachable from the callee: its elements
+                       are directly used as the argument list */
+                    JSValue *tab = JS_VALUE_GET_OBJ(sp[-1])->u.array.u.values;
+                    if (magic & 1) {
+                        ret_val = JS_CallConstructorInternal(ctx, sp[-3], sp[-2],
+                                                             len, tab, 0);
+                    } else {
+                        ret_val = JS_CallInternal(ctx, sp[-3], sp[-2],
+                                                  JS_UNDEFINED, len, tab, 0);
+                    }
+                } else {
+                    ret_val = js_function_apply(ctx, sp[-3], 2, (JSValueConst *)&sp[-2], magic);
+                }
                 if (unlikely(JS_IsException(ret_val)))
                     goto exception;
                 JS_FreeValue(ctx, sp[-3]);
@@ -16878,10 +19187,13 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
                 JSAtom atom;
+                int cache_idx;
                 atom = get_u32(pc);
-                pc += 4;
+                cache_idx = get_u16(pc + 4);
+                pc += 6;
 
-                val = JS_GetGlobalVar(ctx, atom, opcode - OP_get_var_undef);
+                val = get_global_var_cache(ctx, b, cache_idx, atom,
+                                           opcode - OP_get_var_undef);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 *sp++ = val;
@@ -16889,6 +19201,21 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             BREAK;
 
         CASE(OP_put_var):
+            {
+                int ret;
+                JSAtom atom;
+                int cache_idx;
+                atom = get_u32(pc);
+                cache_idx = get_u16(pc + 4);
+                pc += 6;
+
+                ret = put_global_var_cache(ctx, b, cache_idx, atom, sp[-1], 0);
+                sp--;
+                if (unlikely(ret < 0))
+                    goto exception;
+            }
+            BREAK;
+
         CASE(OP_put_var_init):
             {
                 int ret;
@@ -16896,7 +19223,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 atom = get_u32(pc);
                 pc += 4;
 
-                ret = JS_SetGlobalVar(ctx, atom, sp[-1], opcode - OP_put_var);
+                ret = JS_SetGlobalVar(ctx, atom, sp[-1], 1);
                 sp--;
                 if (unlikely(ret < 0))
                     goto exception;
@@ -16907,15 +19234,17 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
+                int cache_idx;
                 atom = get_u32(pc);
-                pc += 4;
+                cache_idx = get_u16(pc + 4);
+                pc += 6;
 
                 /* sp[-2] is JS_TRUE or JS_FALSE */
                 if (unlikely(!JS_VALUE_GET_INT(sp[-2]))) {
                     JS_ThrowReferenceErrorNotDefined(ctx, atom);
                     goto exception;
                 }
-                ret = JS_SetGlobalVar(ctx, atom, sp[-1], 2);
+                ret = put_global_var_cache(ctx, b, cache_idx, atom, sp[-1], 2);
                 sp -= 2;
                 if (unlikely(ret < 0))
                     goto exception;
@@ -17383,7 +19712,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             sp += 2;
             BREAK;
         CASE(OP_for_of_start):
-            if (js_for_of_start(ctx, sp, FALSE))
+            if (js_for_of_start(ctx, sp, FALSE,
+                                !(b->func_kind & JS_FUNC_GENERATOR)))
                 goto exception;
             sp += 1;
             *sp++ = JS_NewCatchOffset(ctx, 0);
@@ -17398,7 +19728,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
         CASE(OP_for_await_of_start):
-            if (js_for_of_start(ctx, sp, TRUE))
+            if (js_for_of_start(ctx, sp, TRUE, FALSE))
                 goto exception;
             sp += 1;
             *sp++ = JS_NewCatchOffset(ctx, 0);
@@ -17418,14 +19748,13 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_iterator_close):
             /* iter_obj next catch_offset -> */
             sp--; /* drop the catch offset to avoid getting caught by exception */
-            JS_FreeValue(ctx, sp[-1]); /* drop the next method */
-            sp--;
-            if (!JS_IsUndefined(sp[-1])) {
-                if (JS_IteratorClose(ctx, sp[-1], FALSE))
+            if (!JS_IsUndefined(sp[-2])) {
+                if (js_for_of_close(ctx, sp - 2, FALSE))
                     goto exception;
-                JS_FreeValue(ctx, sp[-1]);
             }
-            sp--;
+            JS_FreeValue(ctx, sp[-1]); /* drop the next method */
+            JS_FreeValue(ctx, sp[-2]);
+            sp -= 2;
             BREAK;
         CASE(OP_nip_catch):
             {
@@ -17510,10 +19839,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
                 JSAtom atom;
+                int ic_idx;
                 atom = get_u32(pc);
-                pc += 4;
+                ic_idx = get_u16(pc + 4);
+                pc += 6;
 
-                val = JS_GetProperty(ctx, sp[-1], atom);
+                val = get_field_ic(ctx, b, ic_idx, sp[-1], atom);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 JS_FreeValue(ctx, sp[-1]);
@@ -17525,10 +19856,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
                 JSAtom atom;
+                int ic_idx;
                 atom = get_u32(pc);
-                pc += 4;
+                ic_idx = get_u16(pc + 4);
+                pc += 6;
 
-                val = JS_GetProperty(ctx, sp[-1], atom);
+                val = get_field_ic(ctx, b, ic_idx, sp[-1], atom);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 *sp++ = val;
@@ -17539,11 +19872,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
                 JSAtom atom;
+                int ic_idx;
                 atom = get_u32(pc);
-                pc += 4;
+                ic_idx = get_u16(pc + 4);
+                pc += 6;
 
-                ret = JS_SetPropertyInternal(ctx, sp[-2], atom, sp[-1], sp[-2],
-                                             JS_PROP_THROW_STRICT);
+                ret = put_field_ic(ctx, b, ic_idx, sp[-2], atom, sp[-1]);
                 JS_FreeValue(ctx, sp[-2]);
                 sp -= 2;
                 if (unlikely(ret < 0))
@@ -17732,6 +20066,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue val;
 
+                if (js_is_fast_array_el(sp[-2], sp[-1]))
+                    QUICKEN(OP_get_array_el_fast);
                 val = JS_GetPropertyValue(ctx, sp[-2], sp[-1]);
                 JS_FreeValue(ctx, sp[-2]);
                 sp[-2] = val;
@@ -17795,6 +20131,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int ret;
 
+                if (js_is_fast_array_el(sp[-3], sp[-2]))
+                    QUICKEN(OP_put_array_el_fast);
                 ret = JS_SetPropertyValue(ctx, sp[-3], sp[-2], sp[-1], JS_PROP_THROW_STRICT);
                 JS_FreeValue(ctx, sp[-3]);
                 sp -= 3;
@@ -17803,6 +20141,91 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
 
+        CASE(OP_get_array_el_fast):
+            {
+                JSValue val;
+
+                if (unlikely(!js_is_fast_array_el(sp[-2], sp[-1]))) {
+                    UNQUICKEN(OP_get_array_el);
+                    BREAK;
+                }
+                val = JS_DupValue(ctx, JS_VALUE_GET_OBJ(sp[-2])->u.array.u.values[JS_VALUE_GET_INT(sp[-1])]);
+                JS_FreeValue(ctx, sp[-2]);
+                sp[-2] = val;
+                sp--;
+            }
+            BREAK;
+
+        CASE(OP_put_array_el_fast):
+            {
+                if (unlikely(!js_is_fast_array_el(sp[-3], sp[-2]))) {
+                    UNQUICKEN(OP_put_array_el);
+                    BREAK;
+                }
+                set_value(ctx, &JS_VALUE_GET_OBJ(sp[-3])->u.array.u.values[JS_VALUE_GET_INT(sp[-2])], sp[-1]);
+                JS_FreeValue(ctx, sp[-3]);
+                sp -= 3;
+            }
+            BREAK;
+
+        CASE(OP_lt_if_false):
+            {
+                /* lt if_false(8) */
+                JSValue op1, op2;
+                int res;
+
+                op1 = sp[-2];
+                op2 = sp[-1];
+                if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {
+                    res = JS_VALUE_GET_INT(op1) < JS_VALUE_GET_INT(op2);
+                } else if (JS_VALUE_IS_BOTH_FLOAT(op1, op2)) {
+                    res = JS_VALUE_GET_FLOAT64(op1) < JS_VALUE_GET_FLOAT64(op2);
+                } else {
+                    /* execute lt, if_false follows */
+                    if (js_relational_slow(ctx, sp, OP_lt))
+                        goto exception;
+                    sp--;
+                    BREAK;
+                }
+                sp -= 2;
+                if (*pc == OP_if_false8) {
+                    pc += 2;
+                    if (!res)
+                        pc += (int8_t)pc[-1] - 1;
+                } else {
+                    pc += 5;
+                    if (!res)
+                        pc += (int32_t)get_u32(pc - 4) - 4;
+                }
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+            }
+            BREAK;
+
+        CASE(OP_inc_loc_check):
+            {
+                /* get_loc_check(n) post_inc put_loc_check(n) drop */
+                JSValue op1;
+                int idx;
+
+                idx = get_u16(pc);
+                pc += 2;
+                op1 = var_buf[idx];
+                if (likely(JS_VALUE_GET_TAG(op1) == JS_TAG_INT &&
+                           JS_VALUE_GET_INT(op1) != INT32_MAX)) {
+                    var_buf[idx] = JS_NewInt32(ctx, JS_VALUE_GET_INT(op1) + 1);
+                    pc += 5;
+                } else {
+                    /* execute get_loc_check, post_inc follows */
+                    if (unlikely(JS_IsUninitialized(op1))) {
+                        JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, FALSE);
+                        goto exception;
+                    }
+                    *sp++ = JS_DupValue(ctx, op1);
+                }
+            }
+            BREAK;
+
         CASE(OP_put_ref_value):
             {
                 int ret, flags;
@@ -17938,12 +20361,13 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     *pv = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(*pv) +
                                                JS_VALUE_GET_FLOAT64(op2));
                     sp--;
-                } else if (JS_VALUE_GET_TAG(*pv) == JS_TAG_STRING) {
+                } else if (tag_is_string(JS_VALUE_GET_TAG(*pv))) {
                     sp--;
                     op2 = JS_ToPrimitiveFree(ctx, op2, HINT_NONE);
                     if (JS_IsException(op2))
                         goto exception;
-                    if (JS_ConcatStringInPlace(ctx, JS_VALUE_GET_STRING(*pv), op2)) {
+                    if (JS_VALUE_GET_TAG(*pv) == JS_TAG_STRING &&
+                        JS_ConcatStringInPlace(ctx, JS_VALUE_GET_STRING(*pv), op2)) {
                         JS_FreeValue(ctx, op2);
                     } else {
                         op2 = JS_ConcatString(ctx, JS_DupValue(ctx, *pv), op2);
@@ -18374,6 +20798,9 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {           \
                     sp[-2] = JS_NewBool(ctx, JS_VALUE_GET_INT(op1) binary_op JS_VALUE_GET_INT(op2)); \
                     sp--;                                               \
+                } else if (JS_VALUE_IS_BOTH_FLOAT(op1, op2)) {          \
+                    sp[-2] = JS_NewBool(ctx, JS_VALUE_GET_FLOAT64(op1) binary_op JS_VALUE_GET_FLOAT64(op2)); \
+                    sp--;                                               \
                 } else {                                                \
                     if (slow_call)                                      \
                         goto exception;                                 \
@@ -18669,9 +21096,9 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 int pos = JS_VALUE_GET_INT(val);
                 if (pos == 0) {
                     /* enumerator: close it with a throw */
+                    js_for_of_close(ctx, sp - 2, TRUE);
                     JS_FreeValue(ctx, sp[-1]); /* drop the next method */
                     sp--;
-                    JS_IteratorClose(ctx, sp[-1], TRUE);
                 } else {
                     *sp++ = rt->current_exception;
                     rt->current_exception = JS_UNINITIALIZED;
@@ -19003,6 +21430,9 @@ static void async_func_free(JSRuntime *rt, JSAsyncFunctionState *s)
             if (rt->gc_phase == JS_GC_PHASE_NONE) {
                 free_zero_refcount(rt);
             }
+        } else if (s->header.mark == JS_GC_MARK_NONE) {
+            list_del(&s->header.link);
+            list_add_tail(&s->header.link, &rt->gc_inc_zero_ref_count_list);
         }
     }
 }
@@ -20110,7 +22540,7 @@ typedef struct JSParseState {
 } JSParseState;
 
 typedef struct JSOpCode {
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(DUMP_OPCODE_PAIRS)
     const char *name;
 #endif
     uint8_t size; /* in bytes */
@@ -20123,7 +22553,7 @@ typedef struct JSOpCode {
 
 static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #define FMT(f)
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(DUMP_OPCODE_PAIRS)
 #define DEF(id, size, n_pop, n_push, f) { #id, size, n_pop, n_push, OP_FMT_ ## f },
 #else
 #define DEF(id, size, n_pop, n_push, f) { size, n_pop, n_push, OP_FMT_ ## f },
@@ -20145,6 +22575,44 @@ static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #define short_opcode_info(op) opcode_info[op]
 #endif
 
+#ifdef DUMP_OPCODE_PAIRS
+static void js_dump_opcode_pairs(void)
+{
+    uint64_t total, count, best;
+    int n, op1, op2, best_op1, best_op2;
+
+    total = 0;
+    for(op1 = 0; op1 < 256; op1++) {
+        for(op2 = 0; op2 < 256; op2++)
+            total += js_opcode_pair_count[op1][op2];
+    }
+    if (total == 0)
+        return;
+    printf("%-20s %-20s %12s %6s\n", "OPCODE1", "OPCODE2", "COUNT", "%");
+    for(n = 0; n < 50; n++) {
+        best = 0;
+        best_op1 = best_op2 = 0;
+        for(op1 = 0; op1 < 256; op1++) {
+            for(op2 = 0; op2 < 256; op2++) {
+                count = js_opcode_pair_count[op1][op2];
+                if (count > best) {
+                    best = count;
+                    best_op1 = op1;
+                    best_op2 = op2;
+                }
+            }
+        }
+        if (best == 0)
+            break;
+        printf("%-20s %-20s %12" PRIu64 " %6.2f\n",
+               short_opcode_info(best_op1).name,
+               short_opcode_info(best_op2).name,
+               best, (double)best * 100 / total);
+        js_opcode_pair_count[best_op1][best_op2] = 0;
+    }
+}
+#endif
+
 static __exception int next_token(JSParseState *s);
 
 static void free_token(JSParseState *s, JSToken *token)
@@ -21649,6 +24117,13 @@ static void emit_atom(JSParseState *s, JSAtom name)
     emit_u32(s, JS_DupAtom(s->ctx, name));
 }
 
+/* inline cache index of OP_get_field, OP_get_field2 and OP_put_field.
+   The final value is set by js_create_function(). */
+static void emit_ic(JSParseState *s)
+{
+    emit_u16(s, 0);
+}
+
 static int update_label(JSFunctionDef *s, int label, int delta)
 {
     LabelSlot *ls;
@@ -22321,6 +24796,7 @@ static __exception int js_parse_template(JSParseState *s, int call, int *argc)
                         goto done1;
                     emit_op(s, OP_get_field2);
                     emit_atom(s, JS_ATOM_concat);
+                    emit_ic(s);
                 }
                 depth++;
             } else {
@@ -23572,6 +26048,7 @@ static __exception int js_parse_array_literal(JSParseState *s)
             emit_u32(s, idx);
             emit_op(s, OP_put_field);
             emit_atom(s, JS_ATOM_length);
+            emit_ic(s);
         }
         goto done;
     }
@@ -23636,6 +26113,7 @@ static __exception int js_parse_array_literal(JSParseState *s)
         emit_op(s, OP_dup1);    /* array length - array array length */
         emit_op(s, OP_put_field);
         emit_atom(s, JS_ATOM_length);
+        emit_ic(s);
     } else {
         emit_op(s, OP_drop);    /* array length - array */
     }
@@ -23736,6 +26214,7 @@ static __exception int get_lvalue(JSParseState *s, int *popcode, int *pscope,
         case OP_get_field:
             emit_op(s, OP_get_field2);
             emit_atom(s, name);
+            emit_ic(s);
             break;
         case OP_scope_get_private_field:
             emit_op(s, OP_scope_get_private_field2);
@@ -23883,6 +26362,7 @@ static void put_lvalue(JSParseState *s, int opcode, int scope,
     case OP_get_field:
         emit_op(s, OP_put_field);
         emit_u32(s, name);  /* name has refcount */
+        emit_ic(s);
         break;
     case OP_scope_get_private_field:
         emit_op(s, OP_scope_put_private_field);
@@ -23894,6 +26374,9 @@ static void put_lvalue(JSParseState *s, int opcode, int scope,
         break;
     case OP_get_ref_value:
         emit_op(s, OP_put_ref_value);
+        /* room for the replacement by optimize_scope_make_global_ref() */
+        emit_u8(s, OP_nop);
+        emit_u8(s, OP_nop);
         break;
     case OP_get_super_value:
         emit_op(s, OP_put_super_value);
@@ -24144,6 +26627,7 @@ static int js_parse_destructuring_element(JSParseState *s, int tok, int is_arg,
                         /* get the named property from the source object */
                         emit_op(s, OP_get_field2);
                         emit_u32(s, prop_name);
+                        emit_ic(s);
                     }
                     if (js_parse_destructuring_element(s, tok, is_arg, TRUE, -1, TRUE) < 0)
                         return -1;
@@ -24233,6 +26717,7 @@ static int js_parse_destructuring_element(JSParseState *s, int tok, int is_arg,
                     /* source -- val */
                     emit_op(s, OP_get_field);
                     emit_u32(s, prop_name);
+                    emit_ic(s);
                 }
             } else {
                 /* prop_type = PROP_TYPE_VAR, cannot be a computed property */
@@ -24264,6 +26749,7 @@ static int js_parse_destructuring_element(JSParseState *s, int tok, int is_arg,
                 /* source -- source val */
                 emit_op(s, OP_get_field2);
                 emit_u32(s, prop_name);
+                emit_ic(s);
             }
         set_val:
             if (tok) {
@@ -24792,10 +27278,10 @@ static __exception int js_parse_postfix_expr(JSParseState *s, int parse_flags)
                     {
                         int opt_chain_label, next_label;
                         opt_chain_label = get_u32(fd->byte_code.buf +
-                                                  fd->last_opcode_pos + 1 + 4 + 1);
+                                                  fd->last_opcode_pos + 1 + 4 + 2 + 1);
                         /* keep the object on the stack */
                         fd->byte_code.buf[fd->last_opcode_pos] = OP_get_field2;
-                        fd->byte_code.size = fd->last_opcode_pos + 1 + 4;
+                        fd->byte_code.size = fd->last_opcode_pos + 1 + 4 + 2;
                         next_label = emit_goto(s, OP_goto, -1);
                         emit_label(s, opt_chain_label);
                         /* need an additional undefined value for the
@@ -25091,6 +27577,7 @@ static __exception int js_parse_postfix_expr(JSParseState *s, int parse_flags)
                     }
                     emit_op(s, OP_get_field);
                     emit_atom(s, s->token.u.ident.atom);
+                    emit_ic(s);
                 }
             }
             if (next_token(s))
@@ -25156,7 +27643,7 @@ static __exception int js_parse_delete(JSParseState *s)
             int ret, opt_chain_label, next_label;
             if (opcode == OP_get_field_opt_chain) {
                 opt_chain_label = get_u32(fd->byte_code.buf +
-                                          fd->last_opcode_pos + 1 + 4 + 1);
+                                          fd->last_opcode_pos + 1 + 4 + 2 + 1);
             } else {
                 opt_chain_label = -1;
             }
@@ -25705,12 +28192,14 @@ static __exception int js_parse_assign_expr2(JSParseState *s, int parse_flags)
             emit_op(s, OP_iterator_check_object);
             emit_op(s, OP_get_field2);
             emit_atom(s, JS_ATOM_done);
+            emit_ic(s);
             label_next = emit_goto(s, OP_if_true, -1); /* end of loop */
             emit_label(s, label_yield);
             if (is_async) {
                 /* OP_async_yield_star takes the value as parameter */
                 emit_op(s, OP_get_field);
                 emit_atom(s, JS_ATOM_value);
+                emit_ic(s);
                 emit_op(s, OP_async_yield_star);
             } else {
                 /* OP_yield_star takes (value, done) as parameter */
@@ -25738,10 +28227,12 @@ static __exception int js_parse_assign_expr2(JSParseState *s, int parse_flags)
             emit_op(s, OP_iterator_check_object);
             emit_op(s, OP_get_field2);
             emit_atom(s, JS_ATOM_done);
+            emit_ic(s);
             emit_goto(s, OP_if_false, label_yield);
 
             emit_op(s, OP_get_field);
             emit_atom(s, JS_ATOM_value);
+            emit_ic(s);
 
             emit_label(s, label_return1);
             emit_op(s, OP_nip);
@@ -25759,6 +28250,7 @@ static __exception int js_parse_assign_expr2(JSParseState *s, int parse_flags)
             emit_op(s, OP_iterator_check_object);
             emit_op(s, OP_get_field2);
             emit_atom(s, JS_ATOM_done);
+            emit_ic(s);
             emit_goto(s, OP_if_false, label_yield);
             emit_goto(s, OP_goto, label_next);
             /* close the iterator and throw a type error exception */
@@ -25777,6 +28269,7 @@ static __exception int js_parse_assign_expr2(JSParseState *s, int parse_flags)
             emit_label(s, label_next);
             emit_op(s, OP_get_field);
             emit_atom(s, JS_ATOM_value);
+            emit_ic(s);
             emit_op(s, OP_nip); /* keep the value associated with
                                    done = true */
             emit_op(s, OP_nip);
@@ -26075,6 +28568,7 @@ static void emit_return(JSParseState *s, BOOL hasval)
                     emit_op(s, OP_swap);
                     emit_op(s, OP_get_field2);
                     emit_atom(s, JS_ATOM_return);
+                    emit_ic(s);
                     /* stack: iter_obj return_func */
                     emit_op(s, OP_dup);
                     emit_op(s, OP_is_undefined_or_null);
@@ -30177,13 +32671,13 @@ static int optimize_scope_make_ref(JSContext *ctx, JSFunctionDef *s,
     label_pos = ls->pos;
     pos = label_pos - 5;
     assert(bc_buf[pos] == OP_label);
-    /* label points to an instruction pair:
+    /* label points to an instruction pair followed by 2 nops:
        - insert3 / put_ref_value
        - perm4 / put_ref_value
        - rot3l / put_ref_value
        - nop / put_ref_value
      */
-    end_pos = label_pos + 2;
+    end_pos = label_pos + 4;
     if (bc_buf[label_pos] == OP_insert3)
         bc_buf[pos++] = OP_dup;
     bc_buf[pos] = get_op + 1;
@@ -30218,15 +32712,15 @@ static int optimize_scope_make_global_ref(JSContext *ctx, JSFunctionDef *s,
     if (bc_buf[pos_next] == OP_get_ref_value) {
         dbuf_putc(bc, OP_get_var);
         dbuf_put_u32(bc, JS_DupAtom(ctx, var_name));
+        dbuf_put_u16(bc, 0);
         pos_next++;
     }
     /* remove the OP_label to make room for replacement */
     /* label should have a refcount of 0 anyway */
-    /* XXX: should have emitted several OP_nop to avoid this kludge */
     label_pos = ls->pos;
     pos = label_pos - 5;
     assert(bc_buf[pos] == OP_label);
-    end_pos = label_pos + 2;
+    end_pos = label_pos + 4;
     op = bc_buf[label_pos];
     if (is_strict) {
         if (op != OP_nop) {
@@ -30257,7 +32751,8 @@ static int optimize_scope_make_global_ref(JSContext *ctx, JSFunctionDef *s,
         /* XXX: need 2 extra OP_drop if destructuring an array */
     }
     put_u32(bc_buf + pos + 1, JS_DupAtom(ctx, var_name));
-    pos += 5;
+    put_u16(bc_buf + pos + 5, 0);
+    pos += 7;
     /* pad with OP_nop */
     while (pos < end_pos)
         bc_buf[pos++] = OP_nop;
@@ -30745,12 +33240,14 @@ static int resolve_scope_var(JSContext *ctx, JSFunctionDef *s,
         dbuf_putc(bc, OP_undefined);
         dbuf_putc(bc, OP_get_var);
         dbuf_put_u32(bc, JS_DupAtom(ctx, var_name));
+        dbuf_put_u16(bc, 0);
         break;
     case OP_scope_get_var_undef:
     case OP_scope_get_var:
     case OP_scope_put_var:
         dbuf_putc(bc, OP_get_var_undef + (op - OP_scope_get_var_undef));
         dbuf_put_u32(bc, JS_DupAtom(ctx, var_name));
+        dbuf_put_u16(bc, 0);
         break;
     case OP_scope_put_var_init:
         dbuf_putc(bc, OP_put_var_init);
@@ -31455,6 +33952,7 @@ static void instantiate_hoisted_definitions(JSContext *ctx, JSFunctionDef *s, Dy
                 /* XXX: Check if variable is writable and enumerable */
                 dbuf_putc(bc, OP_put_var);
                 dbuf_put_u32(bc, JS_DupAtom(ctx, hf->var_name));
+                dbuf_put_u16(bc, 0);
             }
         }
     done_global_var:
@@ -31877,6 +34375,7 @@ static __exception int resolve_variables(JSContext *ctx, JSFunctionDef *s)
                 JSAtom name = get_u32(bc_buf + pos + 1);
                 dbuf_putc(&bc_out, OP_get_field);
                 dbuf_put_u32(&bc_out, name);
+                dbuf_put_u16(&bc_out, 0);
             }
             break;
         case OP_get_array_el_opt_chain: /* equivalent to OP_get_array_el */
@@ -32126,6 +34625,156 @@ static void put_short_code(DynBuf *bc_out, int op, int idx)
     dbuf_put_u16(bc_out, idx);
 }
 
+/* Return the argument index of the rest parameter or -1 if none. It is
+   stored at the start of the function with 'rest(idx) put_arg(idx)'. */
+static int find_rest_arg(JSFunctionDef *s)
+{
+    const uint8_t *bc_buf = s->byte_code.buf;
+    int pos, idx;
+
+    for (pos = 0; pos < s->byte_code.size; pos += opcode_info[bc_buf[pos]].size) {
+        if (bc_buf[pos] == OP_rest) {
+            idx = get_u16(bc_buf + pos + 1);
+            if (bc_buf[pos + 3] == OP_put_arg && get_u16(bc_buf + pos + 4) == idx)
+                return idx;
+            break;
+        }
+    }
+    return -1;
+}
+
+/* Return TRUE if the 'arguments' object in the local variable 'idx'
+   or the rest parameter in the argument 'idx' is only read as
+   'obj.length' or 'obj[x]' where 'x' is a variable or an integer
+   constant. The object is then not created and these accesses read
+   the frame directly. The arguments which are not mapped must keep
+   their initial values, so 'no_arg_write' rejects the functions
+   modifying their arguments. The initialization of the rest parameter
+   'rest_idx' is not counted as a modification. */
+static BOOL is_lazy_arguments(JSFunctionDef *s, int idx, BOOL is_arg,
+                              BOOL no_arg_write, int rest_idx)
+{
+    const uint8_t *bc_buf = s->byte_code.buf;
+    int pos, pos_next, op, op1, i;
+
+    if (s->func_kind != JS_FUNC_NORMAL || s->has_eval_call)
+        return FALSE;
+    if (is_arg ? s->args[idx].is_captured : s->vars[idx].is_captured)
+        return FALSE;
+    if (no_arg_write) {
+        for (i = 0; i < s->arg_count; i++) {
+            if (s->args[i].is_captured)
+                return FALSE;
+        }
+    }
+    for (pos = 0; pos < s->byte_code.size; pos = pos_next) {
+        op = bc_buf[pos];
+        pos_next = pos + opcode_info[op].size;
+        switch(op) {
+        case OP_get_loc:
+        case OP_get_arg:
+            if ((op == OP_get_arg) != is_arg || get_u16(bc_buf + pos + 1) != idx)
+                break;
+            op1 = bc_buf[pos_next];
+            if (op1 == OP_get_field &&
+                get_u32(bc_buf + pos_next + 1) == JS_ATOM_length)
+                break;
+            if (op1 == OP_get_loc || op1 == OP_get_loc_check ||
+                op1 == OP_get_arg || op1 == OP_get_var_ref) {
+                if ((op1 == OP_get_arg) == is_arg && op1 != OP_get_var_ref &&
+                    get_u16(bc_buf + pos_next + 1) == idx)
+                    return FALSE;
+            } else if (op1 != OP_push_i32) {
+                return FALSE;
+            }
+            if (bc_buf[pos_next + opcode_info[op1].size] != OP_get_array_el)
+                return FALSE;
+            break;
+        case OP_rest:
+            if (get_u16(bc_buf + pos + 1) == rest_idx)
+                pos_next += opcode_info[OP_put_arg].size;
+            break;
+        case OP_put_arg:
+        case OP_set_arg:
+            if (no_arg_write || (is_arg && get_u16(bc_buf + pos + 1) == idx))
+                return FALSE;
+            break;
+        case OP_make_arg_ref:
+            if (no_arg_write || (is_arg && get_u16(bc_buf + pos + 5) == idx))
+                return FALSE;
+            break;
+        case OP_put_loc:
+        case OP_set_loc:
+        case OP_get_loc_check:
+        case OP_put_loc_check:
+        case OP_put_loc_check_init:
+        case OP_set_loc_uninitialized:
+        case OP_get_loc_checkthis:
+        case OP_close_loc:
+            if (!is_arg && get_u16(bc_buf + pos + 1) == idx)
+                return FALSE;
+            break;
+        case OP_make_loc_ref:
+            if (!is_arg && get_u16(bc_buf + pos + 5) == idx)
+                return FALSE;
+            break;
+        default:
+            break;
+        }
+    }
+    return TRUE;
+}
+
+/* Emit the code of an access to an 'arguments' object in the local
+   variable 'args_idx' or to a rest parameter in the argument
+   'rest_idx' which are not created (see is_lazy_arguments()). Return
+   the position of the next instruction, or 0 if the instruction at
+   'pos' is not such an access. */
+static int put_lazy_arguments_code(JSFunctionDef *s, DynBuf *bc_out, int pos,
+                                   int args_idx, int rest_idx)
+{
+    const uint8_t *bc_buf = s->byte_code.buf;
+    int op, op1, idx;
+
+    op = bc_buf[pos];
+    if (op != OP_get_loc && op != OP_get_arg && op != OP_rest)
+        return 0;
+    idx = get_u16(bc_buf + pos + 1);
+    if (idx != (op == OP_get_loc ? args_idx : rest_idx))
+        return 0;
+    pos += opcode_info[op].size;
+    if (op == OP_rest) {
+        /* the rest parameter is not stored */
+        return pos + opcode_info[OP_put_arg].size;
+    }
+    op1 = bc_buf[pos];
+    if (op1 == OP_get_field) {
+        /* 'length' (see is_lazy_arguments()) */
+        dbuf_putc(bc_out, OP_get_argc);
+        dbuf_put_u16(bc_out, op == OP_get_loc ? 0 : rest_idx);
+        return pos + opcode_info[op1].size;
+    }
+    if (op1 == OP_push_i32)
+        push_short_int(bc_out, get_i32(bc_buf + pos + 1));
+    else if (op1 == OP_get_loc_check)
+        dbuf_put(bc_out, bc_buf + pos, opcode_info[op1].size);
+    else
+        put_short_code(bc_out, op1, get_u16(bc_buf + pos + 1));
+    pos += opcode_info[op1].size;
+    if (op == OP_get_loc) {
+        dbuf_putc(bc_out, OP_get_arguments_el);
+        if ((s->js_mode & JS_MODE_STRICT) || !s->has_simple_parameter_list)
+            dbuf_putc(bc_out, OP_SPECIAL_OBJECT_ARGUMENTS);
+        else
+            dbuf_putc(bc_out, OP_SPECIAL_OBJECT_MAPPED_ARGUMENTS);
+    } else {
+        dbuf_putc(bc_out, OP_get_rest_el);
+        dbuf_put_u16(bc_out, rest_idx);
+    }
+    /* skip get_array_el */
+    return pos + 1;
+}
+
 /* peephole optimizations and resolve goto/labels */
 static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
 {
@@ -32136,6 +34785,7 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
     RelocEntry *re, *re_next;
     CodeContext cc;
     int label;
+    int lazy_args_idx, lazy_rest_idx;
 #if SHORT_OPCODES
     JumpSlot *jp;
 #endif
@@ -32193,8 +34843,24 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
             put_short_code(&bc_out, OP_put_loc, s->this_var_idx);
         }
     }
+    /* the 'arguments' object and the rest parameter are not created if
+       only their elements and length are read */
+    lazy_args_idx = -1;
+    lazy_rest_idx = -1;
+    if (OPTIMIZE) {
+        lazy_rest_idx = find_rest_arg(s);
+        if (lazy_rest_idx >= 0 &&
+            !is_lazy_arguments(s, lazy_rest_idx, TRUE, FALSE, lazy_rest_idx))
+            lazy_rest_idx = -1;
+        if (s->arguments_var_idx >= 0 && s->arguments_arg_idx < 0 &&
+            is_lazy_arguments(s, s->arguments_var_idx, FALSE,
+                              (s->js_mode & JS_MODE_STRICT) ||
+                              !s->has_simple_parameter_list,
+                              lazy_rest_idx))
+            lazy_args_idx = s->arguments_var_idx;
+    }
     /* initialize the 'arguments' variable if needed */
-    if (s->arguments_var_idx >= 0) {
+    if (s->arguments_var_idx >= 0 && lazy_args_idx < 0) {
         if ((s->js_mode & JS_MODE_STRICT) || !s->has_simple_parameter_list) {
             dbuf_putc(&bc_out, OP_special_object);
             dbuf_putc(&bc_out, OP_SPECIAL_OBJECT_ARGUMENTS);
@@ -32229,6 +34895,15 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
         op = bc_buf[pos];
         len = opcode_info[op].size;
         pos_next = pos + len;
+        if (unlikely(lazy_args_idx >= 0 || lazy_rest_idx >= 0)) {
+            add_pc2line_info(s, bc_out.size, line_num);
+            val = put_lazy_arguments_code(s, &bc_out, pos,
+                                          lazy_args_idx, lazy_rest_idx);
+            if (val) {
+                pos_next = val;
+                continue;
+            }
+        }
         switch(op) {
         case OP_line_num:
             /* line number info (for debug). We put it in a separate
@@ -32671,6 +35346,7 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     add_pc2line_info(s, bc_out.size, line_num);
                     dbuf_putc(&bc_out, cc.op);
                     dbuf_put_u32(&bc_out, cc.atom);
+                    dbuf_put_u16(&bc_out, cc.val);
                     pos_next = cc.pos;
                     break;
                 }
@@ -32701,6 +35377,15 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     if (line2 >= 0) line_num = line2;
                     break;
                 }
+                /* Transformation: dup put_loc_check(n) drop -> put_loc_check(n) */
+                if (code_match(&cc, pos_next, OP_put_loc_check, -1, OP_drop, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    dbuf_putc(&bc_out, OP_put_loc_check);
+                    dbuf_put_u16(&bc_out, cc.idx);
+                    pos_next = cc.pos;
+                    break;
+                }
             }
             goto no_change;
 
@@ -32840,6 +35525,7 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     dbuf_putc(&bc_out, OP_dec + (op - OP_post_dec));
                     dbuf_putc(&bc_out, cc.op);
                     dbuf_put_u32(&bc_out, cc.atom);
+                    dbuf_put_u16(&bc_out, cc.val);
                     pos_next = cc.pos;
                     break;
                 }
@@ -33298,6 +35984,72 @@ static int add_module_variables(JSContext *ctx, JSFunctionDef *fd)
     return 0;
 }
 
+static int new_cache_index(int *pcount)
+{
+    if (*pcount < JS_IC_NONE)
+        return (*pcount)++;
+    *pcount = JS_IC_NONE + 1; /* empty cache never updated */
+    return JS_IC_NONE;
+}
+
+/* Replace the first opcode of the most frequent sequences (see
+   DUMP_OPCODE_PAIRS) by a superinstruction executing all of them. The
+   other opcodes are left in place, so the code size is unchanged and
+   the jumps inside the sequence remain valid. */
+static void fuse_superinstructions(JSFunctionDef *s)
+{
+    uint8_t *bc_buf = s->byte_code.buf;
+    int bc_len = s->byte_code.size;
+    int pos, pos_next, op;
+
+    for(pos = 0; pos < bc_len; pos = pos_next) {
+        op = bc_buf[pos];
+        pos_next = pos + short_opcode_info(op).size;
+        switch(op) {
+        case OP_lt:
+            if (pos_next < bc_len &&
+                (bc_buf[pos_next] == OP_if_false ||
+                 bc_buf[pos_next] == OP_if_false8))
+                bc_buf[pos] = OP_lt_if_false;
+            break;
+        case OP_get_loc_check:
+            if (pos_next + 5 <= bc_len &&
+                bc_buf[pos_next] == OP_post_inc &&
+                bc_buf[pos_next + 1] == OP_put_loc_check &&
+                get_u16(bc_buf + pos_next + 2) == get_u16(bc_buf + pos + 1) &&
+                bc_buf[pos_next + 4] == OP_drop)
+                bc_buf[pos] = OP_inc_loc_check;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/* number the caches of the property and global variable accesses */
+static void assign_function_ic(JSFunctionBytecode *b)
+{
+    uint8_t *bc_buf = b->byte_code_buf;
+    int pos, op;
+
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        switch(op) {
+        case OP_get_field:
+        case OP_get_field2:
+        case OP_put_field:
+            put_u16(bc_buf + pos + 5, new_cache_index(&b->ic_count));
+            break;
+        case OP_get_var_undef:
+        case OP_get_var:
+        case OP_put_var:
+        case OP_put_var_strict:
+            put_u16(bc_buf + pos + 5, new_cache_index(&b->gv_cache_count));
+            break;
+        }
+    }
+}
+
 /* create a function object from a function definition. The function
    definition is freed. All the child functions are also created. It
    must be done this way to resolve all the variables. */
@@ -33397,6 +36149,9 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     if (compute_stack_size(ctx, fd, &stack_size) < 0)
         goto fail;
 
+    if (OPTIMIZE)
+        fuse_superinstructions(fd);
+
     if (fd->js_mode & JS_MODE_STRIP) {
         function_size = offsetof(JSFunctionBytecode, debug);
     } else {
@@ -33421,6 +36176,7 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     b->byte_code_buf = (void *)((uint8_t*)b + byte_code_offset);
     b->byte_code_len = fd->byte_code.size;
     memcpy(b->byte_code_buf, fd->byte_code.buf, fd->byte_code.size);
+    assign_function_ic(b);
     js_free(ctx, fd->byte_code.buf);
     fd->byte_code.buf = NULL;
 
@@ -33553,6 +36309,9 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
         JSClosureVar *cv = &b->closure_var[i];
         JS_FreeAtomRT(rt, cv->var_name);
     }
+    if (b->ic)
+        free_function_ic(rt, b);
+    js_free_rt(rt, b->gv_cache);
     if (b->realm)
         JS_FreeContext(b->realm);
 
@@ -34362,6 +37121,7 @@ static __exception int js_parse_program(JSParseState *s)
 
             emit_op(s, OP_put_field);
             emit_atom(s, JS_ATOM_value);
+            emit_ic(s);
         } else {
             emit_op(s, OP_get_loc);
             emit_u16(s, fd->eval_ret_idx);
@@ -34740,9 +37500,9 @@ typedef enum BCTagEnum {
 } BCTagEnum;
 
 #ifdef CONFIG_BIGNUM
-#define BC_VERSION 0x43
+#define BC_VERSION 0x47
 #else
-#define BC_VERSION 3
+#define BC_VERSION 7
 #endif
 
 typedef struct BCWriterState {
@@ -34990,6 +37750,17 @@ static int JS_WriteFunctionBytecode(BCWriterState *s,
         default:
             break;
         }
+        /* the quickened opcodes are written as the generic ones */
+        switch(op) {
+        case OP_get_array_el_fast:
+            bc_buf[pos] = OP_get_array_el;
+            break;
+        case OP_put_array_el_fast:
+            bc_buf[pos] = OP_put_array_el;
+            break;
+        default:
+            break;
+        }
         pos += len;
     }
 
@@ -35450,6 +38221,13 @@ static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj)
             JS_WriteString(s, p);
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSValueConst str = js_string_rope_flatten(s->ctx, obj);
+            if (JS_IsException(str))
+                goto fail;
+            return JS_WriteObjectRec(s, str);
+        }
     case JS_TAG_FUNCTION_BYTECODE:
         if (!s->allow_bytecode)
             goto invalid_tag;
@@ -35888,7 +38666,7 @@ static int JS_ReadFunctionBytecode(BCReaderState *s, JSFunctionBytecode *b,
                                    int byte_code_offset, uint32_t bc_len)
 {
     uint8_t *bc_buf;
-    int pos, len, op;
+    int pos, len, op, *pcount;
     JSAtom atom;
     uint32_t idx;
 
@@ -35912,6 +38690,28 @@ static int JS_ReadFunctionBytecode(BCReaderState *s, JSFunctionBytecode *b,
     while (pos < bc_len) {
         op = bc_buf[pos];
         len = short_opcode_info(op).size;
+        switch(op) {
+        case OP_get_field:
+        case OP_get_field2:
+        case OP_put_field:
+            pcount = &b->ic_count;
+            goto check_cache_index;
+        case OP_get_var_undef:
+        case OP_get_var:
+        case OP_put_var:
+        case OP_put_var_strict:
+            pcount = &b->gv_cache_count;
+        check_cache_index:
+            /* the caches are numbered in order */
+            idx = get_u16(bc_buf + pos + 5);
+            if (idx != min_int(*pcount, JS_IC_NONE)) {
+                b->byte_code_len = pos;
+                JS_ThrowSyntaxError(s->ctx, "invalid cache index");
+                return -1;
+            }
+            *pcount = idx + 1;
+            break;
+        }
         switch(short_opcode_info(op).fmt) {
         case OP_FMT_atom:
         case OP_FMT_atom_u8:
@@ -37157,6 +39957,13 @@ static JSValue JS_ToObject(JSContext *ctx, JSValueConst val)
     case JS_TAG_FLOAT64:
         obj = JS_NewObjectClass(ctx, JS_CLASS_NUMBER);
         goto set_value;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSValueConst str = js_string_rope_flatten(ctx, val);
+            if (JS_IsException(str))
+                return JS_EXCEPTION;
+            return JS_ToObject(ctx, str);
+        }
     case JS_TAG_STRING:
         /* XXX: should call the string constructor */
         {
@@ -38543,8 +41350,9 @@ static JSValue js_function_apply(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv, int magic)
 {
     JSValueConst this_arg, array_arg;
-    uint32_t len;
+    uint32_t len, i;
     JSValue *tab, ret;
+    BOOL is_dense;
 
     if (check_function(ctx, this_val))
         return JS_EXCEPTION;
@@ -38554,15 +41362,33 @@ static JSValue js_function_apply(JSContext *ctx, JSValueConst this_val,
          JS_VALUE_GET_TAG(array_arg) == JS_TAG_NULL) && magic != 2) {
         return JS_Call(ctx, this_val, this_arg, 0, NULL);
     }
-    tab = build_arg_list(ctx, &len, array_arg);
-    if (!tab)
-        return JS_EXCEPTION;
+    /* small dense arrays are copied to the stack because the callee
+       may modify the array. Larger ones go through build_arg_list. */
+    is_dense = js_get_dense_array_args(array_arg, &len) &&
+        len <= JS_MAX_APPLY_STACK_ARGS &&
+        !js_check_stack_overflow(ctx->rt, sizeof(JSValue) * len);
+    if (is_dense) {
+        tab = alloca(sizeof(tab[0]) * len);
+        for(i = 0; i < len; i++) {
+            tab[i] = JS_DupValue(ctx, JS_VALUE_GET_OBJ(array_arg)->u.array.u.values[i]);
+        }
+    } else {
+        tab = build_arg_list(ctx, &len, array_arg);
+        if (!tab)
+            return JS_EXCEPTION;
+    }
     if (magic & 1) {
         ret = JS_CallConstructor2(ctx, this_val, this_arg, len, (JSValueConst *)tab);
     } else {
         ret = JS_Call(ctx, this_val, this_arg, len, (JSValueConst *)tab);
     }
-    free_arg_list(ctx, tab, len);
+    if (is_dense) {
+        for(i = 0; i < len; i++) {
+            JS_FreeValue(ctx, tab[i]);
+        }
+    } else {
+        free_arg_list(ctx, tab, len);
+    }
     return ret;
 }
 
@@ -39033,7 +41859,7 @@ static JSValue js_array_from(JSContext *ctx, JSValueConst this_val,
         if (JS_IsException(r))
             goto exception;
         stack[0] = JS_DupValue(ctx, items);
-        if (js_for_of_start(ctx, &stack[1], FALSE))
+        if (js_for_of_start(ctx, &stack[1], FALSE, FALSE))
             goto exception;
         for (k = 0;; k++) {
             v = JS_IteratorNext(ctx, stack[0], stack[1], 0, NULL, &done);
@@ -39396,11 +42222,61 @@ static JSValue js_typed_array___speciesCreate(JSContext *ctx,
                                               JSValueConst this_val,
                                               int argc, JSValueConst *argv);
 
+/* Read element 'k' of the array scanned by the iteration methods. The
+   callback may modify the array, so the fast array test is done again
+   for each element. */
+static inline int js_array_iter_get(JSContext *ctx, JSValueConst obj,
+                                    int64_t k, JSValue *pval)
+{
+    JSValue *arrp;
+    uint32_t count32;
+
+    if (js_get_fast_array(ctx, obj, &arrp, &count32) && k < count32) {
+        *pval = JS_DupValue(ctx, arrp[k]);
+        return TRUE;
+    }
+    return JS_TryGetPropertyInt64(ctx, obj, k, pval);
+}
+
+/* Call the callback of the iteration methods. As with OP_call, the
+   references in 'args' belong to the caller and the callee may modify
+   them in place, so the arguments are not copied. 'args' is freed. */
+static JSValue js_array_iter_call(JSContext *ctx, JSValueConst func,
+                                  JSValueConst this_arg, int argc,
+                                  JSValue *args)
+{
+    JSValue ret;
+    int i;
+
+    ret = JS_CallInternal(ctx, func, this_arg, JS_UNDEFINED, argc, args, 0);
+    for(i = 0; i < argc; i++)
+        JS_FreeValue(ctx, args[i]);
+    return ret;
+}
+
+/* Define element 'k' of the array built by map() and filter(). When
+   'k' is the next element of an extensible fast array, it is appended
+   directly. */
+static int js_array_iter_define(JSContext *ctx, JSValueConst arr, int64_t k,
+                                JSValue val)
+{
+    JSObject *p;
+
+    if (js_is_fast_array(ctx, arr)) {
+        p = JS_VALUE_GET_OBJ(arr);
+        if (p->extensible && p->u.array.count == k)
+            return add_fast_array_element(ctx, p, val, JS_PROP_THROW);
+    }
+    return JS_DefinePropertyValueInt64(ctx, arr, k, val,
+                                       JS_PROP_C_W_E | JS_PROP_THROW);
+}
+
 static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
                               int argc, JSValueConst *argv, int special)
 {
-    JSValue obj, val, index_val, res, ret;
+    JSValue obj, val, res, ret;
     JSValueConst args[3];
+    JSValue call_args[3];
     JSValueConst func, this_arg;
     int64_t len, k, n;
     int present;
@@ -39439,6 +42315,14 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
         ret = JS_ArraySpeciesCreate(ctx, obj, JS_NewInt64(ctx, len));
         if (JS_IsException(ret))
             goto exception;
+        /* reserve the result elements when the source is a dense array */
+        if (js_is_fast_array(ctx, obj) && js_is_fast_array(ctx, ret)) {
+            JSObject *p = JS_VALUE_GET_OBJ(obj);
+            JSObject *p1 = JS_VALUE_GET_OBJ(ret);
+            if (p->u.array.count == len && len > p1->u.array.u1.size &&
+                expand_fast_array(ctx, p1, len))
+                goto exception;
+        }
         break;
     case special_filter:
         ret = JS_ArraySpeciesCreate(ctx, obj, JS_NewInt32(ctx, 0));
@@ -39467,19 +42351,15 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
                 goto exception;
             present = TRUE;
         } else {
-            present = JS_TryGetPropertyInt64(ctx, obj, k, &val);
+            present = js_array_iter_get(ctx, obj, k, &val);
             if (present < 0)
                 goto exception;
         }
         if (present) {
-            index_val = JS_NewInt64(ctx, k);
-            if (JS_IsException(index_val))
-                goto exception;
-            args[0] = val;
-            args[1] = index_val;
-            args[2] = obj;
-            res = JS_Call(ctx, func, this_arg, 3, args);
-            JS_FreeValue(ctx, index_val);
+            call_args[0] = JS_DupValue(ctx, val);
+            call_args[1] = JS_NewInt64(ctx, k);
+            call_args[2] = JS_DupValue(ctx, obj);
+            res = js_array_iter_call(ctx, func, this_arg, 3, call_args);
             if (JS_IsException(res))
                 goto exception;
             switch (special) {
@@ -39498,8 +42378,7 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
                 }
                 break;
             case special_map:
-                if (JS_DefinePropertyValueInt64(ctx, ret, k, res,
-                                                JS_PROP_C_W_E | JS_PROP_THROW) < 0)
+                if (js_array_iter_define(ctx, ret, k, res) < 0)
                     goto exception;
                 break;
             case special_map | special_TA:
@@ -39509,8 +42388,8 @@ static JSValue js_array_every(JSContext *ctx, JSValueConst this_val,
             case special_filter:
             case special_filter | special_TA:
                 if (JS_ToBoolFree(ctx, res)) {
-                    if (JS_DefinePropertyValueInt64(ctx, ret, n++, JS_DupValue(ctx, val),
-                                                    JS_PROP_C_W_E | JS_PROP_THROW) < 0)
+                    if (js_array_iter_define(ctx, ret, n++,
+                                             JS_DupValue(ctx, val)) < 0)
                         goto exception;
                 }
                 break;
@@ -39554,8 +42433,8 @@ exception:
 static JSValue js_array_reduce(JSContext *ctx, JSValueConst this_val,
                                int argc, JSValueConst *argv, int special)
 {
-    JSValue obj, val, index_val, acc, acc1;
-    JSValueConst args[4];
+    JSValue obj, val, acc, acc1;
+    JSValue args[4];
     JSValueConst func;
     int64_t len, k, k1;
     int present;
@@ -39594,7 +42473,7 @@ static JSValue js_array_reduce(JSContext *ctx, JSValueConst this_val,
                     goto exception;
                 break;
             } else {
-                present = JS_TryGetPropertyInt64(ctx, obj, k1, &acc);
+                present = js_array_iter_get(ctx, obj, k1, &acc);
                 if (present < 0)
                     goto exception;
                 if (present)
@@ -39610,25 +42489,20 @@ static JSValue js_array_reduce(JSContext *ctx, JSValueConst this_val,
                 goto exception;
             present = TRUE;
         } else {
-            present = JS_TryGetPropertyInt64(ctx, obj, k1, &val);
+            present = js_array_iter_get(ctx, obj, k1, &val);
             if (present < 0)
                 goto exception;
         }
         if (present) {
-            index_val = JS_NewInt64(ctx, k1);
-            if (JS_IsException(index_val))
-                goto exception;
             args[0] = acc;
             args[1] = val;
-            args[2] = index_val;
-            args[3] = obj;
-            acc1 = JS_Call(ctx, func, JS_UNDEFINED, 4, args);
-            JS_FreeValue(ctx, index_val);
-            JS_FreeValue(ctx, val);
+            args[2] = JS_NewInt64(ctx, k1);
+            args[3] = JS_DupValue(ctx, obj);
+            acc = JS_UNDEFINED;
             val = JS_UNDEFINED;
+            acc1 = js_array_iter_call(ctx, func, JS_UNDEFINED, 4, args);
             if (JS_IsException(acc1))
                 goto exception;
-            JS_FreeValue(ctx, acc);
             acc = acc1;
         }
     }
@@ -40600,15 +43474,215 @@ exception:
     return 0;
 }
 
+/* default comparison of two int32 values: compare their decimal
+   representations as strings without converting them */
+static int js_array_cmp_int(const void *a, const void *b, void *opaque)
+{
+    const ValueSlot *ap = a, *bp = b;
+    int32_t x = JS_VALUE_GET_INT(ap->val);
+    int32_t y = JS_VALUE_GET_INT(bp->val);
+    uint64_t ux, uy, px, py;
+
+    if (x == y)
+        goto cmp_same;
+    if ((x < 0) != (y < 0))
+        return x < 0 ? -1 : 1; /* '-' is lower than the digits */
+    ux = x < 0 ? -(uint64_t)x : x;
+    uy = y < 0 ? -(uint64_t)y : y;
+    /* scale the number with the fewest digits to compare them */
+    for(px = 10; px <= ux; px *= 10)
+        continue;
+    for(py = 10; py <= uy; py *= 10)
+        continue;
+    if (px < py)
+        ux *= py / px;
+    else
+        uy *= px / py;
+    if (ux != uy)
+        return ux < uy ? -1 : 1;
+    /* one is a prefix of the other */
+    return px < py ? -1 : 1;
+ cmp_same:
+    return (ap->pos > bp->pos) - (ap->pos < bp->pos);
+}
+
+/* default comparison of two flat strings */
+static int js_array_cmp_string(const void *a, const void *b, void *opaque)
+{
+    const ValueSlot *ap = a, *bp = b;
+    struct array_sort_context *psc = opaque;
+    int cmp;
+
+    cmp = js_string_compare(psc->ctx, JS_VALUE_GET_STRING(ap->val),
+                            JS_VALUE_GET_STRING(bp->val));
+    if (cmp != 0)
+        return cmp;
+    return (ap->pos > bp->pos) - (ap->pos < bp->pos);
+}
+
+#define ARRAY_SORT_MIN_RUN 32
+
+/* sort a[start, end) knowing that a[start, sorted) is sorted, inserting
+   each element with a binary search */
+static void array_sort_insertion(ValueSlot *a, size_t start, size_t sorted,
+                                 size_t end,
+                                 int (*cmp)(const void *, const void *, void *),
+                                 void *opaque)
+{
+    ValueSlot v;
+    size_t i, lo, hi, mid;
+
+    for(i = sorted; i < end; i++) {
+        v = a[i];
+        lo = start;
+        hi = i;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (cmp(&v, &a[mid], opaque) < 0)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        memmove(&a[lo + 1], &a[lo], (i - lo) * sizeof(a[0]));
+        a[lo] = v;
+    }
+}
+
+/* stable merge of the sorted a[start, mid) and a[mid, end). 'tmp'
+   receives the shortest one. */
+static void array_sort_merge(ValueSlot *a, size_t start, size_t mid,
+                             size_t end, ValueSlot *tmp,
+                             int (*cmp)(const void *, const void *, void *),
+                             void *opaque)
+{
+    size_t i, j, k, n;
+
+    if (cmp(&a[mid], &a[mid - 1], opaque) >= 0)
+        return; /* already in order */
+    if (mid - start <= end - mid) {
+        n = mid - start;
+        memcpy(tmp, &a[start], n * sizeof(a[0]));
+        i = 0;
+        j = mid;
+        k = start;
+        while (i < n && j < end) {
+            if (cmp(&a[j], &tmp[i], opaque) < 0)
+                a[k++] = a[j++];
+            else
+                a[k++] = tmp[i++];
+        }
+        memcpy(&a[k], &tmp[i], (n - i) * sizeof(a[0]));
+    } else {
+        /* merge from the end */
+        n = end - mid;
+        memcpy(tmp, &a[mid], n * sizeof(a[0]));
+        i = n;
+        j = mid;
+        k = end;
+        while (i > 0 && j > start) {
+            if (cmp(&tmp[i - 1], &a[j - 1], opaque) < 0)
+                a[--k] = a[--j];
+            else
+                a[--k] = tmp[--i];
+        }
+        memcpy(&a[k - i], tmp, i * sizeof(a[0]));
+    }
+}
+
+/* Stable natural merge sort: the ascending and strictly descending runs
+   are detected and extended to ARRAY_SORT_MIN_RUN elements, then merged
+   with the balancing rules of TimSort. Sorted inputs take n - 1
+   comparisons. Return -1 if memory allocation failed. */
+static int array_merge_sort(JSContext *ctx, ValueSlot *a, size_t n,
+                            int (*cmp)(const void *, const void *, void *),
+                            void *opaque)
+{
+    struct { size_t start, len; } runs[85];
+    ValueSlot *tmp, v;
+    size_t i, j, k, end;
+    int nruns;
+
+    if (n < 2)
+        return 0;
+    if (n <= ARRAY_SORT_MIN_RUN) {
+        array_sort_insertion(a, 0, 1, n, cmp, opaque);
+        return 0;
+    }
+    tmp = js_malloc(ctx, (n / 2) * sizeof(tmp[0]));
+    if (!tmp)
+        return -1;
+    nruns = 0;
+    for(i = 0; i < n; i = end) {
+        j = i + 1;
+        if (j < n) {
+            if (cmp(&a[j], &a[i], opaque) < 0) {
+                for(j++; j < n && cmp(&a[j], &a[j - 1], opaque) < 0; j++)
+                    continue;
+                for(k = 0; k < (j - i) / 2; k++) {
+                    v = a[i + k];
+                    a[i + k] = a[j - 1 - k];
+                    a[j - 1 - k] = v;
+                }
+            } else {
+                for(j++; j < n && cmp(&a[j], &a[j - 1], opaque) >= 0; j++)
+                    continue;
+            }
+        }
+        end = j;
+        if (end - i < ARRAY_SORT_MIN_RUN) {
+            end = i + ARRAY_SORT_MIN_RUN;
+            if (end > n)
+                end = n;
+            array_sort_insertion(a, i, j, end, cmp, opaque);
+        }
+        runs[nruns].start = i;
+        runs[nruns].len = end - i;
+        nruns++;
+        /* keep the run lengths decreasing faster than the Fibonacci
+           sequence so that the stack stays small */
+        while (nruns > 1) {
+            k = nruns - 2;
+            if ((k > 0 && runs[k - 1].len <= runs[k].len + runs[k + 1].len) ||
+                (k > 1 && runs[k - 2].len <= runs[k - 1].len + runs[k].len)) {
+                if (runs[k - 1].len < runs[k + 1].len)
+                    k--;
+            } else if (runs[k].len > runs[k + 1].len) {
+                break;
+            }
+            array_sort_merge(a, runs[k].start, runs[k + 1].start,
+                             runs[k + 1].start + runs[k + 1].len, tmp, cmp, opaque);
+            runs[k].len += runs[k + 1].len;
+            if (k + 2 < nruns)
+                runs[k + 1] = runs[k + 2];
+            nruns--;
+        }
+    }
+    while (nruns > 1) {
+        k = nruns - 2;
+        if (k > 0 && runs[k - 1].len < runs[k + 1].len)
+            k--;
+        array_sort_merge(a, runs[k].start, runs[k + 1].start,
+                         runs[k + 1].start + runs[k + 1].len, tmp, cmp, opaque);
+        runs[k].len += runs[k + 1].len;
+        if (k + 2 < nruns)
+            runs[k + 1] = runs[k + 2];
+        nruns--;
+    }
+    js_free(ctx, tmp);
+    return 0;
+}
+
 static JSValue js_array_sort(JSContext *ctx, JSValueConst this_val,
                              int argc, JSValueConst *argv)
 {
     struct array_sort_context asc = { ctx, 0, 0, argv[0] };
-    JSValue obj = JS_UNDEFINED;
+    JSValue obj = JS_UNDEFINED, *arrp;
     ValueSlot *array = NULL;
     size_t array_size = 0, pos = 0, n = 0;
     int64_t i, len, undefined_count = 0;
-    int present;
+    int present, all_int, all_string;
+    uint32_t count32;
+    int (*cmp)(const void *a, const void *b, void *opaque);
 
     if (!JS_IsUndefined(asc.method)) {
         if (check_function(ctx, asc.method))
@@ -40619,7 +43693,6 @@ static JSValue js_array_sort(JSContext *ctx, JSValueConst this_val,
     if (js_get_length64(ctx, &len, obj))
         goto exception;
 
-    /* XXX: should special case fast arrays */
     for (i = 0; i < len; i++) {
         if (pos >= array_size) {
             size_t new_size, slack;
@@ -40632,11 +43705,16 @@ static JSValue js_array_sort(JSContext *ctx, JSValueConst this_val,
             array = new_array;
             array_size = new_size;
         }
-        present = JS_TryGetPropertyInt64(ctx, obj, i, &array[pos].val);
-        if (present < 0)
-            goto exception;
-        if (present == 0)
-            continue;
+        if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
+            /* no getter can be called */
+            array[pos].val = JS_DupValue(ctx, arrp[i]);
+        } else {
+            present = JS_TryGetPropertyInt64(ctx, obj, i, &array[pos].val);
+            if (present < 0)
+                goto exception;
+            if (present == 0)
+                continue;
+        }
         if (JS_IsUndefined(array[pos].val)) {
             undefined_count++;
             continue;
@@ -40645,11 +43723,63 @@ static JSValue js_array_sort(JSContext *ctx, JSValueConst this_val,
         array[pos].pos = i;
         pos++;
     }
-    rqsort(array, pos, sizeof(*array), js_array_cmp_generic, &asc);
+
+    /* the default order of int32 values and strings does not need the
+       string conversions */
+    cmp = js_array_cmp_generic;
+    if (!asc.has_method) {
+        all_int = all_string = TRUE;
+        for (n = 0; n < pos && (all_int || all_string); n++) {
+            switch (JS_VALUE_GET_TAG(array[n].val)) {
+            case JS_TAG_INT:
+                all_string = FALSE;
+                break;
+            case JS_TAG_STRING:
+                all_int = FALSE;
+                break;
+            case JS_TAG_STRING_ROPE:
+                all_int = FALSE;
+                if (all_string) {
+                    array[n].val = js_flatten_string(ctx, array[n].val);
+                    if (JS_IsException(array[n].val)) {
+                        array[n].val = JS_UNDEFINED;
+                        n = 0;
+                        goto exception;
+                    }
+                }
+                break;
+            default:
+                all_int = all_string = FALSE;
+                break;
+            }
+        }
+        n = 0;
+        if (all_int)
+            cmp = js_array_cmp_int;
+        else if (all_string)
+            cmp = js_array_cmp_string;
+    }
+    if (array_merge_sort(ctx, array, pos, cmp, &asc))
+        goto exception;
     if (asc.exception)
         goto exception;
 
-    /* XXX: should special case fast arrays */
+    if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
+        /* no hole and no setter: the elements are replaced directly */
+        for (n = 0; n < pos; n++) {
+            if (array[n].str)
+                JS_FreeValue(ctx, JS_MKPTR(JS_TAG_STRING, array[n].str));
+            if (array[n].pos == n)
+                JS_FreeValue(ctx, array[n].val);
+            else
+                set_value(ctx, &JS_VALUE_GET_OBJ(obj)->u.array.u.values[n], array[n].val);
+        }
+        js_free(ctx, array);
+        for (i = n; i < len; i++)
+            set_value(ctx, &JS_VALUE_GET_OBJ(obj)->u.array.u.values[i], JS_UNDEFINED);
+        return obj;
+    }
+
     while (n < pos) {
         if (array[n].str)
             JS_FreeValue(ctx, JS_MKPTR(JS_TAG_STRING, array[n].str));
@@ -40828,6 +43958,25 @@ static JSValue js_create_array_iterator(JSContext *ctx, JSValueConst this_val,
     return JS_EXCEPTION;
 }
 
+/* Replace the array and the index of the enumeration record 'penum'
+   by an array iterator and its 'next' method (see js_for_of_start()) */
+static int js_for_of_create_iterator(JSContext *ctx, JSValue *penum)
+{
+    JSValue enum_obj;
+    JSArrayIteratorData *it;
+
+    enum_obj = js_create_array_iterator(ctx, penum[0], 0, NULL,
+                                        JS_ITERATOR_KIND_VALUE);
+    if (JS_IsException(enum_obj))
+        return -1;
+    it = JS_VALUE_GET_OBJ(enum_obj)->u.array_iterator_data;
+    it->idx = JS_VALUE_GET_INT(penum[1]);
+    JS_FreeValue(ctx, penum[0]);
+    penum[0] = enum_obj;
+    penum[1] = JS_DupValue(ctx, ctx->array_iterator_next);
+    return 0;
+}
+
 static JSValue js_array_iterator_next(JSContext *ctx, JSValueConst this_val,
                                       int argc, JSValueConst *argv,
                                       BOOL *pdone, int magic)
@@ -41441,6 +44590,8 @@ static JSValue js_thisStringValue(JSContext *ctx, JSValueConst this_val)
 {
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING)
         return JS_DupValue(ctx, this_val);
+    if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING_ROPE)
+        return JS_DupValue(ctx, js_string_rope_flatten(ctx, this_val));
 
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_OBJECT) {
         JSObject *p = JS_VALUE_GET_OBJ(this_val);
@@ -41683,6 +44834,8 @@ static JSValue js_string_concat(JSContext *ctx, JSValueConst this_val,
 static int string_cmp(JSString *p1, JSString *p2, int x1, int x2, int len)
 {
     int i, c1, c2;
+    if (!p1->is_wide_char && !p2->is_wide_char)
+        return memcmp(p1->u.str8 + x1, p2->u.str8 + x2, len);
     for (i = 0; i < len; i++) {
         if ((c1 = string_get(p1, x1 + i)) != (c2 = string_get(p2, x2 + i)))
             return c1 - c2;
@@ -41695,35 +44848,167 @@ static int string_indexof_char(JSString *p, int c, int from)
     /* assuming 0 <= from <= p->len */
     int i, len = p->len;
     if (p->is_wide_char) {
-        for (i = from; i < len; i++) {
-            if (p->u.str16[i] == c)
+        const uint16_t *s = p->u.str16;
+        i = from;
+#if defined(__AVX2__)
+        {
+            __m256i vc = _mm256_set1_epi16(c);
+            for (; i + 16 <= len; i += 16) {
+                __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+                uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(a, vc));
+                if (mask)
+                    return i + (ctz32(mask) >> 1);
+            }
+        }
+#elif defined(__SSE2__)
+        {
+            __m128i vc = _mm_set1_epi16(c);
+            for (; i + 8 <= len; i += 8) {
+                __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+                uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi16(a, vc));
+                if (mask)
+                    return i + (ctz32(mask) >> 1);
+            }
+        }
+#endif
+        for (; i < len; i++) {
+            if (s[i] == c)
                 return i;
         }
     } else {
-        if ((c & ~0xff) == 0) {
-            for (i = from; i < len; i++) {
-                if (p->u.str8[i] == (uint8_t)c)
-                    return i;
+        if ((c & ~0xff) == 0 && from < len) {
+            /* memchr() is vectorized by the C library */
+            const uint8_t *q = memchr(p->u.str8 + from, c, len - from);
+            if (q)
+                return q - p->u.str8;
+        }
+    }
+    return -1;
+}
+
+/* Search p2 (of length >= 2) in p1 from 'from'. A SIMD filter on the
+   first and last characters of p2 selects the candidate positions,
+   then the characters in between are compared. */
+static int string_indexof8(JSString *p1, JSString *p2, int from)
+{
+    const uint8_t *s = p1->u.str8;
+    int i, k, len1 = p1->len, len2 = p2->len;
+    int c0 = string_get(p2, 0), c1 = string_get(p2, len2 - 1);
+
+    if ((c0 | c1) & ~0xff)
+        return -1;
+    i = from;
+#if defined(__AVX2__)
+    {
+        __m256i vc0 = _mm256_set1_epi8(c0);
+        __m256i vc1 = _mm256_set1_epi8(c1);
+        for (; i + len2 - 1 + 32 <= len1; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + len2 - 1));
+            uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, vc0),
+                                                                  _mm256_cmpeq_epi8(b, vc1)));
+            while (mask) {
+                k = i + ctz32(mask);
+                if (!string_cmp(p1, p2, k + 1, 1, len2 - 2))
+                    return k;
+                mask &= mask - 1;
+            }
+        }
+    }
+#elif defined(__SSE2__)
+    {
+        __m128i vc0 = _mm_set1_epi8(c0);
+        __m128i vc1 = _mm_set1_epi8(c1);
+        for (; i + len2 - 1 + 16 <= len1; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(s + i + len2 - 1));
+            uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, vc0),
+                                                            _mm_cmpeq_epi8(b, vc1)));
+            while (mask) {
+                k = i + ctz32(mask);
+                if (!string_cmp(p1, p2, k + 1, 1, len2 - 2))
+                    return k;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    while (i + len2 <= len1) {
+        const uint8_t *q = memchr(s + i, c0, len1 - len2 + 1 - i);
+        if (!q)
+            break;
+        k = q - s;
+        if (s[k + len2 - 1] == c1 && !string_cmp(p1, p2, k + 1, 1, len2 - 2))
+            return k;
+        i = k + 1;
+    }
+    return -1;
+}
+
+static int string_indexof16(JSString *p1, JSString *p2, int from)
+{
+    const uint16_t *s = p1->u.str16;
+    int i, k, len1 = p1->len, len2 = p2->len;
+    int c0 = string_get(p2, 0), c1 = string_get(p2, len2 - 1);
+
+    i = from;
+#if defined(__AVX2__)
+    {
+        __m256i vc0 = _mm256_set1_epi16(c0);
+        __m256i vc1 = _mm256_set1_epi16(c1);
+        for (; i + len2 - 1 + 16 <= len1; i += 16) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + len2 - 1));
+            uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi16(a, vc0),
+                                                                  _mm256_cmpeq_epi16(b, vc1)));
+            mask &= 0x55555555;
+            while (mask) {
+                k = i + (ctz32(mask) >> 1);
+                if (!string_cmp(p1, p2, k + 1, 1, len2 - 2))
+                    return k;
+                mask &= mask - 1;
+            }
+        }
+    }
+#elif defined(__SSE2__)
+    {
+        __m128i vc0 = _mm_set1_epi16(c0);
+        __m128i vc1 = _mm_set1_epi16(c1);
+        for (; i + len2 - 1 + 8 <= len1; i += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(s + i + len2 - 1));
+            uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(a, vc0),
+                                                            _mm_cmpeq_epi16(b, vc1)));
+            mask &= 0x5555;
+            while (mask) {
+                k = i + (ctz32(mask) >> 1);
+                if (!string_cmp(p1, p2, k + 1, 1, len2 - 2))
+                    return k;
+                mask &= mask - 1;
             }
         }
     }
+#endif
+    for (; i + len2 <= len1; i++) {
+        if (s[i] == c0 && s[i + len2 - 1] == c1 &&
+            !string_cmp(p1, p2, i + 1, 1, len2 - 2))
+            return i;
+    }
     return -1;
 }
 
 static int string_indexof(JSString *p1, JSString *p2, int from)
 {
     /* assuming 0 <= from <= p1->len */
-    int c, i, j, len1 = p1->len, len2 = p2->len;
+    int len2 = p2->len;
     if (len2 == 0)
         return from;
-    for (i = from, c = string_get(p2, 0); i + len2 <= len1; i = j + 1) {
-        j = string_indexof_char(p1, c, i);
-        if (j < 0 || j + len2 > len1)
-            break;
-        if (!string_cmp(p1, p2, j + 1, 1, len2 - 1))
-            return j;
-    }
-    return -1;
+    if (len2 == 1)
+        return string_indexof_char(p1, string_get(p2, 0), from);
+    if (p1->is_wide_char)
+        return string_indexof16(p1, p2, from);
+    else
+        return string_indexof8(p1, p2, from);
 }
 
 static int64_t string_advance_index(JSString *p, int64_t index, BOOL unicode)
@@ -41857,7 +45142,10 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
         inc = 1;
     }
     ret = -1;
-    if (len >= v_len && inc * (stop - start) >= 0) {
+    if (!lastIndexOf) {
+        if (len >= v_len && start <= stop)
+            ret = string_indexof(p, p1, start);
+    } else if (len >= v_len && inc * (stop - start) >= 0) {
         for (i = start;; i += inc) {
             if (!string_cmp(p, p1, i, 0, v_len)) {
                 ret = i;
@@ -41884,7 +45172,7 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
                                   int argc, JSValueConst *argv, int magic)
 {
     JSValue str, v = JS_UNDEFINED;
-    int i, len, v_len, pos, start, stop, ret;
+    int len, v_len, pos, start, stop, ret;
     JSString *p;
     JSString *p1;
 
@@ -41924,13 +45212,10 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
         start = stop = pos;
     }
     if (start >= 0 && start <= stop) {
-        for (i = start;; i++) {
-            if (!string_cmp(p, p1, i, 0, v_len)) {
-                ret = 1;
-                break;
-            }
-            if (i == stop)
-                break;
+        if (magic == 0) {
+            ret = (string_indexof(p, p1, start) >= 0);
+        } else if (!string_cmp(p, p1, start, 0, v_len)) {
+            ret = 1;
         }
     }
  done:
@@ -45156,12 +48441,515 @@ static JSValue json_parse_value(JSParseState *s)
     return JS_EXCEPTION;
 }
 
+/* JSON.parse fast path. It handles the JSON grammar only and returns
+   JS_UNINITIALIZED on anything else (including syntax errors) so that
+   the generic parser above runs and reports the error. */
+
+#define JSON_SHAPE_CACHE_DEPTH 16
+
+typedef struct JSONParseEntry {
+    JSAtom atom; /* JS_ATOM_NULL for array elements */
+    JSValue val;
+} JSONParseEntry;
+
+typedef struct JSONParseState {
+    JSContext *ctx;
+    const uint8_t *p;
+    const uint8_t *p_end; /* the buffer is zero terminated */
+    BOOL fallback; /* the generic parser must be used */
+    int depth;
+    /* pending members of the arrays and objects being parsed */
+    JSONParseEntry *stack;
+    int stack_len;
+    int stack_size;
+    /* shape of the last object built at each depth. The sibling objects
+       with the same keys reuse it without property transitions and its
+       atoms are tried first when parsing their keys. */
+    JSShape *shapes[JSON_SHAPE_CACHE_DEPTH];
+} JSONParseState;
+
+static JSValue json_fast_parse_value(JSONParseState *s);
+
+/* skip the JSON whitespace */
+static inline const uint8_t *json_skip_space(const uint8_t *p,
+                                             const uint8_t *p_end)
+{
+    if (likely(*p > ' '))
+        return p;
+#if defined(__SSE2__)
+    while (p_end - p >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8(' ')),
+                                              _mm_cmpeq_epi8(a, _mm_set1_epi8('\n'))),
+                                 _mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8('\r')),
+                                              _mm_cmpeq_epi8(a, _mm_set1_epi8('\t'))));
+        uint32_t mask = _mm_movemask_epi8(m);
+        if (mask != 0xffff)
+            return p + ctz32(~mask);
+        p += 16;
+    }
+#endif
+    while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')
+        p++;
+    return p;
+}
+
+/* return the first byte of [p, p_end) which is '"', '\\', a control
+   character or a non-ASCII byte */
+static inline const uint8_t *json_scan_string(const uint8_t *p,
+                                              const uint8_t *p_end)
+{
+#if defined(__AVX2__)
+    while (p_end - p >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        /* signed compare: also true for the bytes >= 0x80 */
+        __m256i m = _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), a),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(a, _mm256_set1_epi8('"')),
+                                                    _mm256_cmpeq_epi8(a, _mm256_set1_epi8('\\'))));
+        uint32_t mask = _mm256_movemask_epi8(m);
+        if (mask)
+            return p + ctz32(mask);
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    while (p_end - p >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        /* signed compare: also true for the bytes >= 0x80 */
+        __m128i m = _mm_or_si128(_mm_cmplt_epi8(a, _mm_set1_epi8(0x20)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8('"')),
+                                              _mm_cmpeq_epi8(a, _mm_set1_epi8('\\'))));
+        uint32_t mask = _mm_movemask_epi8(m);
+        if (mask)
+            return p + ctz32(mask);
+        p += 16;
+    }
+#endif
+    while (p < p_end && *p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\')
+        p++;
+    return p;
+}
+
+/* 'p' points after the opening quote */
+static JSValue json_fast_parse_string(JSONParseState *s, const uint8_t *p)
+{
+    StringBuffer b_s, *b = &b_s;
+    const uint8_t *p1;
+    uint32_t c;
+    int i, h, l;
+
+    p1 = json_scan_string(p, s->p_end);
+    if (p1 < s->p_end && *p1 == '"') {
+        s->p = p1 + 1;
+        return js_new_string8(s->ctx, p, p1 - p);
+    }
+    if (string_buffer_init(s->ctx, b, p1 - p + 16))
+        return JS_EXCEPTION;
+    for(;;) {
+        string_buffer_write8(b, p, p1 - p);
+        p = p1;
+        if (p >= s->p_end)
+            goto fallback;
+        c = *p;
+        if (c == '"') {
+            break;
+        } else if (c == '\\') {
+            switch(p[1]) {
+            case '"':
+            case '\\':
+            case '/':
+                c = p[1];
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'u':
+                c = 0;
+                for(i = 0; i < 4; i++) {
+                    h = from_hex(p[2 + i]);
+                    if (h < 0)
+                        goto fallback;
+                    c = (c << 4) | h;
+                }
+                p += 4;
+                break;
+            default:
+                goto fallback;
+            }
+            p += 2;
+            string_buffer_putc16(b, c);
+        } else if (c >= 0x80) {
+            l = utf8_decode_fast(p, s->p_end, &c);
+            if (l == 0)
+                goto fallback;
+            p += l;
+            string_buffer_putc(b, c);
+        } else {
+            goto fallback;
+        }
+        p1 = json_scan_string(p, s->p_end);
+    }
+    s->p = p + 1;
+    return string_buffer_end(b);
+ fallback:
+    string_buffer_free(b);
+    s->fallback = TRUE;
+    return JS_EXCEPTION;
+}
+
+/* 'p' points after the opening quote of the key of the member 'idx' */
+static JSAtom json_fast_parse_key(JSONParseState *s, const uint8_t *p, int idx)
+{
+    JSContext *ctx = s->ctx;
+    const uint8_t *p1;
+    JSShape *sh;
+    JSAtom atom;
+    JSString *str;
+    JSValue val;
+    size_t len;
+
+    p1 = json_scan_string(p, s->p_end);
+    if (p1 < s->p_end && *p1 == '"') {
+        /* ASCII key without escapes: try the key at the same position
+           in the sibling object */
+        len = p1 - p;
+        s->p = p1 + 1;
+        if (s->depth < JSON_SHAPE_CACHE_DEPTH) {
+            sh = s->shapes[s->depth];
+            if (sh && idx < sh->prop_count) {
+                atom = get_shape_prop(sh)[idx].atom;
+                if (!__JS_AtomIsTaggedInt(atom)) {
+                    str = ctx->rt->atom_array[atom];
+                    if (str->len == len && !str->is_wide_char &&
+                        !memcmp(str->u.str8, p, len))
+                        return JS_DupAtom(ctx, atom);
+                }
+            }
+        }
+        atom = JS_NewAtomLen(ctx, (const char *)p, len);
+    } else {
+        val = json_fast_parse_string(s, p);
+        if (JS_IsException(val))
+            return JS_ATOM_NULL;
+        atom = JS_NewAtomStr(ctx, JS_VALUE_GET_STRING(val));
+    }
+    return atom;
+}
+
+static JSValue json_fast_parse_number(JSONParseState *s, const uint8_t *p)
+{
+    const uint8_t *p_start = p;
+    uint64_t v;
+    int n;
+    BOOL is_neg;
+    JSValue val;
+
+    is_neg = (*p == '-');
+    p += is_neg;
+    if (*p == '0') {
+        if (is_digit(p[1]))
+            goto fallback;
+        p++;
+    } else if (!is_digit(*p)) {
+        goto fallback;
+    }
+    v = 0;
+    for(n = 0; is_digit(*p); n++, p++)
+        v = v * 10 + (*p - '0');
+    if (likely(n <= 15 && *p != '.' && *p != 'e' && *p != 'E')) {
+        /* exact in a float64 */
+        s->p = p;
+        return JS_NewFloat64(s->ctx, is_neg ? -(double)v : (double)v);
+    }
+    val = js_atof(s->ctx, (const char *)p_start, (const char **)&p, 10, 0);
+    s->p = p;
+    return val;
+ fallback:
+    s->fallback = TRUE;
+    return JS_EXCEPTION;
+}
+
+static int json_fast_push(JSONParseState *s, JSAtom atom, JSValue val)
+{
+    JSONParseEntry *e;
+
+    if (js_resize_array(s->ctx, (void **)&s->stack, sizeof(s->stack[0]),
+                        &s->stack_size, s->stack_len + 1)) {
+        JS_FreeAtom(s->ctx, atom);
+        JS_FreeValue(s->ctx, val);
+        return -1;
+    }
+    e = &s->stack[s->stack_len++];
+    e->atom = atom;
+    e->val = val;
+    return 0;
+}
+
+static void json_fast_pop(JSONParseState *s, int base)
+{
+    JSONParseEntry *e;
+
+    while (s->stack_len > base) {
+        e = &s->stack[--s->stack_len];
+        JS_FreeAtom(s->ctx, e->atom);
+        JS_FreeValue(s->ctx, e->val);
+    }
+}
+
+/* build the object from the members base..stack_len - 1 */
+static JSValue json_fast_new_object(JSONParseState *s, int base)
+{
+    JSContext *ctx = s->ctx;
+    JSONParseEntry *e = s->stack + base;
+    int i, n = s->stack_len - base;
+    JSShape *sh = NULL;
+    JSShapeProperty *prs;
+    JSObject *p;
+    JSValue obj;
+
+    if (s->depth < JSON_SHAPE_CACHE_DEPTH)
+        sh = s->shapes[s->depth];
+    if (sh && sh->prop_count == n) {
+        prs = get_shape_prop(sh);
+        for(i = 0; i < n; i++) {
+            if (prs[i].atom != e[i].atom)
+                goto generic;
+        }
+        obj = JS_NewObjectFromShape(ctx, js_dup_shape(sh), JS_CLASS_OBJECT);
+        if (JS_IsException(obj))
+            goto fail;
+        p = JS_VALUE_GET_OBJ(obj);
+        for(i = 0; i < n; i++) {
+            p->prop[i].u.value = e[i].val;
+            JS_FreeAtom(ctx, e[i].atom);
+        }
+        s->stack_len = base;
+        return obj;
+    }
+ generic:
+    obj = JS_NewObject(ctx);
+    if (JS_IsException(obj))
+        goto fail;
+    for(i = 0; i < n; i++) {
+        /* duplicate keys keep the last value */
+        if (JS_DefinePropertyValue(ctx, obj, e[i].atom, e[i].val,
+                                   JS_PROP_C_W_E) < 0) {
+            e[i].val = JS_UNDEFINED;
+            JS_FreeValue(ctx, obj);
+            goto fail;
+        }
+        e[i].val = JS_UNDEFINED;
+    }
+    json_fast_pop(s, base);
+    sh = JS_VALUE_GET_OBJ(obj)->shape;
+    if (s->depth < JSON_SHAPE_CACHE_DEPTH && sh->is_hashed &&
+        sh->prop_count == n && sh->deleted_prop_count == 0) {
+        if (s->shapes[s->depth])
+            js_free_shape(ctx->rt, s->shapes[s->depth]);
+        s->shapes[s->depth] = js_dup_shape(sh);
+    }
+    return obj;
+ fail:
+    json_fast_pop(s, base);
+    return JS_EXCEPTION;
+}
+
+/* build the array from the elements base..stack_len - 1 */
+static JSValue json_fast_new_array(JSONParseState *s, int base)
+{
+    JSValue arr;
+    JSObject *p;
+    int i, n = s->stack_len - base;
+
+    arr = js_allocate_fast_array(s->ctx, n);
+    if (JS_IsException(arr)) {
+        json_fast_pop(s, base);
+        return arr;
+    }
+    p = JS_VALUE_GET_OBJ(arr);
+    for(i = 0; i < n; i++)
+        p->u.array.u.values[i] = s->stack[base + i].val;
+    p->prop[0].u.value = JS_NewInt32(s->ctx, n);
+    s->stack_len = base;
+    return arr;
+}
+
+static JSValue json_fast_parse_object(JSONParseState *s, const uint8_t *p)
+{
+    JSValue val;
+    JSAtom atom;
+    int idx, base = s->stack_len;
+
+    p = json_skip_space(p, s->p_end);
+    if (*p != '}') {
+        for(idx = 0;; idx++) {
+            if (*p != '"')
+                goto fallback;
+            atom = json_fast_parse_key(s, p + 1, idx);
+            if (atom == JS_ATOM_NULL)
+                goto fail;
+            p = json_skip_space(s->p, s->p_end);
+            if (*p != ':') {
+                JS_FreeAtom(s->ctx, atom);
+                goto fallback;
+            }
+            s->p = p + 1;
+            val = json_fast_parse_value(s);
+            if (JS_IsException(val)) {
+                JS_FreeAtom(s->ctx, atom);
+                goto fail;
+            }
+            if (json_fast_push(s, atom, val))
+                goto fail;
+            p = json_skip_space(s->p, s->p_end);
+            if (*p == '}')
+                break;
+            if (*p != ',')
+                goto fallback;
+            p = json_skip_space(p + 1, s->p_end);
+        }
+    }
+    s->p = p + 1;
+    return json_fast_new_object(s, base);
+ fallback:
+    s->fallback = TRUE;
+ fail:
+    json_fast_pop(s, base);
+    return JS_EXCEPTION;
+}
+
+static JSValue json_fast_parse_array(JSONParseState *s, const uint8_t *p)
+{
+    JSValue val;
+    int base = s->stack_len;
+
+    p = json_skip_space(p, s->p_end);
+    if (*p != ']') {
+        for(;;) {
+            s->p = p;
+            val = json_fast_parse_value(s);
+            if (JS_IsException(val))
+                goto fail;
+            if (json_fast_push(s, JS_ATOM_NULL, val))
+                goto fail;
+            p = json_skip_space(s->p, s->p_end);
+            if (*p == ']')
+                break;
+            if (*p != ',')
+                goto fallback;
+            p = json_skip_space(p + 1, s->p_end);
+        }
+    }
+    s->p = p + 1;
+    return json_fast_new_array(s, base);
+ fallback:
+    s->fallback = TRUE;
+ fail:
+    json_fast_pop(s, base);
+    return JS_EXCEPTION;
+}
+
+static JSValue json_fast_parse_value(JSONParseState *s)
+{
+    const uint8_t *p;
+    JSValue val;
+
+    if (js_check_stack_overflow(s->ctx->rt, 0))
+        goto fallback;
+    p = json_skip_space(s->p, s->p_end);
+    switch(*p) {
+    case '{':
+        s->depth++;
+        val = json_fast_parse_object(s, p + 1);
+        s->depth--;
+        return val;
+    case '[':
+        s->depth++;
+        val = json_fast_parse_array(s, p + 1);
+        s->depth--;
+        return val;
+    case '"':
+        return json_fast_parse_string(s, p + 1);
+    case 't':
+        if (p[1] == 'r' && p[2] == 'u' && p[3] == 'e') {
+            s->p = p + 4;
+            return JS_TRUE;
+        }
+        break;
+    case 'f':
+        if (p[1] == 'a' && p[2] == 'l' && p[3] == 's' && p[4] == 'e') {
+            s->p = p + 5;
+            return JS_FALSE;
+        }
+        break;
+    case 'n':
+        if (p[1] == 'u' && p[2] == 'l' && p[3] == 'l') {
+            s->p = p + 4;
+            return JS_NULL;
+        }
+        break;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        return json_fast_parse_number(s, p);
+    default:
+        break;
+    }
+ fallback:
+    s->fallback = TRUE;
+    return JS_EXCEPTION;
+}
+
+static JSValue json_parse_fast(JSContext *ctx, const char *buf, size_t buf_len)
+{
+    JSONParseState s1, *s = &s1;
+    JSValue val;
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->p = (const uint8_t *)buf;
+    s->p_end = s->p + buf_len;
+    val = json_fast_parse_value(s);
+    if (!JS_IsException(val) &&
+        json_skip_space(s->p, s->p_end) != s->p_end) {
+        JS_FreeValue(ctx, val);
+        val = JS_EXCEPTION;
+        s->fallback = TRUE;
+    }
+    for(i = 0; i < JSON_SHAPE_CACHE_DEPTH; i++) {
+        if (s->shapes[i])
+            js_free_shape(ctx->rt, s->shapes[i]);
+    }
+    js_free(ctx, s->stack);
+    if (s->fallback)
+        return JS_UNINITIALIZED;
+    return val;
+}
+
 JSValue JS_ParseJSON2(JSContext *ctx, const char *buf, size_t buf_len,
                       const char *filename, int flags)
 {
     JSParseState s1, *s = &s1;
     JSValue val = JS_UNDEFINED;
 
+    if (!(flags & JS_PARSE_JSON_EXT)) {
+        val = json_parse_fast(ctx, buf, buf_len);
+        if (!JS_IsUninitialized(val))
+            return val;
+        val = JS_UNDEFINED;
+    }
     js_parse_init(ctx, s, buf, buf_len, filename);
     s->ext_json = ((flags & JS_PARSE_JSON_EXT) != 0);
     if (json_next_token(s))
@@ -45289,6 +49077,17 @@ static JSValue js_json_parse(JSContext *ctx, JSValueConst this_val,
     return obj;
 }
 
+/* enumerable keys of a shape for the JSON.stringify fast path */
+typedef struct JSONShapeKeys {
+    JSShape *sh;
+    BOOL is_plain; /* no toJSON, accessor or array index property */
+    int count;
+    struct {
+        int prop_idx;
+        JSValue quoted; /* "key": */
+    } keys[0];
+} JSONShapeKeys;
+
 typedef struct JSONStringifyContext {
     JSValueConst replacer_func;
     JSValue stack;
@@ -45296,6 +49095,14 @@ typedef struct JSONStringifyContext {
     JSValue gap;
     JSValue empty;
     StringBuffer *b;
+    /* fast path state */
+    uint32_t gen; /* incremented each time user code may have run */
+    uint32_t protos_gen;
+    BOOL object_proto_plain;
+    BOOL array_proto_plain;
+    JSONShapeKeys **shape_keys; /* hash table indexed by shape */
+    int shape_keys_size;
+    int shape_keys_count;
 } JSONStringifyContext;
 
 static JSValue JS_ToQuotedStringFree(JSContext *ctx, JSValue val) {
@@ -45347,6 +49154,7 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
         if (JS_IsFunction(ctx, val))
             break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
     case JS_TAG_INT:
     case JS_TAG_FLOAT64:
     case JS_TAG_BOOL:
@@ -45524,6 +49332,7 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
  concat_primitive:
     switch (JS_VALUE_GET_NORM_TAG(val)) {
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_ToQuotedStringFree(ctx, val);
         if (JS_IsException(val))
             goto exception;
@@ -45561,6 +49370,389 @@ exception:
     return -1;
 }
 
+/* JSON.stringify fast path, used without replacer and gap. The plain
+   objects and fast arrays are serialized directly from their shape and
+   values. Any other value goes through js_json_check() and
+   js_json_to_str(), and the iteration of the enclosing objects resumes
+   with the generic property accesses if their shape changed meanwhile. */
+
+#define JSON_FAST_MAX_DEPTH 64
+
+/* TRUE if no object of the prototype chain has a toJSON property */
+static BOOL json_fast_proto_is_plain(JSObject *p)
+{
+    JSProperty *pr;
+
+    for(; p != NULL; p = p->shape->proto) {
+        if (p->class_id != JS_CLASS_OBJECT && p->class_id != JS_CLASS_ARRAY)
+            return FALSE;
+        if (find_own_property(&pr, p, JS_ATOM_toJSON))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static void json_fast_update_protos(JSContext *ctx, JSONStringifyContext *jsc)
+{
+    if (jsc->protos_gen != jsc->gen) {
+        jsc->object_proto_plain =
+            json_fast_proto_is_plain(JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_OBJECT]));
+        jsc->array_proto_plain =
+            json_fast_proto_is_plain(JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_ARRAY]));
+        jsc->protos_gen = jsc->gen;
+    }
+}
+
+static JSONShapeKeys *json_fast_new_shape_keys(JSContext *ctx, JSShape *sh)
+{
+    JSONShapeKeys *sk;
+    JSShapeProperty *prs;
+    StringBuffer b_s, *b = &b_s;
+    JSValue str;
+    uint32_t idx;
+    int i, n;
+
+    n = 0;
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        if (prs->atom != JS_ATOM_NULL && (prs->flags & JS_PROP_ENUMERABLE))
+            n++;
+    }
+    sk = js_mallocz(ctx, sizeof(*sk) + sizeof(sk->keys[0]) * n);
+    if (!sk)
+        return NULL;
+    sk->sh = js_dup_shape(sh);
+    sk->is_plain = !sh->has_small_array_index;
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        if (prs->atom == JS_ATOM_NULL)
+            continue;
+        if (prs->atom == JS_ATOM_toJSON)
+            sk->is_plain = FALSE;
+        if (!(prs->flags & JS_PROP_ENUMERABLE) || !sk->is_plain)
+            continue;
+        if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL ||
+            !JS_AtomIsString(ctx, prs->atom) ||
+            JS_AtomIsArrayIndex(ctx, &idx, prs->atom)) {
+            sk->is_plain = FALSE;
+            continue;
+        }
+        str = JS_AtomToString(ctx, prs->atom);
+        if (JS_IsException(str))
+            goto fail;
+        if (string_buffer_init(ctx, b, JS_VALUE_GET_STRING(str)->len + 3) ||
+            string_buffer_put_quoted(b, JS_VALUE_GET_STRING(str)) ||
+            string_buffer_putc8(b, ':')) {
+            JS_FreeValue(ctx, str);
+            string_buffer_free(b);
+            goto fail;
+        }
+        JS_FreeValue(ctx, str);
+        sk->keys[sk->count].prop_idx = i;
+        sk->keys[sk->count].quoted = string_buffer_end(b);
+        if (JS_IsException(sk->keys[sk->count].quoted))
+            goto fail;
+        sk->count++;
+    }
+    return sk;
+ fail:
+    sk->is_plain = FALSE;
+    return sk;
+}
+
+static void json_fast_free_shape_keys(JSRuntime *rt, JSONShapeKeys *sk)
+{
+    int i;
+
+    for(i = 0; i < sk->count; i++)
+        JS_FreeValueRT(rt, sk->keys[i].quoted);
+    js_free_shape(rt, sk->sh);
+    js_free_rt(rt, sk);
+}
+
+static inline uint32_t json_fast_shape_hash(JSShape *sh, int size)
+{
+    return ((uintptr_t)sh >> 4) * 0x9e3779b1u & (size - 1);
+}
+
+/* return the keys of the shape, NULL if exception */
+static JSONShapeKeys *json_fast_get_shape_keys(JSContext *ctx,
+                                               JSONStringifyContext *jsc,
+                                               JSShape *sh)
+{
+    JSONShapeKeys *sk, **tab;
+    int i, h, new_size;
+
+    if (jsc->shape_keys_size) {
+        for(h = json_fast_shape_hash(sh, jsc->shape_keys_size);
+            (sk = jsc->shape_keys[h]) != NULL;
+            h = (h + 1) & (jsc->shape_keys_size - 1)) {
+            if (sk->sh == sh)
+                return sk;
+        }
+    }
+    if (2 * (jsc->shape_keys_count + 1) > jsc->shape_keys_size) {
+        new_size = max_int(16, jsc->shape_keys_size * 2);
+        tab = js_mallocz(ctx, sizeof(tab[0]) * new_size);
+        if (!tab)
+            return NULL;
+        for(i = 0; i < jsc->shape_keys_size; i++) {
+            sk = jsc->shape_keys[i];
+            if (sk) {
+                for(h = json_fast_shape_hash(sk->sh, new_size); tab[h];
+                    h = (h + 1) & (new_size - 1))
+                    continue;
+                tab[h] = sk;
+            }
+        }
+        js_free(ctx, jsc->shape_keys);
+        jsc->shape_keys = tab;
+        jsc->shape_keys_size = new_size;
+    }
+    sk = json_fast_new_shape_keys(ctx, sh);
+    if (!sk)
+        return NULL;
+    for(h = json_fast_shape_hash(sh, jsc->shape_keys_size); jsc->shape_keys[h];
+        h = (h + 1) & (jsc->shape_keys_size - 1))
+        continue;
+    jsc->shape_keys[h] = sk;
+    jsc->shape_keys_count++;
+    return sk;
+}
+
+static void json_fast_free(JSRuntime *rt, JSONStringifyContext *jsc)
+{
+    int i;
+
+    for(i = 0; i < jsc->shape_keys_size; i++) {
+        if (jsc->shape_keys[i])
+            json_fast_free_shape_keys(rt, jsc->shape_keys[i]);
+    }
+    js_free_rt(rt, jsc->shape_keys);
+}
+
+/* return 1 if 'val' is serialized by the fast path, 0 if it must go
+   through js_json_check(), -1 if it is omitted and -2 if exception */
+static int json_fast_kind(JSContext *ctx, JSONStringifyContext *jsc,
+                          JSValueConst val, int depth)
+{
+    JSObject *p;
+    JSShape *sh;
+    JSONShapeKeys *sk;
+
+    switch(JS_VALUE_GET_NORM_TAG(val)) {
+    case JS_TAG_INT:
+    case JS_TAG_FLOAT64:
+    case JS_TAG_BOOL:
+    case JS_TAG_NULL:
+    case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
+        return 1;
+    case JS_TAG_UNDEFINED:
+    case JS_TAG_SYMBOL:
+        return -1;
+    case JS_TAG_OBJECT:
+        if (depth >= JSON_FAST_MAX_DEPTH)
+            return 0;
+        p = JS_VALUE_GET_OBJ(val);
+        sh = p->shape;
+        json_fast_update_protos(ctx, jsc);
+        if (p->class_id == JS_CLASS_ARRAY) {
+            return p->fast_array && sh == ctx->array_shape &&
+                jsc->array_proto_plain &&
+                JS_VALUE_GET_TAG(p->prop[0].u.value) == JS_TAG_INT;
+        } else if (p->class_id == JS_CLASS_OBJECT) {
+            if (sh->proto != NULL &&
+                (sh->proto != JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_OBJECT]) ||
+                 !jsc->object_proto_plain))
+                return 0;
+            sk = json_fast_get_shape_keys(ctx, jsc, sh);
+            if (!sk)
+                return -2;
+            return sk->is_plain;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static int json_fast_to_str(JSContext *ctx, JSONStringifyContext *jsc,
+                            JSValueConst val, int depth);
+
+/* serialize a value which is not handled by the fast path. 'key' is
+   freed. If the value is not omitted, it is preceded by a ',' if 'sep'
+   is TRUE and by 'prefix' if defined. Return 0 if it was omitted, 1 if
+   it was serialized and -1 if exception. */
+static int json_fast_to_str_generic(JSContext *ctx, JSONStringifyContext *jsc,
+                                    JSValueConst holder, JSValue val,
+                                    JSValue key, JSValueConst prefix, BOOL sep)
+{
+    jsc->gen++;
+    if (JS_IsException(key)) {
+        JS_FreeValue(ctx, val);
+        return -1;
+    }
+    val = js_json_check(ctx, jsc, holder, val, key);
+    JS_FreeValue(ctx, key);
+    if (JS_IsException(val))
+        return -1;
+    if (JS_IsUndefined(val))
+        return 0;
+    if (sep)
+        string_buffer_putc8(jsc->b, ',');
+    if (!JS_IsUndefined(prefix))
+        string_buffer_concat_value(jsc->b, prefix);
+    if (js_json_to_str(ctx, jsc, holder, val, jsc->empty))
+        return -1;
+    return 1;
+}
+
+static int json_fast_object_to_str(JSContext *ctx, JSONStringifyContext *jsc,
+                                   JSValueConst obj, int depth)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(obj);
+    JSShape *sh = p->shape;
+    JSONShapeKeys *sk;
+    JSValue v;
+    JSAtom atom;
+    uint32_t gen = jsc->gen;
+    BOOL has_content = FALSE, same_shape = TRUE;
+    int i, kind, ret;
+
+    /* the keys are kept in the hash table until the end */
+    sk = json_fast_get_shape_keys(ctx, jsc, sh);
+    if (!sk)
+        return -1;
+    js_dup_shape(sh);
+    string_buffer_putc8(jsc->b, '{');
+    for(i = 0; i < sk->count; i++) {
+        if (gen != jsc->gen) {
+            /* user code may have modified the object */
+            same_shape = (p->shape == sh);
+            gen = jsc->gen;
+        }
+        if (same_shape) {
+            v = JS_DupValue(ctx, p->prop[sk->keys[i].prop_idx].u.value);
+            kind = json_fast_kind(ctx, jsc, v, depth + 1);
+        } else {
+            atom = get_shape_prop(sh)[sk->keys[i].prop_idx].atom;
+            v = JS_GetProperty(ctx, obj, atom);
+            if (JS_IsException(v))
+                goto exception;
+            kind = 0;
+        }
+        if (kind == 1) {
+            if (has_content)
+                string_buffer_putc8(jsc->b, ',');
+            string_buffer_concat_value(jsc->b, sk->keys[i].quoted);
+            ret = json_fast_to_str(ctx, jsc, v, depth + 1);
+            JS_FreeValue(ctx, v);
+            if (ret < 0)
+                goto exception;
+            has_content = TRUE;
+        } else if (kind == 0) {
+            atom = get_shape_prop(sh)[sk->keys[i].prop_idx].atom;
+            ret = json_fast_to_str_generic(ctx, jsc, obj, v,
+                                           JS_AtomToString(ctx, atom),
+                                           sk->keys[i].quoted, has_content);
+            if (ret < 0)
+                goto exception;
+            if (ret)
+                has_content = TRUE;
+        } else {
+            JS_FreeValue(ctx, v);
+            if (kind == -2)
+                goto exception;
+        }
+    }
+    js_free_shape(ctx->rt, sh);
+    return string_buffer_putc8(jsc->b, '}');
+ exception:
+    js_free_shape(ctx->rt, sh);
+    return -1;
+}
+
+static int json_fast_array_to_str(JSContext *ctx, JSONStringifyContext *jsc,
+                                  JSValueConst obj, int depth)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(obj);
+    JSValue v;
+    uint32_t i, len;
+    int kind, ret;
+
+    len = JS_VALUE_GET_INT(p->prop[0].u.value);
+    string_buffer_putc8(jsc->b, '[');
+    for(i = 0; i < len; i++) {
+        if (i > 0)
+            string_buffer_putc8(jsc->b, ',');
+        if (p->fast_array && i < p->u.array.count) {
+            v = JS_DupValue(ctx, p->u.array.u.values[i]);
+            kind = json_fast_kind(ctx, jsc, v, depth + 1);
+        } else {
+            v = JS_GetPropertyUint32(ctx, obj, i);
+            if (JS_IsException(v))
+                return -1;
+            kind = 0;
+        }
+        if (kind == 1) {
+            ret = json_fast_to_str(ctx, jsc, v, depth + 1);
+            JS_FreeValue(ctx, v);
+        } else if (kind == 0) {
+            ret = json_fast_to_str_generic(ctx, jsc, obj, v,
+                                           JS_ToStringFree(ctx, JS_NewInt32(ctx, i)),
+                                           JS_UNDEFINED, FALSE);
+            if (ret == 0)
+                ret = string_buffer_puts8(jsc->b, "null");
+        } else {
+            JS_FreeValue(ctx, v);
+            if (kind == -2)
+                return -1;
+            ret = string_buffer_puts8(jsc->b, "null");
+        }
+        if (ret < 0)
+            return -1;
+    }
+    return string_buffer_putc8(jsc->b, ']');
+}
+
+/* serialize a value for which json_fast_kind() returned 1 */
+static int json_fast_to_str(JSContext *ctx, JSONStringifyContext *jsc,
+                            JSValueConst val, int depth)
+{
+    char buf[JS_DTOA_BUF_SIZE];
+    JSValueConst str;
+    double d;
+
+    switch(JS_VALUE_GET_NORM_TAG(val)) {
+    case JS_TAG_INT:
+        return string_buffer_puts8(jsc->b,
+                                   i64toa(buf + sizeof(buf) - 1, JS_VALUE_GET_INT(val), 10));
+    case JS_TAG_FLOAT64:
+        d = JS_VALUE_GET_FLOAT64(val);
+        if (!isfinite(d))
+            return string_buffer_puts8(jsc->b, "null");
+        js_dtoa1(&buf, d, 10, 0, JS_DTOA_VAR_FORMAT);
+        return string_buffer_puts8(jsc->b, buf);
+    case JS_TAG_BOOL:
+        return string_buffer_puts8(jsc->b, JS_VALUE_GET_BOOL(val) ? "true" : "false");
+    case JS_TAG_NULL:
+        return string_buffer_puts8(jsc->b, "null");
+    case JS_TAG_STRING:
+        return string_buffer_put_quoted(jsc->b, JS_VALUE_GET_STRING(val));
+    case JS_TAG_STRING_ROPE:
+        str = js_string_rope_flatten(ctx, val);
+        if (JS_IsException(str))
+            return -1;
+        return string_buffer_put_quoted(jsc->b, JS_VALUE_GET_STRING(str));
+    case JS_TAG_OBJECT:
+        if (JS_VALUE_GET_OBJ(val)->class_id == JS_CLASS_ARRAY)
+            return json_fast_array_to_str(ctx, jsc, val, depth);
+        else
+            return json_fast_object_to_str(ctx, jsc, val, depth);
+    default:
+        abort();
+    }
+}
+
 JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
                          JSValueConst replacer, JSValueConst space0)
 {
@@ -45576,6 +49768,11 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
     jsc->gap = JS_UNDEFINED;
     jsc->b = &b_s;
     jsc->empty = JS_AtomToString(ctx, JS_ATOM_empty_string);
+    jsc->gen = 0;
+    jsc->protos_gen = -1;
+    jsc->shape_keys = NULL;
+    jsc->shape_keys_size = 0;
+    jsc->shape_keys_count = 0;
     ret = JS_UNDEFINED;
     wrapper = JS_UNDEFINED;
 
@@ -45653,7 +49850,11 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
             goto exception;
         jsc->gap = JS_NewStringLen(ctx, "          ", n);
     } else if (JS_IsString(space)) {
-        JSString *p = JS_VALUE_GET_STRING(space);
+        JSString *p;
+        space = js_flatten_string(ctx, space);
+        if (JS_IsException(space))
+            goto exception;
+        p = JS_VALUE_GET_STRING(space);
         jsc->gap = js_sub_string(ctx, p, 0, min_int(p->len, 10));
     } else {
         jsc->gap = JS_DupValue(ctx, jsc->empty);
@@ -45661,6 +49862,21 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
     JS_FreeValue(ctx, space);
     if (JS_IsException(jsc->gap))
         goto exception;
+    if (JS_IsUndefined(jsc->replacer_func) &&
+        JS_IsUndefined(jsc->property_list) &&
+        JS_IsEmptyString(jsc->gap)) {
+        res = json_fast_kind(ctx, jsc, obj, 0);
+        if (res == -2)
+            goto exception;
+        if (res == -1)
+            goto done1;
+        if (res == 1) {
+            if (json_fast_to_str(ctx, jsc, obj, 0))
+                goto exception;
+            ret = string_buffer_end(jsc->b);
+            goto done;
+        }
+    }
     wrapper = JS_NewObject(ctx);
     if (JS_IsException(wrapper))
         goto exception;
@@ -45687,6 +49903,7 @@ exception:
 done1:
     string_buffer_free(jsc->b);
 done:
+    json_fast_free(ctx->rt, jsc);
     JS_FreeValue(ctx, wrapper);
     JS_FreeValue(ctx, jsc->empty);
     JS_FreeValue(ctx, jsc->gap);
@@ -46976,22 +51193,29 @@ static const JSCFunctionListEntry js_symbol_funcs[] = {
 typedef struct JSMapRecord {
     int ref_count; /* used during enumeration to avoid freeing the record */
     BOOL empty; /* TRUE if the record is deleted */
+    uint32_t hash;
     struct JSMapState *map;
     struct JSMapRecord *next_weak_ref;
     struct list_head link;
-    struct list_head hash_link;
     JSValue key;
     JSValue value;
 } JSMapRecord;
 
+/* The records are indexed by an open addressing hash table with
+   linear probing. The hash is kept in the slot so that the probes do
+   not access the records. The deletion moves back the following
+   slots of the cluster, hence there are no tombstones. */
+typedef struct JSMapHashSlot {
+    JSMapRecord *mr; /* NULL if the slot is free */
+    uint32_t hash;
+} JSMapHashSlot;
+
 typedef struct JSMapState {
     BOOL is_weak; /* TRUE if WeakSet/WeakMap */
     struct list_head records; /* list of JSMapRecord.link */
     uint32_t record_count;
-    struct list_head *hash_table;
-    uint32_t hash_size; /* must be a power of two */
-    uint32_t record_count_threshold; /* count at which a hash table
-                                        resize is needed */
+    JSMapHashSlot *hash_table; /* NULL if no record was added */
+    uint32_t hash_size; /* 0 or a power of two, at most half full */
 } JSMapState;
 
 #define MAGIC_SET (1 << 0)
@@ -47016,12 +51240,6 @@ static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
     init_list_head(&s->records);
     s->is_weak = is_weak;
     JS_SetOpaque(obj, s);
-    s->hash_size = 1;
-    s->hash_table = js_malloc(ctx, sizeof(s->hash_table[0]) * s->hash_size);
-    if (!s->hash_table)
-        goto fail;
-    init_list_head(&s->hash_table[0]);
-    s->record_count_threshold = 4;
 
     arr = JS_UNDEFINED;
     if (argc > 0)
@@ -47108,21 +51326,35 @@ static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
 }
 
 /* XXX: could normalize strings to speed up comparison */
+/* return JS_EXCEPTION if a rope cannot be flattened */
 static JSValueConst map_normalize_key(JSContext *ctx, JSValueConst key)
 {
     uint32_t tag = JS_VALUE_GET_TAG(key);
     /* convert -0.0 to +0.0 */
     if (JS_TAG_IS_FLOAT64(tag) && JS_VALUE_GET_FLOAT64(key) == 0.0) {
         key = JS_NewInt32(ctx, 0);
+    } else if (tag == JS_TAG_STRING_ROPE) {
+        /* the keys are hashed as flat strings */
+        key = js_string_rope_flatten(ctx, key);
     }
     return key;
 }
 
-/* XXX: better hash ? */
-static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
+static inline uint32_t map_hash_mix(uint64_t h)
+{
+    /* finalizer of MurmurHash3 */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+static uint32_t map_hash_key(JSValueConst key)
 {
     uint32_t tag = JS_VALUE_GET_NORM_TAG(key);
-    uint32_t h;
+    uint64_t h;
     double d;
     JSFloat64Union u;
 
@@ -47135,7 +51367,7 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
         break;
     case JS_TAG_OBJECT:
     case JS_TAG_SYMBOL:
-        h = (uintptr_t)JS_VALUE_GET_PTR(key) * 3163;
+        h = (uintptr_t)JS_VALUE_GET_PTR(key);
         break;
     case JS_TAG_INT:
         d = JS_VALUE_GET_INT(key);
@@ -47147,70 +51379,142 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
             d = JS_FLOAT64_NAN;
     hash_float64:
         u.d = d;
-        h = (u.u32[0] ^ u.u32[1]) * 3163;
-        return h ^= JS_TAG_FLOAT64;
+        tag = JS_TAG_FLOAT64;
+        h = u.u64;
+        break;
+    case JS_TAG_BIG_INT:
+        {
+            /* equal values have the same exponent and most
+               significant limb */
+            JSBigFloat *p = JS_VALUE_GET_PTR(key);
+            h = p->num.expn;
+            if (p->num.len != 0)
+                h = (h * 2 + p->num.sign) ^ p->num.tab[p->num.len - 1];
+        }
+        break;
     default:
-        h = 0; /* XXX: bignum support */
+        h = 0;
         break;
     }
-    h ^= tag;
-    return h;
+    return map_hash_mix(h ^ ((uint64_t)tag << 32));
 }
 
 static JSMapRecord *map_find_record(JSContext *ctx, JSMapState *s,
                                     JSValueConst key)
 {
-    struct list_head *el;
-    JSMapRecord *mr;
-    uint32_t h;
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_for_each(el, &s->hash_table[h]) {
-        mr = list_entry(el, JSMapRecord, hash_link);
-        if (js_same_value_zero(ctx, mr->key, key))
-            return mr;
+    JSMapHashSlot *sl;
+    uint32_t h, i;
+
+    if (s->hash_size == 0)
+        return NULL;
+    h = map_hash_key(key);
+    for(i = h & (s->hash_size - 1);; i = (i + 1) & (s->hash_size - 1)) {
+        sl = &s->hash_table[i];
+        if (!sl->mr)
+            return NULL;
+        if (sl->hash == h && js_same_value_zero(ctx, sl->mr->key, key))
+            return sl->mr;
     }
-    return NULL;
 }
 
-static void map_hash_resize(JSContext *ctx, JSMapState *s)
+static void map_hash_insert(JSMapHashSlot *hash_table, uint32_t hash_size,
+                            JSMapRecord *mr)
 {
-    uint32_t new_hash_size, i, h;
-    size_t slack;
-    struct list_head *new_hash_table, *el;
-    JSMapRecord *mr;
+    uint32_t i;
 
-    /* XXX: no reporting of memory allocation failure */
-    if (s->hash_size == 1)
-        new_hash_size = 4;
-    else
-        new_hash_size = s->hash_size * 2;
-    new_hash_table = js_realloc2(ctx, s->hash_table,
-                                 sizeof(new_hash_table[0]) * new_hash_size, &slack);
-    if (!new_hash_table)
-        return;
-    new_hash_size += slack / sizeof(*new_hash_table);
+    for(i = mr->hash & (hash_size - 1); hash_table[i].mr;
+        i = (i + 1) & (hash_size - 1))
+        continue;
+    hash_table[i].mr = mr;
+    hash_table[i].hash = mr->hash;
+}
 
-    for(i = 0; i < new_hash_size; i++)
-        init_list_head(&new_hash_table[i]);
+/* remove 'mr' from the hash table */
+static void map_hash_remove(JSMapState *s, JSMapRecord *mr)
+{
+    uint32_t mask = s->hash_size - 1;
+    uint32_t i, j, k;
 
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            h = map_hash_key(ctx, mr->key) & (new_hash_size - 1);
-            list_add_tail(&mr->hash_link, &new_hash_table[h]);
+    for(i = mr->hash & mask; s->hash_table[i].mr != mr; i = (i + 1) & mask)
+        continue;
+    /* move back the slots of the cluster which would no longer be
+       reachable from their hash */
+    for(j = i;;) {
+        j = (j + 1) & mask;
+        if (!s->hash_table[j].mr)
+            break;
+        k = s->hash_table[j].hash & mask;
+        if (((j - k) & mask) >= ((j - i) & mask)) {
+            s->hash_table[i] = s->hash_table[j];
+            i = j;
         }
     }
+    s->hash_table[i].mr = NULL;
+}
+
+static void map_hash_rebuild(JSMapState *s, JSMapHashSlot *new_hash_table,
+                             uint32_t new_hash_size)
+{
+    uint32_t i;
+
+    memset(new_hash_table, 0, sizeof(new_hash_table[0]) * new_hash_size);
+    for(i = 0; i < s->hash_size; i++) {
+        if (s->hash_table[i].mr)
+            map_hash_insert(new_hash_table, new_hash_size, s->hash_table[i].mr);
+    }
+}
+
+/* shrink the hash table if the map has lost most of its records */
+static void map_hash_trim(JSRuntime *rt, JSMapState *s)
+{
+    uint32_t new_hash_size;
+    JSMapHashSlot *new_hash_table;
+
+    if (s->record_count == 0) {
+        js_free_rt(rt, s->hash_table);
+        s->hash_table = NULL;
+        s->hash_size = 0;
+        return;
+    }
+    new_hash_size = 4;
+    while (new_hash_size < 2 * s->record_count)
+        new_hash_size *= 2;
+    if (s->hash_size < 4 * new_hash_size)
+        return;
+    new_hash_table = js_malloc_rt(rt, sizeof(new_hash_table[0]) * new_hash_size);
+    if (!new_hash_table)
+        return;
+    map_hash_rebuild(s, new_hash_table, new_hash_size);
+    js_free_rt(rt, s->hash_table);
     s->hash_table = new_hash_table;
     s->hash_size = new_hash_size;
-    s->record_count_threshold = new_hash_size * 2;
+}
+
+static int map_hash_resize(JSContext *ctx, JSMapState *s)
+{
+    uint32_t new_hash_size;
+    JSMapHashSlot *new_hash_table;
+
+    new_hash_size = max_int(4, s->hash_size * 2);
+    new_hash_table = js_malloc(ctx, sizeof(new_hash_table[0]) * new_hash_size);
+    if (!new_hash_table)
+        return -1;
+    map_hash_rebuild(s, new_hash_table, new_hash_size);
+    js_free(ctx, s->hash_table);
+    s->hash_table = new_hash_table;
+    s->hash_size = new_hash_size;
+    return 0;
 }
 
 static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
                                    JSValueConst key)
 {
-    uint32_t h;
     JSMapRecord *mr;
 
+    if (2 * (s->record_count + 1) > s->hash_size) {
+        if (map_hash_resize(ctx, s))
+            return NULL;
+    }
     mr = js_malloc(ctx, sizeof(*mr));
     if (!mr)
         return NULL;
@@ -47226,13 +51530,10 @@ static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
         JS_DupValue(ctx, key);
     }
     mr->key = (JSValue)key;
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_add_tail(&mr->hash_link, &s->hash_table[h]);
+    mr->hash = map_hash_key(key);
+    map_hash_insert(s->hash_table, s->hash_size, mr);
     list_add_tail(&mr->link, &s->records);
     s->record_count++;
-    if (s->record_count >= s->record_count_threshold) {
-        map_hash_resize(ctx, s);
-    }
     return mr;
 }
 
@@ -47261,7 +51562,7 @@ static void map_delete_record(JSRuntime *rt, JSMapState *s, JSMapRecord *mr)
 {
     if (mr->empty)
         return;
-    list_del(&mr->hash_link);
+    map_hash_remove(s, mr);
     if (s->is_weak) {
         delete_weak_ref(rt, mr);
     } else {
@@ -47301,8 +51602,9 @@ static void reset_weak_ref(JSRuntime *rt, JSObject *p)
         s = mr->map;
         assert(s->is_weak);
         assert(!mr->empty); /* no iterator on WeakMap/WeakSet */
-        list_del(&mr->hash_link);
+        map_hash_remove(s, mr);
         list_del(&mr->link);
+        s->record_count--;
     }
 
     /* second pass to free the values to avoid modifying the weak
@@ -47326,6 +51628,8 @@ static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
+    if (JS_IsException(key))
+        return JS_EXCEPTION;
     if (s->is_weak && !JS_IsObject(key))
         return JS_ThrowTypeErrorNotAnObject(ctx);
     if (magic & MAGIC_SET)
@@ -47354,6 +51658,8 @@ static JSValue js_map_get(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
+    if (JS_IsException(key))
+        return JS_EXCEPTION;
     mr = map_find_record(ctx, s, key);
     if (!mr)
         return JS_UNDEFINED;
@@ -47371,6 +51677,8 @@ static JSValue js_map_has(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
+    if (JS_IsException(key))
+        return JS_EXCEPTION;
     mr = map_find_record(ctx, s, key);
     return JS_NewBool(ctx, mr != NULL);
 }
@@ -47385,6 +51693,8 @@ static JSValue js_map_delete(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
+    if (JS_IsException(key))
+        return JS_EXCEPTION;
     mr = map_find_record(ctx, s, key);
     if (!mr)
         return JS_FALSE;
@@ -50997,6 +55307,7 @@ static JSValue JS_ToBigIntCtorFree(JSContext *ctx, JSValue val)
         goto redo;
 #endif
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_StringToBigIntErr(ctx, val);
         break;
     case JS_TAG_OBJECT:
@@ -51557,6 +55868,7 @@ static JSValue js_bigfloat_constructor(JSContext *ctx,
                 break;
             goto redo;
         case JS_TAG_STRING:
+        case JS_TAG_STRING_ROPE:
             {
                 const char *str, *p;
                 size_t len;
@@ -52245,6 +56557,7 @@ static JSValue JS_ToBigDecimalFree(JSContext *ctx, JSValue val,
             break;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str, *p;
             size_t len;
@@ -52778,6 +57091,8 @@ void JS_AddIntrinsicBaseObjects(JSContext *ctx)
 
     ctx->global_obj = JS_NewObject(ctx);
     ctx->global_var_obj = JS_NewObjectProto(ctx, JS_NULL);
+    js_set_global_shape(ctx, ctx->global_obj);
+    js_set_global_shape(ctx, ctx->global_var_obj);
 
     /* Object */
     obj = JS_NewGlobalCConstructor(ctx, "Object", js_object_constructor, 1,
@@ -52867,6 +57182,9 @@ void JS_AddIntrinsicBaseObjects(JSContext *ctx)
     JS_SetPropertyFunctionList(ctx, ctx->class_proto[JS_CLASS_ARRAY_ITERATOR],
                                js_array_iterator_proto_funcs,
                                countof(js_array_iterator_proto_funcs));
+    /* needed to iterate over the arrays without iterator object */
+    ctx->array_iterator_next =
+        JS_GetProperty(ctx, ctx->class_proto[JS_CLASS_ARRAY_ITERATOR], JS_ATOM_next);
 
     /* parseFloat and parseInteger must be defined before Number
        because of the Number.parseFloat and Number.parseInteger
@@ -53480,6 +57798,408 @@ static JSValue js_typed_array_get_toStringTag(JSContext *ctx,
     return JS_AtomToString(ctx, ctx->rt->class_array[p->class_id].class_name);
 }
 
+/* Bulk typed array kernels. The SIMD versions process TA_BLOCK_SIZE
+   bytes at a time, the remaining elements use scalar code. */
+
+#if defined(__AVX2__)
+#define TA_BLOCK_SIZE 32
+#elif defined(__SSE2__)
+#define TA_BLOCK_SIZE 16
+#endif
+
+/* store 'count' times the element 'v64' of 1 << shift bytes at 'p' */
+static void js_TA_fill(uint8_t *p, uint64_t v64, int shift, size_t count)
+{
+    size_t i, n;
+
+    if (shift == 0) {
+        memset(p, v64, count);
+        return;
+    }
+    /* replicate the element in 64 bits */
+    if (shift == 1)
+        v64 = (v64 & 0xffff) * UINT64_C(0x0001000100010001);
+    else if (shift == 2)
+        v64 = (v64 & 0xffffffff) * UINT64_C(0x0000000100000001);
+    n = count << shift;
+    i = 0;
+#if defined(__AVX2__)
+    {
+        __m256i v = _mm256_set1_epi64x(v64);
+        for(; i + 32 <= n; i += 32)
+            _mm256_storeu_si256((__m256i *)(p + i), v);
+    }
+#elif defined(__SSE2__)
+    {
+        __m128i v = _mm_set1_epi64x(v64);
+        for(; i + 16 <= n; i += 16)
+            _mm_storeu_si128((__m128i *)(p + i), v);
+    }
+#endif
+    for(; i + 8 <= n; i += 8)
+        put_u64(p + i, v64);
+    /* i is a multiple of 8, so the pattern starts with an element */
+    memcpy(p + i, &v64, n - i);
+}
+
+#ifdef TA_BLOCK_SIZE
+/* bit i is set if the byte i of the TA_BLOCK_SIZE bytes at 'p' is
+   equal to the byte i of the replicated pattern 'v64' and the next
+   (1 << shift) - 1 bytes are equal too */
+static inline uint32_t js_TA_block_eq_mask(const uint8_t *p, uint64_t v64,
+                                           int shift)
+{
+    uint32_t m;
+#if defined(__AVX2__)
+    m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p),
+                                               _mm256_set1_epi64x(v64)));
+#else
+    m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p),
+                                         _mm_set1_epi64x(v64)));
+#endif
+    if (shift >= 1)
+        m &= m >> 1;
+    if (shift >= 2)
+        m &= m >> 2;
+    if (shift >= 3)
+        m &= m >> 4;
+    /* keep the first byte of each element */
+    switch(shift) {
+    case 1:
+        m &= 0x55555555;
+        break;
+    case 2:
+        m &= 0x11111111;
+        break;
+    case 3:
+        m &= 0x01010101;
+        break;
+    }
+    return m;
+}
+
+/* bit i is set if the float32 (is_f32) or float64 element i of the
+   block at 'p' is equal to 'd', or is a NaN if 'is_nan' is TRUE */
+static inline uint32_t js_TA_block_float_mask(const uint8_t *p, double d,
+                                              BOOL is_f32, BOOL is_nan)
+{
+#if defined(__AVX2__)
+    if (is_f32) {
+        __m256 a = _mm256_loadu_ps((const float *)p);
+        if (is_nan)
+            return _mm256_movemask_ps(_mm256_cmp_ps(a, a, _CMP_UNORD_Q));
+        return _mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_set1_ps(d), _CMP_EQ_OQ));
+    } else {
+        __m256d a = _mm256_loadu_pd((const double *)p);
+        if (is_nan)
+            return _mm256_movemask_pd(_mm256_cmp_pd(a, a, _CMP_UNORD_Q));
+        return _mm256_movemask_pd(_mm256_cmp_pd(a, _mm256_set1_pd(d), _CMP_EQ_OQ));
+    }
+#else
+    if (is_f32) {
+        __m128 a = _mm_loadu_ps((const float *)p);
+        if (is_nan)
+            return _mm_movemask_ps(_mm_cmpunord_ps(a, a));
+        return _mm_movemask_ps(_mm_cmpeq_ps(a, _mm_set1_ps(d)));
+    } else {
+        __m128d a = _mm_loadu_pd((const double *)p);
+        if (is_nan)
+            return _mm_movemask_pd(_mm_cmpunord_pd(a, a));
+        return _mm_movemask_pd(_mm_cmpeq_pd(a, _mm_set1_pd(d)));
+    }
+#endif
+}
+#endif /* TA_BLOCK_SIZE */
+
+/* Return the index of the first (inc = 1) or last (inc = -1) element
+   of 1 << shift bytes equal to 'v64' in [k, stop) or (stop, k], or -1. */
+static int js_TA_find_bits(const uint8_t *tab, int k, int stop, int inc,
+                           uint64_t v64, int shift)
+{
+    if (shift == 0 && inc > 0) {
+        /* memchr() is vectorized by the C library */
+        const uint8_t *q = memchr(tab + k, (uint8_t)v64, stop - k);
+        return q ? q - tab : -1;
+    }
+#ifdef TA_BLOCK_SIZE
+    {
+        int n = TA_BLOCK_SIZE >> shift;
+        uint64_t pattern;
+        uint32_t mask;
+
+        if (shift == 0)
+            pattern = (v64 & 0xff) * UINT64_C(0x0101010101010101);
+        else if (shift == 1)
+            pattern = (v64 & 0xffff) * UINT64_C(0x0001000100010001);
+        else if (shift == 2)
+            pattern = (v64 & 0xffffffff) * UINT64_C(0x0000000100000001);
+        else
+            pattern = v64;
+        if (inc > 0) {
+            for(; k + n <= stop; k += n) {
+                mask = js_TA_block_eq_mask(tab + ((size_t)k << shift), pattern, shift);
+                if (mask)
+                    return k + (ctz32(mask) >> shift);
+            }
+        } else {
+            for(; k - n >= stop; k -= n) {
+                mask = js_TA_block_eq_mask(tab + ((size_t)(k - n + 1) << shift), pattern, shift);
+                if (mask)
+                    return k - n + 1 + ((31 - clz32(mask)) >> shift);
+            }
+        }
+    }
+#endif
+    switch(shift) {
+    case 0:
+        for(; k != stop; k += inc) {
+            if (tab[k] == (uint8_t)v64)
+                return k;
+        }
+        break;
+    case 1:
+        for(; k != stop; k += inc) {
+            if (((const uint16_t *)tab)[k] == (uint16_t)v64)
+                return k;
+        }
+        break;
+    case 2:
+        for(; k != stop; k += inc) {
+            if (((const uint32_t *)tab)[k] == (uint32_t)v64)
+                return k;
+        }
+        break;
+    default:
+        for(; k != stop; k += inc) {
+            if (((const uint64_t *)tab)[k] == v64)
+                return k;
+        }
+        break;
+    }
+    return -1;
+}
+
+/* same as js_TA_find_bits() for float32 (is_f32) or float64 elements
+   equal to 'd'. If 'd' is NaN, the NaN elements are searched. */
+static int js_TA_find_float(const uint8_t *tab, int k, int stop, int inc,
+                            double d, BOOL is_f32)
+{
+    BOOL is_nan = isnan(d);
+#ifdef TA_BLOCK_SIZE
+    {
+        int shift = is_f32 ? 2 : 3;
+        int n = TA_BLOCK_SIZE >> shift;
+        uint32_t mask;
+
+        if (inc > 0) {
+            for(; k + n <= stop; k += n) {
+                mask = js_TA_block_float_mask(tab + ((size_t)k << shift), d, is_f32, is_nan);
+                if (mask)
+                    return k + ctz32(mask);
+            }
+        } else {
+            for(; k - n >= stop; k -= n) {
+                mask = js_TA_block_float_mask(tab + ((size_t)(k - n + 1) << shift), d, is_f32, is_nan);
+                if (mask)
+                    return k - n + 1 + (31 - clz32(mask));
+            }
+        }
+    }
+#endif
+    if (is_f32) {
+        const float *pv = (const float *)tab;
+        float f = d;
+        for(; k != stop; k += inc) {
+            if (is_nan ? isnan(pv[k]) : pv[k] == f)
+                return k;
+        }
+    } else {
+        const double *pv = (const double *)tab;
+        for(; k != stop; k += inc) {
+            if (is_nan ? isnan(pv[k]) : pv[k] == d)
+                return k;
+        }
+    }
+    return -1;
+}
+
+/* number of elements converted at once between typed arrays of
+   different types */
+#define TA_CONVERT_CHUNK 256
+
+/* load 'len' elements of class 'class_id' as float64 */
+static void js_TA_load_float64(double *d, const uint8_t *src, int class_id,
+                               int len)
+{
+    int i = 0;
+
+    switch(class_id) {
+    case JS_CLASS_UINT8C_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        for(; i < len; i++)
+            d[i] = src[i];
+        break;
+    case JS_CLASS_INT8_ARRAY:
+        for(; i < len; i++)
+            d[i] = (int8_t)src[i];
+        break;
+    case JS_CLASS_INT16_ARRAY:
+        for(; i < len; i++)
+            d[i] = ((const int16_t *)src)[i];
+        break;
+    case JS_CLASS_UINT16_ARRAY:
+        for(; i < len; i++)
+            d[i] = ((const uint16_t *)src)[i];
+        break;
+    case JS_CLASS_INT32_ARRAY:
+#if defined(__AVX2__)
+        for(; i + 4 <= len; i += 4) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + i * 4));
+            _mm256_storeu_pd(d + i, _mm256_cvtepi32_pd(a));
+        }
+#elif defined(__SSE2__)
+        for(; i + 2 <= len; i += 2) {
+            __m128i a = _mm_loadl_epi64((const __m128i *)(src + i * 4));
+            _mm_storeu_pd(d + i, _mm_cvtepi32_pd(a));
+        }
+#endif
+        for(; i < len; i++)
+            d[i] = ((const int32_t *)src)[i];
+        break;
+    case JS_CLASS_UINT32_ARRAY:
+        for(; i < len; i++)
+            d[i] = ((const uint32_t *)src)[i];
+        break;
+    case JS_CLASS_FLOAT32_ARRAY:
+#if defined(__AVX2__)
+        for(; i + 4 <= len; i += 4) {
+            __m128 a = _mm_loadu_ps((const float *)(src + i * 4));
+            _mm256_storeu_pd(d + i, _mm256_cvtps_pd(a));
+        }
+#elif defined(__SSE2__)
+        for(; i + 2 <= len; i += 2) {
+            __m128 a = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)(src + i * 4)));
+            _mm_storeu_pd(d + i, _mm_cvtps_pd(a));
+        }
+#endif
+        for(; i < len; i++)
+            d[i] = ((const float *)src)[i];
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        memcpy(d, src, len * sizeof(d[0]));
+        break;
+    default:
+        abort();
+    }
+}
+
+/* store 'len' float64 values as elements of class 'class_id' */
+static void js_TA_store_float64(uint8_t *dst, int class_id, const double *d,
+                                int len)
+{
+    int i = 0;
+
+    switch(class_id) {
+    case JS_CLASS_UINT8C_ARRAY:
+        for(; i < len; i++) {
+            if (isnan(d[i]) || d[i] < 0)
+                dst[i] = 0;
+            else if (d[i] > 255)
+                dst[i] = 255;
+            else
+                dst[i] = lrint(d[i]);
+        }
+        break;
+    case JS_CLASS_INT8_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        for(; i < len; i++)
+            dst[i] = js_float64_to_int32(d[i]);
+        break;
+    case JS_CLASS_INT16_ARRAY:
+    case JS_CLASS_UINT16_ARRAY:
+        for(; i < len; i++)
+            ((uint16_t *)dst)[i] = js_float64_to_int32(d[i]);
+        break;
+    case JS_CLASS_INT32_ARRAY:
+    case JS_CLASS_UINT32_ARRAY:
+        /* the SIMD conversion returns INT32_MIN for the values out of
+           the int32 range: they are converted again by the scalar
+           code */
+#if defined(__AVX2__)
+        for(; i + 4 <= len; i += 4) {
+            __m128i a = _mm256_cvttpd_epi32(_mm256_loadu_pd(d + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, _mm_set1_epi32(INT32_MIN))))
+                break;
+            _mm_storeu_si128((__m128i *)(dst + i * 4), a);
+        }
+#elif defined(__SSE2__)
+        for(; i + 2 <= len; i += 2) {
+            __m128i a = _mm_cvttpd_epi32(_mm_loadu_pd(d + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, _mm_set1_epi32(INT32_MIN))) & 0xff)
+                break;
+            _mm_storel_epi64((__m128i *)(dst + i * 4), a);
+        }
+#endif
+        for(; i < len; i++)
+            ((uint32_t *)dst)[i] = js_float64_to_int32(d[i]);
+        break;
+    case JS_CLASS_FLOAT32_ARRAY:
+#if defined(__AVX2__)
+        for(; i + 4 <= len; i += 4)
+            _mm_storeu_ps((float *)(dst + i * 4), _mm256_cvtpd_ps(_mm256_loadu_pd(d + i)));
+#elif defined(__SSE2__)
+        for(; i + 2 <= len; i += 2) {
+            __m128 a = _mm_cvtpd_ps(_mm_loadu_pd(d + i));
+            _mm_storel_epi64((__m128i *)(dst + i * 4), _mm_castps_si128(a));
+        }
+#endif
+        for(; i < len; i++)
+            ((float *)dst)[i] = d[i];
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        memcpy(dst, d, len * sizeof(d[0]));
+        break;
+    default:
+        abort();
+    }
+}
+
+static inline BOOL typed_array_is_bigint(int class_id)
+{
+    return class_id == JS_CLASS_BIG_INT64_ARRAY ||
+        class_id == JS_CLASS_BIG_UINT64_ARRAY;
+}
+
+/* Copy 'len' elements of class 'src_class' to elements of class
+   'dst_class' with the same result as a Get followed by a Set of each
+   element. Both classes must be BigInt arrays or both must be Number
+   arrays. The source and the destination must not overlap. */
+static void js_TA_convert(uint8_t *dst, int dst_class,
+                          const uint8_t *src, int src_class, int len)
+{
+    double buf[TA_CONVERT_CHUNK];
+    int shift, n;
+
+    shift = typed_array_size_log2(dst_class);
+    if (shift == typed_array_size_log2(src_class) &&
+        dst_class < JS_CLASS_FLOAT32_ARRAY &&
+        src_class < JS_CLASS_FLOAT32_ARRAY &&
+        !(dst_class == JS_CLASS_UINT8C_ARRAY &&
+          src_class == JS_CLASS_INT8_ARRAY)) {
+        /* integers of the same size are converted modulo 2^n */
+        memcpy(dst, src, (size_t)len << shift);
+        return;
+    }
+    while (len > 0) {
+        n = min_int(len, TA_CONVERT_CHUNK);
+        js_TA_load_float64(buf, src, src_class, n);
+        js_TA_store_float64(dst, dst_class, buf, n);
+        src += (size_t)n << typed_array_size_log2(src_class);
+        dst += (size_t)n << shift;
+        len -= n;
+    }
+}
+
 static JSValue js_typed_array_set_internal(JSContext *ctx,
                                            JSValueConst dst,
                                            JSValueConst src,
@@ -53529,11 +58249,26 @@ static JSValue js_typed_array_set_internal(JSContext *ctx,
                     src_abuf->data + src_ta->offset, src_len << shift);
             goto done;
         }
-        if (dest_abuf->data == src_abuf->data) {
-            /* copying between the same buffer using different types of mappings
-               would require a temporary buffer */
+        if (typed_array_is_bigint(src_p->class_id) ==
+            typed_array_is_bigint(p->class_id)) {
+            uint8_t *src_ptr, *tmp = NULL;
+            int src_shift = typed_array_size_log2(src_p->class_id);
+            src_ptr = src_abuf->data + src_ta->offset;
+            if (dest_abuf->data == src_abuf->data) {
+                /* copying between the same buffer using different
+                   types of mappings requires a temporary buffer */
+                tmp = js_malloc(ctx, max_int(src_len << src_shift, 1));
+                if (!tmp)
+                    goto fail;
+                memcpy(tmp, src_ptr, src_len << src_shift);
+                src_ptr = tmp;
+            }
+            js_TA_convert(dest_abuf->data + dest_ta->offset + (offset << shift),
+                          p->class_id, src_ptr, src_p->class_id, src_len);
+            js_free(ctx, tmp);
+            goto done;
         }
-        /* otherwise, default behavior is slow but correct */
+        /* otherwise, the conversion throws a TypeError */
     } else {
         if (js_get_length64(ctx, &src_len, src_obj))
             goto fail;
@@ -53777,7 +58512,7 @@ static JSValue js_typed_array_from(JSContext *ctx, JSValueConst this_val,
         if (JS_IsException(arr))
             goto exception;
         stack[0] = JS_DupValue(ctx, items);
-        if (js_for_of_start(ctx, &stack[1], FALSE))
+        if (js_for_of_start(ctx, &stack[1], FALSE, FALSE))
             goto exception;
         for (k = 0;; k++) {
             v = JS_IteratorNext(ctx, stack[0], stack[1], 0, NULL, &done);
@@ -53947,30 +58682,9 @@ static JSValue js_typed_array_fill(JSContext *ctx, JSValueConst this_val,
         return JS_ThrowTypeErrorDetachedArrayBuffer(ctx);
 
     shift = typed_array_size_log2(p->class_id);
-    switch(shift) {
-    case 0:
-        if (k < final) {
-            memset(p->u.array.u.uint8_ptr + k, v64, final - k);
-        }
-        break;
-    case 1:
-        for(; k < final; k++) {
-            p->u.array.u.uint16_ptr[k] = v64;
-        }
-        break;
-    case 2:
-        for(; k < final; k++) {
-            p->u.array.u.uint32_ptr[k] = v64;
-        }
-        break;
-    case 3:
-        for(; k < final; k++) {
-            p->u.array.u.uint64_ptr[k] = v64;
-        }
-        break;
-    default:
-        abort();
-    }
+    if (k < final)
+        js_TA_fill(p->u.array.u.uint8_ptr + ((size_t)k << shift), v64, shift,
+                   final - k);
     return JS_DupValue(ctx, this_val);
 }
 
@@ -54047,7 +58761,6 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
     int len, tag, is_int, is_bigint, k, stop, inc, res = -1;
     int64_t v64;
     double d;
-    float f;
 
     len = js_typed_array_get_length_internal(ctx, this_val);
     if (len < 0)
@@ -54133,137 +58846,56 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
     switch (p->class_id) {
     case JS_CLASS_INT8_ARRAY:
         if (is_int && (int8_t)v64 == v64)
-            goto scan8;
+            goto scan;
         break;
     case JS_CLASS_UINT8C_ARRAY:
     case JS_CLASS_UINT8_ARRAY:
-        if (is_int && (uint8_t)v64 == v64) {
-            const uint8_t *pv, *pp;
-            uint16_t v;
-        scan8:
-            pv = p->u.array.u.uint8_ptr;
-            v = v64;
-            if (inc > 0) {
-                pp = memchr(pv + k, v, len - k);
-                if (pp)
-                    res = pp - pv;
-            } else {
-                for (; k != stop; k += inc) {
-                    if (pv[k] == v) {
-                        res = k;
-                        break;
-                    }
-                }
-            }
-        }
+        if (is_int && (uint8_t)v64 == v64)
+            goto scan;
         break;
     case JS_CLASS_INT16_ARRAY:
         if (is_int && (int16_t)v64 == v64)
-            goto scan16;
+            goto scan;
         break;
     case JS_CLASS_UINT16_ARRAY:
-        if (is_int && (uint16_t)v64 == v64) {
-            const uint16_t *pv;
-            uint16_t v;
-        scan16:
-            pv = p->u.array.u.uint16_ptr;
-            v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
-                }
-            }
-        }
+        if (is_int && (uint16_t)v64 == v64)
+            goto scan;
         break;
     case JS_CLASS_INT32_ARRAY:
         if (is_int && (int32_t)v64 == v64)
-            goto scan32;
+            goto scan;
         break;
     case JS_CLASS_UINT32_ARRAY:
-        if (is_int && (uint32_t)v64 == v64) {
-            const uint32_t *pv;
-            uint32_t v;
-        scan32:
-            pv = p->u.array.u.uint32_ptr;
-            v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
-                }
-            }
-        }
+        if (is_int && (uint32_t)v64 == v64)
+            goto scan;
         break;
     case JS_CLASS_FLOAT32_ARRAY:
-        if (is_bigint)
-            break;
-        if (isnan(d)) {
-            const float *pv = p->u.array.u.float_ptr;
-            /* special case: indexOf returns -1, includes finds NaN */
-            if (special != special_includes)
-                goto done;
-            for (; k != stop; k += inc) {
-                if (isnan(pv[k])) {
-                    res = k;
-                    break;
-                }
-            }
-        } else if ((f = (float)d) == d) {
-            const float *pv = p->u.array.u.float_ptr;
-            for (; k != stop; k += inc) {
-                if (pv[k] == f) {
-                    res = k;
-                    break;
-                }
-            }
-        }
-        break;
     case JS_CLASS_FLOAT64_ARRAY:
         if (is_bigint)
             break;
         if (isnan(d)) {
-            const double *pv = p->u.array.u.double_ptr;
             /* special case: indexOf returns -1, includes finds NaN */
             if (special != special_includes)
                 goto done;
-            for (; k != stop; k += inc) {
-                if (isnan(pv[k])) {
-                    res = k;
-                    break;
-                }
-            }
-        } else {
-            const double *pv = p->u.array.u.double_ptr;
-            for (; k != stop; k += inc) {
-                if (pv[k] == d) {
-                    res = k;
-                    break;
-                }
-            }
+        } else if (p->class_id == JS_CLASS_FLOAT32_ARRAY && (float)d != d) {
+            break;
         }
+        res = js_TA_find_float(p->u.array.u.uint8_ptr, k, stop, inc, d,
+                               p->class_id == JS_CLASS_FLOAT32_ARRAY);
         break;
     case JS_CLASS_BIG_INT64_ARRAY:
         if (is_bigint || (is_math_mode(ctx) && is_int &&
                           v64 >= -MAX_SAFE_INTEGER &&
                           v64 <= MAX_SAFE_INTEGER)) {
-            goto scan64;
+            goto scan;
         }
         break;
     case JS_CLASS_BIG_UINT64_ARRAY:
         if (is_bigint || (is_math_mode(ctx) && is_int &&
                           v64 >= 0 && v64 <= MAX_SAFE_INTEGER)) {
-            const uint64_t *pv;
-            uint64_t v;
-        scan64:
-            pv = p->u.array.u.uint64_ptr;
-            v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
-                }
-            }
+        scan:
+            res = js_TA_find_bits(p->u.array.u.uint8_ptr, k, stop, inc, v64,
+                                  typed_array_size_log2(p->class_id));
         }
         break;
     }
@@ -54624,6 +59256,174 @@ static JSValue js_TA_get_float64(JSContext *ctx, const void *a) {
     return __JS_NewFloat64(ctx, *(const double *)a);
 }
 
+/* below this length, the default sort uses rqsort() */
+#define TA_RADIX_SORT_MIN_LEN 64
+
+/* LSD radix sort of unsigned keys using 'b' as temporary buffer. The
+   passes where all the keys have the same byte are skipped. Return the
+   buffer containing the sorted keys. */
+#define DEF_TA_RADIX_SORT(name, type)                                   \
+static type *name(type *a, type *b, size_t len)                        \
+{                                                                       \
+    uint32_t count[sizeof(type)][256], *c, sum, n;                      \
+    size_t i;                                                           \
+    int k, j;                                                           \
+    type v, *t;                                                         \
+                                                                        \
+    memset(count, 0, sizeof(count));                                    \
+    for(i = 0; i < len; i++) {                                          \
+        v = a[i];                                                       \
+        for(k = 0; k < sizeof(type); k++)                               \
+            count[k][(v >> (8 * k)) & 0xff]++;                          \
+    }                                                                   \
+    for(k = 0; k < sizeof(type); k++) {                                 \
+        c = count[k];                                                   \
+        if (c[(a[0] >> (8 * k)) & 0xff] == len)                         \
+            continue;                                                   \
+        sum = 0;                                                        \
+        for(j = 0; j < 256; j++) {                                      \
+            n = c[j];                                                   \
+            c[j] = sum;                                                 \
+            sum += n;                                                   \
+        }                                                               \
+        for(i = 0; i < len; i++) {                                      \
+            v = a[i];                                                   \
+            b[c[(v >> (8 * k)) & 0xff]++] = v;                          \
+        }                                                               \
+        t = a;                                                          \
+        a = b;                                                          \
+        b = t;                                                          \
+    }                                                                   \
+    return a;                                                           \
+}
+
+DEF_TA_RADIX_SORT(js_TA_radix_sort16, uint16_t)
+DEF_TA_RADIX_SORT(js_TA_radix_sort32, uint32_t)
+DEF_TA_RADIX_SORT(js_TA_radix_sort64, uint64_t)
+
+/* counting sort of 8 bit elements. 'bias' is 0x80 for signed elements */
+static void js_TA_counting_sort8(uint8_t *a, size_t len, int bias)
+{
+    uint32_t count[256], n;
+    size_t i;
+    int j;
+
+    memset(count, 0, sizeof(count));
+    for(i = 0; i < len; i++)
+        count[a[i] ^ bias]++;
+    for(j = 0; j < 256; j++) {
+        n = count[j];
+        memset(a, j ^ bias, n);
+        a += n;
+    }
+}
+
+/* Map the elements to unsigned keys of the same order (to_key = TRUE)
+   or back (to_key = FALSE). Signed integers get their sign bit flipped.
+   Negative floats are complemented and the sign bit of the other ones
+   is set, so that -0 < +0. All NaNs are mapped to the largest key. */
+static void js_TA_sort_keys(void *tab, size_t len, int class_id,
+                            BOOL to_key)
+{
+    size_t i;
+
+    switch(class_id) {
+    case JS_CLASS_INT16_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint16_t *)tab)[i] ^= 0x8000;
+        break;
+    case JS_CLASS_INT32_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint32_t *)tab)[i] ^= 0x80000000;
+        break;
+    case JS_CLASS_BIG_INT64_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint64_t *)tab)[i] ^= (uint64_t)1 << 63;
+        break;
+    case JS_CLASS_FLOAT32_ARRAY:
+        {
+            uint32_t *a = tab, v;
+            for(i = 0; i < len; i++) {
+                v = a[i];
+                if (to_key) {
+                    if ((v & 0x7fffffff) > 0x7f800000)
+                        v = 0xffffffff; /* NaN */
+                    else if (v >> 31)
+                        v = ~v;
+                    else
+                        v |= 0x80000000;
+                } else {
+                    if (v >> 31)
+                        v ^= 0x80000000;
+                    else
+                        v = ~v;
+                }
+                a[i] = v;
+            }
+        }
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        {
+            uint64_t *a = tab, v;
+            const uint64_t sign = (uint64_t)1 << 63;
+            for(i = 0; i < len; i++) {
+                v = a[i];
+                if (to_key) {
+                    if ((v & ~sign) > ((uint64_t)0x7ff << 52))
+                        v = UINT64_MAX; /* NaN */
+                    else if (v & sign)
+                        v = ~v;
+                    else
+                        v |= sign;
+                } else {
+                    if (v & sign)
+                        v ^= sign;
+                    else
+                        v = ~v;
+                }
+                a[i] = v;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* default sort of the typed array elements. Return FALSE if the
+   temporary buffer could not be allocated. */
+static BOOL js_TA_radix_sort(JSContext *ctx, void *array_ptr, size_t len,
+                             int class_id, int elt_size)
+{
+    void *tmp, *res;
+
+    if (elt_size == 1) {
+        js_TA_counting_sort8(array_ptr, len,
+                             class_id == JS_CLASS_INT8_ARRAY ? 0x80 : 0);
+        return TRUE;
+    }
+    tmp = js_malloc_rt(ctx->rt, len * elt_size);
+    if (!tmp)
+        return FALSE;
+    js_TA_sort_keys(array_ptr, len, class_id, TRUE);
+    switch(elt_size) {
+    case 2:
+        res = js_TA_radix_sort16(array_ptr, tmp, len);
+        break;
+    case 4:
+        res = js_TA_radix_sort32(array_ptr, tmp, len);
+        break;
+    default:
+        res = js_TA_radix_sort64(array_ptr, tmp, len);
+        break;
+    }
+    if (res != array_ptr)
+        memcpy(array_ptr, res, len * elt_size);
+    js_TA_sort_keys(array_ptr, len, class_id, FALSE);
+    js_free_rt(ctx->rt, tmp);
+    return TRUE;
+}
+
 struct TA_sort_context {
     JSContext *ctx;
     int exception; /* 1 = exception, 2 = detached typed array */
@@ -54812,7 +59612,9 @@ static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
                 js_free(ctx, array_tmp);
             }
             js_free(ctx, array_idx);
-        } else {
+        } else if (len < TA_RADIX_SORT_MIN_LEN ||
+                   !js_TA_radix_sort(ctx, array_ptr, len, p->class_id,
+                                     elt_size)) {
             rqsort(array_ptr, len, elt_size, cmpfun, &tsc);
             if (tsc.exception)
                 return JS_EXCEPTION;
@@ -55060,6 +59862,10 @@ static JSValue js_typed_array_constructor_ta(JSContext *ctx,
     if (p->class_id == classid) {
         /* same type: copy the content */
         memcpy(abuf->data, src_abuf->data + ta->offset, abuf->byte_length);
+    } else if (typed_array_is_bigint(p->class_id) ==
+               typed_array_is_bigint(classid)) {
+        js_TA_convert(abuf->data, classid, src_abuf->data + ta->offset,
+                      p->class_id, len);
     } else {
         for(i = 0; i < len; i++) {
             JSValue val;
@@ -55982,6 +60788,7 @@ void JS_AddIntrinsicTypedArrays(JSContext *ctx)
 void JS_DumpObjects(JSRuntime *rt) {
     struct list_head *el;
     JSGCObjectHeader *p;
+    gc_inc_abort(rt);
     printf("JSObjects: {\n");
     JS_DumpObjectHeader(rt);
     list_for_each(el, &rt->gc_obj_list) {
@@ -72,6 +72,7 @@ enum {
     JS_TAG_BIG_FLOAT   = -9,
     JS_TAG_SYMBOL      = -8,
     JS_TAG_STRING      = -7,
+    JS_TAG_STRING_ROPE = -6, /* string built by concatenation, see JS_IsString() */
     JS_TAG_MODULE      = -3, /* used internally */
     JS_TAG_FUNCTION_BYTECODE = -2, /* used internally */
     JS_TAG_OBJECT      = -1,
@@ -348,6 +349,61 @@ void JS_SetRuntimeOpaque(JSRuntime *rt, void *opaque);
 typedef void JS_MarkFunc(JSRuntime *rt, JSGCObjectHeader *gp);
 void JS_MarkValue(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func);
 void JS_RunGC(JSRuntime *rt);
+/* Incremental cycle collection: when slice_budget_us > 0, the
+   automatic GC runs the cycle collector in slices of about
+   slice_budget_us microseconds interleaved with the execution instead
+   of running it to completion. 0 (default) disables it. */
+void JS_SetGCSliceBudget(JSRuntime *rt, int64_t slice_budget_us);
+/* Run a slice of cycle collection of about budget_us microseconds
+   (< 0: no limit), starting a new collection if none is in
+   progress. Return TRUE if the collection completed. */
+JS_BOOL JS_RunGCSlice(JSRuntime *rt, int64_t budget_us);
+
+typedef struct JSGCStats {
+    int64_t gc_count; /* completed cycle collections */
+    int64_t slice_count; /* incremental slices */
+    int64_t total_time_us; /* time spent in the cycle collector */
+    int64_t max_pause_us; /* longest collection or slice */
+    /* last completed collection */
+    int64_t last_time_us; /* duration (sum of the slices if incremental) */
+    int64_t last_interval_us; /* execution time since the previous one */
+    size_t last_allocated_size; /* heap growth since the previous one */
+    size_t last_size_before; /* heap size before the cycle removal */
+    size_t last_size_after; /* heap size after the cycle removal */
+    /* heap size triggering the next collection, decided by the policy */
+    size_t threshold;
+} JSGCStats;
+
+/* A GC policy is called after each cycle collection and returns the
+   heap size (malloc_size) triggering the next one. The threshold
+   given to JS_SetGCThreshold() is the minimum. */
+typedef size_t JSGCPolicy(JSRuntime *rt, const JSGCStats *stats, void *opaque);
+
+typedef struct JSGCPolicyParams {
+    /* maximum fraction of the time spent in the cycle collector */
+    double target_overhead;
+    /* bounds of the ratio between the threshold and the live heap size */
+    double min_growth;
+    double max_growth;
+} JSGCPolicyParams;
+
+/* Default policy: the heap grows more between two collections when
+   the last one freed little memory or when the collections would
+   take more than target_overhead of the time at the current
+   allocation rate. opaque is a JSGCPolicyParams or NULL for the
+   default parameters (5% overhead, growth between 1.25 and 4). */
+size_t JS_GCAdaptivePolicy(JSRuntime *rt, const JSGCStats *stats, void *opaque);
+/* policy = NULL restores the default policy */
+void JS_SetGCPolicy(JSRuntime *rt, JSGCPolicy *policy, void *opaque);
+void JS_GetGCStats(JSRuntime *rt, JSGCStats *s);
+/* Use an idle period of about budget_us microseconds to advance the
+   cycle collection, starting one if the heap grew by a quarter since
+   the last one or is half way to the next automatic collection.
+   Return TRUE if no collection is in progress when it returns. Nothing
+   is done if budget_us <= 0. */
+JS_BOOL JS_RunIdleGC(JSRuntime *rt, int64_t budget_us);
+/* Shrink the oversized atom, shape and Map/Set hash tables */
+void JS_TrimMemory(JSRuntime *rt);
 JS_BOOL JS_IsLiveObject(JSRuntime *rt, JSValueConst obj);
 
 JSContext *JS_NewContext(JSRuntime *rt);
@@ -616,9 +672,12 @@ static inline JS_BOOL JS_IsUninitialized(JSValueConst v)
     return js_unlikely(JS_VALUE_GET_TAG(v) == JS_TAG_UNINITIALIZED);
 }
 
+/* also true for JS_TAG_STRING_ROPE: use JS_ToCStringLen() or
+   JS_ToString() to access the characters */
 static inline JS_BOOL JS_IsString(JSValueConst v)
 {
-    return JS_VALUE_GET_TAG(v) == JS_TAG_STRING;
+    return JS_VALUE_GET_TAG(v) == JS_TAG_STRING ||
+        JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE;
 }
 
 static inline JS_BOOL JS_IsSymbol(JSValueConst v)